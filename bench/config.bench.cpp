@@ -0,0 +1,155 @@
+#include "config_parser.h"
+#include "results.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <wblib/testing/fake_mqtt.h>
+#include <wblib/testing/testlog.h>
+
+using namespace WBMQTT;
+
+namespace
+{
+    typedef std::chrono::steady_clock TClock;
+
+    const size_t CONTROLS = 50000;
+    const size_t CONTROLS_PER_GROUP = 100;
+
+    int64_t ElapsedMs(TClock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(TClock::now() - start).count();
+    }
+
+    std::string GetDeviceId(size_t index)
+    {
+        return "bench" + std::to_string(index / CONTROLS_PER_GROUP);
+    }
+
+    std::string GetControlId(size_t index)
+    {
+        return "c" + std::to_string(index % CONTROLS_PER_GROUP);
+    }
+
+    //! Groups with every second control of the devices, every group has enabled controls
+    Json::Value MakeConfig()
+    {
+        Json::Value config(Json::objectValue);
+        config["groups"] = Json::Value(Json::arrayValue);
+        for (size_t i = 0; i < CONTROLS; i += 2) {
+            if (i % CONTROLS_PER_GROUP == 0) {
+                Json::Value group(Json::objectValue);
+                group["name"] = GetDeviceId(i);
+                group["enabled"] = true;
+                group["controls"] = Json::Value(Json::arrayValue);
+                config["groups"].append(group);
+            }
+            Json::Value control(Json::objectValue);
+            control["topic"] = GetDeviceId(i) + "/" + GetControlId(i);
+            control["enabled"] = (i % 4 == 0);
+            config["groups"][config["groups"].size() - 1]["controls"].append(control);
+        }
+        return config;
+    }
+
+    void Write(const Json::Value& config, const std::string& fileName)
+    {
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "    ";
+        std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+        std::ofstream file(fileName);
+        writer->write(config, &file);
+    }
+}
+
+class TConfigBenchmark: public Testing::TLoggedFixture
+{
+protected:
+    std::string ConfigFile;
+    std::string SchemaFile;
+
+    void SetUp() override
+    {
+        ConfigFile = (std::filesystem::temp_directory_path() / ("wb-mqtt-opcua-bench-" + std::to_string(getpid())))
+                         .string();
+        SchemaFile = GetDataFilePath("../wb-mqtt-opcua.schema.json");
+    }
+
+    // Benchmarks don't compare MQTT traffic with reference logs
+    void TearDown() override
+    {
+        std::filesystem::remove(ConfigFile);
+    }
+};
+
+/**! Synthetic config of 50k controls in 500 groups, half of the controls of 500 MQTT devices are configured.
+ *   Measures:
+ *     - load: parsing, validation and building of the nodes config, the first load also parses the schema;
+ *     - merge: adding of unconfigured MQTT controls by the config generator;
+ *     - write: validation and atomic writing of the merged config.
+ */
+TEST_F(TConfigBenchmark, controls)
+{
+    auto config = MakeConfig();
+    Write(config, ConfigFile);
+
+    TConfig cfg;
+    auto start = TClock::now();
+    LoadConfig(cfg, ConfigFile, SchemaFile);
+    auto firstLoadMs = ElapsedMs(start);
+    start = TClock::now();
+    LoadConfig(cfg, ConfigFile, SchemaFile);
+    auto loadMs = ElapsedMs(start);
+    ASSERT_EQ(CONTROLS / CONTROLS_PER_GROUP, cfg.OpcUa.ObjectNodes.size());
+
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto publisher =
+        NewDriver(TDriverArgs{}.SetId("bench-publisher").SetBackend(NewDriverBackend(mqttBroker->MakeClient("pub"))));
+    publisher->StartLoop();
+    publisher->WaitForReady();
+    {
+        auto tx = publisher->BeginTx();
+        PLocalDevice device;
+        for (size_t i = 0; i < CONTROLS; ++i) {
+            if (i % CONTROLS_PER_GROUP == 0) {
+                device = tx->CreateDevice(TLocalDeviceArgs{}.SetId(GetDeviceId(i))).GetValue();
+            }
+            device->CreateControl(tx, TControlArgs{}.SetId(GetControlId(i)).SetType("value").SetRawValue("0"))
+                .GetValue();
+        }
+    }
+
+    auto generator =
+        NewDriver(TDriverArgs{}.SetId("bench-generator").SetBackend(NewDriverBackend(mqttBroker->MakeClient("gen"))));
+    generator->StartLoop();
+    start = TClock::now();
+    UpdateConfig(generator, config);
+    auto mergeMs = ElapsedMs(start);
+    generator->StopLoop();
+    publisher->StopLoop();
+
+    size_t controls = 0;
+    for (const auto& group: config["groups"]) {
+        controls += group["controls"].size();
+    }
+    ASSERT_EQ(CONTROLS, controls);
+
+    Write(config, ConfigFile);
+    start = TClock::now();
+    UpdateConfig(ConfigFile, SchemaFile);
+    auto writeMs = ElapsedMs(start);
+
+    Bench::Report("config",
+                  {{"controls", CONTROLS},
+                   {"first_load_ms", firstLoadMs},
+                   {"load_ms", loadMs},
+                   {"merge_ms", mergeMs},
+                   {"write_ms", writeMs}});
+}
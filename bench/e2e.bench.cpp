@@ -0,0 +1,351 @@
+#include "OPCUAServer.h"
+#include "latency.h"
+#include "results.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <open62541/client_config_default.h>
+#include <open62541/client_highlevel.h>
+#include <open62541/client_subscriptions.h>
+
+#include <wblib/testing/fake_mqtt.h>
+#include <wblib/testing/testlog.h>
+
+using namespace WBMQTT;
+
+namespace
+{
+    typedef std::chrono::steady_clock TClock;
+
+    const size_t CONTROLS_PER_GROUP = 100;
+    const uint16_t FIRST_PORT = 48400;
+    const size_t READ_BATCH_SIZE = 1000;
+    const auto READ_DURATION = std::chrono::seconds(1);
+    const size_t SINGLE_READS = 1000;
+    const size_t NOTIFICATIONS = 100;
+    const size_t WRITES = 200;
+    const auto VALUES_TIMEOUT = std::chrono::seconds(300);
+
+    int64_t ElapsedMs(TClock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(TClock::now() - start).count();
+    }
+
+    std::string GetDeviceId(size_t index)
+    {
+        return "bench" + std::to_string(index / CONTROLS_PER_GROUP);
+    }
+
+    std::string GetControlId(size_t index)
+    {
+        return "c" + std::to_string(index % CONTROLS_PER_GROUP);
+    }
+
+    //! MQTT devices with writable controls published by a separate driver, as by a real device driver
+    class TPublisher
+    {
+    public:
+        TPublisher(Testing::PFakeMqttBroker broker, size_t controlsCount)
+        {
+            auto driverId = "bench-publisher" + std::to_string(controlsCount);
+            Driver = NewDriver(TDriverArgs{}.SetId(driverId).SetBackend(NewDriverBackend(broker->MakeClient(driverId))));
+            Driver->StartLoop();
+            Driver->WaitForReady();
+
+            auto tx = Driver->BeginTx();
+            PLocalDevice device;
+            for (size_t i = 0; i < controlsCount; ++i) {
+                if (i % CONTROLS_PER_GROUP == 0) {
+                    device = tx->CreateDevice(TLocalDeviceArgs{}.SetId(GetDeviceId(i))).GetValue();
+                }
+                Controls.push_back(device
+                                       ->CreateControl(tx,
+                                                       TControlArgs{}
+                                                           .SetId(GetControlId(i))
+                                                           .SetType("value")
+                                                           .SetReadonly(false)
+                                                           .SetRawValue("0"))
+                                       .GetValue());
+            }
+        }
+
+        ~TPublisher()
+        {
+            Driver->StopLoop();
+        }
+
+        void SetValue(size_t index, double value)
+        {
+            auto tx = Driver->BeginTx();
+            Controls[index]->SetValue(tx, value).Sync();
+        }
+
+    private:
+        PDeviceDriver Driver;
+        std::vector<PControl> Controls;
+    };
+
+    class TClient
+    {
+    public:
+        explicit TClient(uint16_t port): Client(UA_Client_new())
+        {
+            UA_ClientConfig_setDefault(UA_Client_getConfig(Client));
+            Url = "opc.tcp://localhost:" + std::to_string(port);
+        }
+
+        ~TClient()
+        {
+            UA_Client_disconnect(Client);
+            UA_Client_delete(Client);
+        }
+
+        TClient(const TClient&) = delete;
+        TClient& operator=(const TClient&) = delete;
+
+        //! Retries until the server starts listening
+        void Connect()
+        {
+            while (UA_Client_connect(Client, Url.c_str()) != UA_STATUSCODE_GOOD) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        //! Reads values of the nodes in batches, returns the number of values with good status
+        size_t Read(const std::vector<UA_NodeId>& nodeIds)
+        {
+            size_t good = 0;
+            std::vector<UA_ReadValueId> items(std::min(nodeIds.size(), READ_BATCH_SIZE));
+            for (size_t first = 0; first < nodeIds.size(); first += READ_BATCH_SIZE) {
+                size_t count = std::min(READ_BATCH_SIZE, nodeIds.size() - first);
+                for (size_t i = 0; i < count; ++i) {
+                    UA_ReadValueId_init(&items[i]);
+                    items[i].nodeId = nodeIds[first + i];
+                    items[i].attributeId = UA_ATTRIBUTEID_VALUE;
+                }
+                UA_ReadRequest request;
+                UA_ReadRequest_init(&request);
+                request.nodesToRead = items.data();
+                request.nodesToReadSize = count;
+                auto response = UA_Client_Service_read(Client, request);
+                if (response.responseHeader.serviceResult == UA_STATUSCODE_GOOD) {
+                    for (size_t i = 0; i < response.resultsSize; ++i) {
+                        if (response.results[i].hasValue && (!response.results[i].hasStatus ||
+                                                              response.results[i].status == UA_STATUSCODE_GOOD))
+                        {
+                            ++good;
+                        }
+                    }
+                }
+                UA_ReadResponse_clear(&response);
+            }
+            return good;
+        }
+
+        UA_Client* Get() const
+        {
+            return Client;
+        }
+
+    private:
+        UA_Client* Client;
+        std::string Url;
+    };
+
+    //! Latest value notified by monitored item with the node index as context
+    struct TNotifications
+    {
+        std::vector<std::atomic<double>> Values;
+
+        explicit TNotifications(size_t count): Values(count)
+        {}
+    };
+
+    extern "C" {
+    void DataChangeNotificationCallback(UA_Client* client,
+                                        UA_UInt32 subId,
+                                        void* subContext,
+                                        UA_UInt32 monId,
+                                        void* monContext,
+                                        UA_DataValue* value)
+    {
+        if (value->hasValue && UA_Variant_hasScalarType(&value->value, &UA_TYPES[UA_TYPES_DOUBLE])) {
+            auto notifications = static_cast<TNotifications*>(subContext);
+            notifications->Values[reinterpret_cast<size_t>(monContext)] = *static_cast<UA_Double*>(value->value.data);
+        }
+    }
+    }
+
+    OPCUA::TServerConfig MakeConfig(size_t controlsCount, uint16_t port)
+    {
+        OPCUA::TServerConfig config;
+        config.BindPort = port;
+        for (size_t i = 0; i < controlsCount; ++i) {
+            config.ObjectNodes[GetDeviceId(i)].push_back(
+                OPCUA::TVariableNodeConfig{GetDeviceId(i) + "/" + GetControlId(i)});
+        }
+        return config;
+    }
+
+    std::vector<std::string> MakeNodeNames(size_t controlsCount)
+    {
+        std::vector<std::string> res;
+        for (size_t i = 0; i < controlsCount; ++i) {
+            res.push_back(GetDeviceId(i) + "/" + GetControlId(i));
+        }
+        return res;
+    }
+
+    //! Node ids point to the names, which must outlive them
+    std::vector<UA_NodeId> MakeNodeIds(const std::vector<std::string>& nodeNames)
+    {
+        std::vector<UA_NodeId> res;
+        for (const auto& name: nodeNames) {
+            res.push_back(UA_NODEID_STRING(1, (char*)name.c_str()));
+        }
+        return res;
+    }
+}
+
+class TEndToEndBenchmark: public Testing::TLoggedFixture
+{
+protected:
+    // Benchmarks don't compare MQTT traffic with reference logs
+    void TearDown() override
+    {}
+};
+
+/**! Starts the server with 100/1k/10k/50k controls published by another MQTT driver
+ *   and drives it by open62541 client over TCP. Measures:
+ *     - startup: constructor time, time to the first connection and to receiving of all values from MQTT;
+ *     - read: throughput of batched reads of all nodes and latency of single node reads;
+ *     - notify: time from publishing a value to MQTT to data change notification of a subscription;
+ *     - write: round-trip of a client write confirmed after publishing to MQTT.
+ */
+TEST_F(TEndToEndBenchmark, controls)
+{
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+
+    uint16_t port = FIRST_PORT;
+    for (size_t count: {100, 1000, 10000, 50000}) {
+        TPublisher publisher(mqttBroker, count);
+
+        // The server doesn't unsubscribe from driver events, so every server gets its own driver
+        auto driverId = "bench-server" + std::to_string(count);
+        auto driver = NewDriver(TDriverArgs{}.SetId(driverId).SetBackend(NewDriverBackend(mqttBroker->MakeClient(driverId))));
+        driver->StartLoop();
+        driver->WaitForReady();
+
+        auto nodeNames = MakeNodeNames(count);
+        auto nodeIds = MakeNodeIds(nodeNames);
+        auto config = MakeConfig(count, port++);
+
+        auto start = TClock::now();
+        auto server = std::make_unique<OPCUA::TServerImpl>(config, driver);
+        auto startupMs = ElapsedMs(start);
+
+        auto client = std::make_unique<TClient>(config.BindPort);
+        client->Connect();
+        auto connectMs = ElapsedMs(start);
+
+        while (client->Read(nodeIds) != count) {
+            ASSERT_LT(TClock::now() - start, VALUES_TIMEOUT) << "Not all values are received from MQTT";
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        auto valuesMs = ElapsedMs(start);
+
+        Bench::Report("e2e_startup",
+                      {{"controls", count},
+                       {"startup_ms", startupMs},
+                       {"connect_ms", connectMs},
+                       {"values_ms", valuesMs}});
+
+        size_t reads = 0;
+        start = TClock::now();
+        while (TClock::now() - start < READ_DURATION) {
+            ASSERT_EQ(count, client->Read(nodeIds));
+            reads += count;
+        }
+        auto readsPerS = reads / std::chrono::duration<double>(TClock::now() - start).count();
+
+        OPCUA::TLatencyHistogram readLatency;
+        for (size_t i = 0; i < SINGLE_READS; ++i) {
+            UA_Variant value;
+            UA_Variant_init(&value);
+            {
+                OPCUA::TLatencyTimer timer(readLatency);
+                ASSERT_EQ(UA_STATUSCODE_GOOD, UA_Client_readValueAttribute(client->Get(), nodeIds[i % count], &value));
+            }
+            UA_Variant_clear(&value);
+        }
+
+        Bench::Report("e2e_read",
+                      {{"controls", count},
+                       {"reads_per_s", readsPerS},
+                       {"p50_us", readLatency.GetPercentileUs(50)},
+                       {"p99_us", readLatency.GetPercentileUs(99)}});
+
+        size_t monitoredCount = std::min(count, CONTROLS_PER_GROUP);
+        TNotifications notifications(monitoredCount);
+        auto subscriptionRequest = UA_CreateSubscriptionRequest_default();
+        subscriptionRequest.requestedPublishingInterval = 0;
+        auto subscription =
+            UA_Client_Subscriptions_create(client->Get(), subscriptionRequest, &notifications, nullptr, nullptr);
+        ASSERT_EQ(UA_STATUSCODE_GOOD, subscription.responseHeader.serviceResult);
+        for (size_t i = 0; i < monitoredCount; ++i) {
+            auto itemRequest = UA_MonitoredItemCreateRequest_default(nodeIds[i]);
+            itemRequest.requestedParameters.samplingInterval = 0;
+            auto item = UA_Client_MonitoredItems_createDataChange(client->Get(),
+                                                                  subscription.subscriptionId,
+                                                                  UA_TIMESTAMPSTORETURN_BOTH,
+                                                                  itemRequest,
+                                                                  reinterpret_cast<void*>(i),
+                                                                  DataChangeNotificationCallback,
+                                                                  nullptr);
+            ASSERT_EQ(UA_STATUSCODE_GOOD, item.statusCode);
+        }
+
+        OPCUA::TLatencyHistogram notifyLatency;
+        for (size_t i = 0; i < NOTIFICATIONS; ++i) {
+            auto index = i % monitoredCount;
+            double value = i + 1;
+            start = TClock::now();
+            publisher.SetValue(index, value);
+            while (notifications.Values[index] != value) {
+                ASSERT_EQ(UA_STATUSCODE_GOOD, UA_Client_run_iterate(client->Get(), 1));
+                ASSERT_LT(TClock::now() - start, std::chrono::seconds(10)) << "No notification";
+            }
+            notifyLatency.Add(TClock::now() - start);
+        }
+
+        Bench::Report("e2e_notify",
+                      {{"controls", count},
+                       {"p50_us", notifyLatency.GetPercentileUs(50)},
+                       {"p99_us", notifyLatency.GetPercentileUs(99)}});
+
+        OPCUA::TLatencyHistogram writeLatency;
+        for (size_t i = 0; i < WRITES; ++i) {
+            UA_Double value = i;
+            UA_Variant variant;
+            UA_Variant_setScalar(&variant, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+            OPCUA::TLatencyTimer timer(writeLatency);
+            ASSERT_EQ(UA_STATUSCODE_GOOD, UA_Client_writeValueAttribute(client->Get(), nodeIds[i % count], &variant));
+        }
+
+        Bench::Report("e2e_write",
+                      {{"controls", count},
+                       {"p50_us", writeLatency.GetPercentileUs(50)},
+                       {"p99_us", writeLatency.GetPercentileUs(99)}});
+
+        client.reset();
+        server.reset();
+        driver->StopLoop();
+    }
+}
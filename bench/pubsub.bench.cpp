@@ -0,0 +1,162 @@
+#include "OPCUAServer.h"
+#include "results.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <wblib/testing/fake_mqtt.h>
+#include <wblib/testing/testlog.h>
+
+using namespace WBMQTT;
+
+namespace
+{
+    typedef std::chrono::steady_clock TClock;
+
+    const uint16_t PORT = 48600;
+    const char* MULTICAST_GROUP = "224.0.0.22";
+    const char* LOOPBACK = "127.0.0.1";
+    const size_t CONTROLS = 100;
+    const auto PUBLISHING_INTERVAL = std::chrono::milliseconds(10);
+    const auto FIRST_MESSAGE_TIMEOUT = std::chrono::seconds(2);
+    const auto RECEIVE_DURATION = std::chrono::seconds(1);
+
+    //! UDP socket joined to the multicast group on loopback, as a PubSub subscriber
+    class TSubscriber
+    {
+    public:
+        TSubscriber(): Socket(socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0))
+        {
+            int reuse = 1;
+            setsockopt(Socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(PORT);
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            bind(Socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+            ip_mreq membership{};
+            inet_pton(AF_INET, MULTICAST_GROUP, &membership.imr_multiaddr);
+            inet_pton(AF_INET, LOOPBACK, &membership.imr_interface);
+            setsockopt(Socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership));
+        }
+
+        ~TSubscriber()
+        {
+            close(Socket);
+        }
+
+        TSubscriber(const TSubscriber&) = delete;
+        TSubscriber& operator=(const TSubscriber&) = delete;
+
+        //! Reads all pending datagrams, returns their number
+        size_t Receive()
+        {
+            char buf[65536];
+            size_t count = 0;
+            while (recv(Socket, buf, sizeof(buf), 0) > 0) {
+                ++count;
+            }
+            return count;
+        }
+
+        int GetSocket() const
+        {
+            return Socket;
+        }
+
+    private:
+        int Socket;
+    };
+
+    //! Waits for datagrams on all subscribers for the duration, returns the number of received ones by subscriber
+    std::vector<size_t> Receive(std::vector<std::unique_ptr<TSubscriber>>& subscribers, TClock::duration duration)
+    {
+        std::vector<pollfd> fds;
+        for (const auto& subscriber: subscribers) {
+            fds.push_back(pollfd{subscriber->GetSocket(), POLLIN, 0});
+        }
+        std::vector<size_t> res(subscribers.size());
+        auto start = TClock::now();
+        while (TClock::now() - start < duration) {
+            if (poll(fds.data(), fds.size(), 10) > 0) {
+                for (size_t i = 0; i < subscribers.size(); ++i) {
+                    res[i] += subscribers[i]->Receive();
+                }
+            }
+        }
+        return res;
+    }
+}
+
+class TPubSubBenchmark: public Testing::TLoggedFixture
+{
+protected:
+    // Benchmarks don't compare MQTT traffic with reference logs
+    void TearDown() override
+    {}
+};
+
+/**! Publishes a group of 100 controls every 10 ms over UDP multicast on loopback
+ *   and receives the messages by 1, 4 and 16 subscriber sockets.
+ *   The gateway sends every message once, so its rate doesn't depend on the number of subscribers.
+ */
+TEST_F(TPubSubBenchmark, subscribers)
+{
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto driver = NewDriver(
+        TDriverArgs{}.SetId("bench-pubsub").SetBackend(NewDriverBackend(mqttBroker->MakeClient("bench-pubsub"))));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    OPCUA::TServerConfig config;
+    config.BindPort = PORT;
+    config.PubSubAddress = std::string("opc.udp://") + MULTICAST_GROUP + ":" + std::to_string(PORT) + "/";
+    config.PubSubInterface = LOOPBACK;
+    config.PubSubInterval = PUBLISHING_INTERVAL;
+    for (size_t i = 0; i < CONTROLS; ++i) {
+        OPCUA::TVariableNodeConfig variableNode{"bench/c" + std::to_string(i)};
+        variableNode.PubSubWriterId = 1;
+        config.ObjectNodes["bench"].push_back(variableNode);
+    }
+    auto server = std::make_unique<OPCUA::TServerImpl>(config, driver);
+
+    for (size_t count: {1, 4, 16}) {
+        std::vector<std::unique_ptr<TSubscriber>> subscribers;
+        for (size_t i = 0; i < count; ++i) {
+            subscribers.push_back(std::make_unique<TSubscriber>());
+        }
+        auto first = Receive(subscribers, FIRST_MESSAGE_TIMEOUT);
+        if (first.front() == 0) {
+            GTEST_SKIP() << "Multicast on loopback is not available";
+        }
+
+        auto start = TClock::now();
+        auto received = Receive(subscribers, RECEIVE_DURATION);
+        auto seconds = std::chrono::duration<double>(TClock::now() - start).count();
+        size_t total = 0;
+        size_t minReceived = received.front();
+        for (auto r: received) {
+            total += r;
+            minReceived = std::min(minReceived, r);
+        }
+
+        Bench::Report("pubsub",
+                      {{"subscribers", count},
+                       {"messages_per_s", minReceived / seconds},
+                       {"received_per_s", total / seconds}});
+    }
+
+    server.reset();
+    driver->StopLoop();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Bench
+{
+    typedef std::vector<std::pair<std::string, double>> TMetrics;
+
+    /**! Prints a benchmark result as one JSON object per line.
+     *   If BENCH_RESULTS environment variable is set, the line is also appended to the file,
+     *   so results of different package versions can be compared by scripts.
+     */
+    inline void Report(const std::string& name, const TMetrics& metrics)
+    {
+        std::stringstream line;
+        line.precision(15);
+        line << "{\"bench\":\"" << name << "\"";
+        for (const auto& metric: metrics) {
+            line << ",\"" << metric.first << "\":" << metric.second;
+        }
+        line << "}";
+
+        std::cout << line.str() << std::endl;
+        auto path = std::getenv("BENCH_RESULTS");
+        if (path && *path) {
+            std::ofstream file(path, std::ios::app);
+            file << line.str() << std::endl;
+        }
+    }
+}
@@ -0,0 +1,233 @@
+#include "OPCUAServer.h"
+#include "latency.h"
+#include "results.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <open62541/client_config_default.h>
+#include <open62541/client_highlevel.h>
+
+#include <wblib/testing/fake_mqtt.h>
+#include <wblib/testing/testlog.h>
+
+using namespace WBMQTT;
+
+namespace
+{
+    typedef std::chrono::steady_clock TClock;
+
+    const uint16_t PORT = 48500;
+    const size_t HANDSHAKES = 20;
+    const size_t READ_BATCH_SIZE = 1000;
+    const auto READ_DURATION = std::chrono::seconds(1);
+
+    const char* CLIENT_APPLICATION_URI = "urn:wb-mqtt-opcua.bench.client";
+
+    struct TPolicy
+    {
+        std::string Name;
+
+        //! Empty for the None policy
+        std::string Uri;
+    };
+
+    const std::vector<TPolicy> Policies = {
+        {"None", ""},
+        {"Basic256Sha256", "http://opcfoundation.org/UA/SecurityPolicy#Basic256Sha256"},
+        {"Aes128_Sha256_RsaOaep", "http://opcfoundation.org/UA/SecurityPolicy#Aes128_Sha256_RsaOaep"}};
+
+    //! Self-signed certificate and key in DER format, generated by openssl
+    struct TCertificate
+    {
+        std::string CertificatePath;
+        std::string PrivateKeyPath;
+        std::string CertificateBytes;
+        std::string PrivateKeyBytes;
+
+        UA_ByteString GetCertificate()
+        {
+            return UA_ByteString{CertificateBytes.size(), (UA_Byte*)CertificateBytes.data()};
+        }
+
+        UA_ByteString GetPrivateKey()
+        {
+            return UA_ByteString{PrivateKeyBytes.size(), (UA_Byte*)PrivateKeyBytes.data()};
+        }
+    };
+
+    std::string ReadFile(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    //! Returns false if openssl is not available
+    bool MakeCertificate(const std::filesystem::path& dir,
+                         const std::string& name,
+                         const std::string& applicationUri,
+                         TCertificate& res)
+    {
+        auto pem = (dir / (name + ".pem")).string();
+        auto keyPem = (dir / (name + "_key.pem")).string();
+        res.CertificatePath = (dir / (name + ".der")).string();
+        res.PrivateKeyPath = (dir / (name + "_key.der")).string();
+        auto command = "openssl req -x509 -newkey rsa:2048 -nodes -sha256 -days 1 -subj /CN=" + name +
+                       " -addext subjectAltName=URI:" + applicationUri + ",DNS:localhost" +
+                       " -addext keyUsage=digitalSignature,nonRepudiation,keyEncipherment,dataEncipherment" +
+                       " -keyout " + keyPem + " -out " + pem + " >/dev/null 2>&1" +
+                       " && openssl x509 -in " + pem + " -outform DER -out " + res.CertificatePath +
+                       " && openssl rsa -in " + keyPem + " -outform DER -out " + res.PrivateKeyPath +
+                       " >/dev/null 2>&1";
+        if (std::system(command.c_str()) != 0) {
+            return false;
+        }
+        res.CertificateBytes = ReadFile(res.CertificatePath);
+        res.PrivateKeyBytes = ReadFile(res.PrivateKeyPath);
+        return !res.CertificateBytes.empty() && !res.PrivateKeyBytes.empty();
+    }
+
+    UA_Client* MakeClient(const TPolicy& policy, TCertificate& certificate)
+    {
+        auto client = UA_Client_new();
+        auto config = UA_Client_getConfig(client);
+        if (policy.Uri.empty()) {
+            UA_ClientConfig_setDefault(config);
+            return client;
+        }
+        UA_ClientConfig_setDefaultEncryption(config,
+                                             certificate.GetCertificate(),
+                                             certificate.GetPrivateKey(),
+                                             nullptr,
+                                             0,
+                                             nullptr,
+                                             0);
+        config->securityMode = UA_MESSAGESECURITYMODE_SIGNANDENCRYPT;
+        UA_String_clear(&config->securityPolicyUri);
+        config->securityPolicyUri = UA_String_fromChars(policy.Uri.c_str());
+        // Must match the URI of the client certificate
+        UA_String_clear(&config->clientDescription.applicationUri);
+        config->clientDescription.applicationUri = UA_String_fromChars(CLIENT_APPLICATION_URI);
+        return client;
+    }
+
+    //! Reads server current time in batches, returns the number of values with good status
+    size_t Read(UA_Client* client)
+    {
+        std::vector<UA_ReadValueId> items(READ_BATCH_SIZE);
+        for (auto& item: items) {
+            UA_ReadValueId_init(&item);
+            item.nodeId = UA_NODEID_NUMERIC(0, UA_NS0ID_SERVER_SERVERSTATUS_CURRENTTIME);
+            item.attributeId = UA_ATTRIBUTEID_VALUE;
+        }
+        UA_ReadRequest request;
+        UA_ReadRequest_init(&request);
+        request.nodesToRead = items.data();
+        request.nodesToReadSize = items.size();
+        auto response = UA_Client_Service_read(client, request);
+        size_t good = 0;
+        if (response.responseHeader.serviceResult == UA_STATUSCODE_GOOD) {
+            for (size_t i = 0; i < response.resultsSize; ++i) {
+                if (response.results[i].hasValue) {
+                    ++good;
+                }
+            }
+        }
+        UA_ReadResponse_clear(&response);
+        return good;
+    }
+}
+
+class TSecurityBenchmark: public Testing::TLoggedFixture
+{
+protected:
+    std::filesystem::path Dir;
+
+    void SetUp() override
+    {
+        Dir = std::filesystem::temp_directory_path() / ("wb-mqtt-opcua-bench-" + std::to_string(getpid()));
+        std::filesystem::create_directories(Dir);
+    }
+
+    // Benchmarks don't compare MQTT traffic with reference logs
+    void TearDown() override
+    {
+        std::filesystem::remove_all(Dir);
+    }
+};
+
+/**! Starts the server with None, Basic256Sha256 and Aes128_Sha256_RsaOaep endpoints and connects to it
+ *   in SignAndEncrypt mode of every policy. Measures:
+ *     - handshake: time of opening a secure channel and activating a session, mostly asymmetric operations;
+ *     - read: throughput of batched reads over an established channel, symmetric operations only.
+ */
+TEST_F(TSecurityBenchmark, policies)
+{
+    TCertificate serverCertificate;
+    TCertificate clientCertificate;
+    if (!MakeCertificate(Dir, "server", "urn:wb-mqtt-opcua.server.application", serverCertificate) ||
+        !MakeCertificate(Dir, "client", CLIENT_APPLICATION_URI, clientCertificate))
+    {
+        GTEST_SKIP() << "openssl is required to generate certificates";
+    }
+
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto driver = NewDriver(
+        TDriverArgs{}.SetId("bench-security").SetBackend(NewDriverBackend(mqttBroker->MakeClient("bench-security"))));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    OPCUA::TServerConfig config;
+    config.BindPort = PORT;
+    config.Certificate = serverCertificate.CertificatePath;
+    config.PrivateKey = serverCertificate.PrivateKeyPath;
+    config.ObjectNodes["bench"].push_back(OPCUA::TVariableNodeConfig{"bench/c0"});
+    auto server = std::make_unique<OPCUA::TServerImpl>(config, driver);
+    auto url = "opc.tcp://localhost:" + std::to_string(PORT);
+
+    for (const auto& policy: Policies) {
+        OPCUA::TLatencyHistogram handshakeLatency;
+        for (size_t i = 0; i < HANDSHAKES; ++i) {
+            auto client = MakeClient(policy, clientCertificate);
+            UA_StatusCode res;
+            {
+                OPCUA::TLatencyTimer timer(handshakeLatency);
+                res = UA_Client_connect(client, url.c_str());
+            }
+            UA_Client_disconnect(client);
+            UA_Client_delete(client);
+            ASSERT_EQ(UA_STATUSCODE_GOOD, res) << policy.Name;
+        }
+
+        auto client = MakeClient(policy, clientCertificate);
+        ASSERT_EQ(UA_STATUSCODE_GOOD, UA_Client_connect(client, url.c_str())) << policy.Name;
+        size_t reads = 0;
+        auto start = TClock::now();
+        while (TClock::now() - start < READ_DURATION) {
+            ASSERT_EQ(READ_BATCH_SIZE, Read(client)) << policy.Name;
+            reads += READ_BATCH_SIZE;
+        }
+        auto readsPerS = reads / std::chrono::duration<double>(TClock::now() - start).count();
+        UA_Client_disconnect(client);
+        UA_Client_delete(client);
+
+        Bench::Report("security_" + policy.Name,
+                      {{"handshake_p50_us", handshakeLatency.GetPercentileUs(50)},
+                       {"handshake_p99_us", handshakeLatency.GetPercentileUs(99)},
+                       {"reads_per_s", readsPerS}});
+    }
+
+    server.reset();
+    driver->StopLoop();
+}
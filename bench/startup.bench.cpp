@@ -0,0 +1,77 @@
+#include "OPCUAServer.h"
+#include "results.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+
+#include <wblib/testing/fake_mqtt.h>
+#include <wblib/testing/testlog.h>
+
+using namespace WBMQTT;
+
+namespace
+{
+    typedef std::chrono::steady_clock TClock;
+
+    const size_t CONTROLS_PER_GROUP = 100;
+
+    int64_t ElapsedMs(TClock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(TClock::now() - start).count();
+    }
+
+    OPCUA::TServerConfig MakeConfig(size_t controlsCount)
+    {
+        OPCUA::TServerConfig config;
+        for (size_t i = 0; i < controlsCount; ++i) {
+            auto deviceId = "device" + std::to_string(i / CONTROLS_PER_GROUP);
+            config.ObjectNodes[deviceId].push_back(
+                OPCUA::TVariableNodeConfig{deviceId + "/control" + std::to_string(i % CONTROLS_PER_GROUP)});
+        }
+        return config;
+    }
+}
+
+class TStartupBenchmark: public Testing::TLoggedFixture
+{
+protected:
+    // Benchmarks don't compare MQTT traffic with reference logs
+    void TearDown() override
+    {}
+};
+
+// Measures server startup with 100/1k/10k/50k configured controls, which are not yet published to MQTT.
+// The time is dominated by building the address space
+TEST_F(TStartupBenchmark, address_space)
+{
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+
+    for (size_t count: {100, 1000, 10000, 50000}) {
+        // The server doesn't unsubscribe from driver events, so every server gets its own driver
+        auto driverId = "bench" + std::to_string(count);
+        auto mqttClient = mqttBroker->MakeClient(driverId);
+        auto backend = NewDriverBackend(mqttClient);
+        auto driver = NewDriver(TDriverArgs{}.SetId(driverId).SetBackend(backend));
+        driver->StartLoop();
+        driver->WaitForReady();
+
+        auto config = MakeConfig(count);
+
+        auto start = TClock::now();
+        auto server = std::make_unique<OPCUA::TServerImpl>(config, driver);
+        auto startupMs = ElapsedMs(start);
+
+        start = TClock::now();
+        server.reset();
+        auto shutdownMs = ElapsedMs(start);
+        driver->StopLoop();
+
+        Bench::Report("startup",
+                      {{"controls", count},
+                       {"groups", config.ObjectNodes.size()},
+                       {"startup_ms", startupMs},
+                       {"shutdown_ms", shutdownMs}});
+    }
+}
@@ -0,0 +1,231 @@
+#include "OPCUAServer.h"
+#include "results.h"
+#include "write_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <open62541/client_config_default.h>
+#include <open62541/client_highlevel.h>
+
+#include <wblib/testing/fake_mqtt.h>
+#include <wblib/testing/testlog.h>
+
+using namespace WBMQTT;
+
+namespace
+{
+    typedef std::chrono::steady_clock TClock;
+
+    const uint16_t BASE_PORT = 48800;
+    const auto CONNECT_TIMEOUT = std::chrono::seconds(2);
+    const auto PUBLISH_TIMEOUT = std::chrono::seconds(10);
+
+    int64_t ElapsedUs(TClock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(TClock::now() - start).count();
+    }
+
+    class TBenchServer: public OPCUA::TServerImpl
+    {
+    public:
+        using TServerImpl::TServerImpl;
+        using TServerImpl::GetWriteQueue;
+    };
+
+    //! Results of one OPC UA Write request with a node per control
+    struct TWriteServiceResult
+    {
+        //! Time until the client gets the response
+        int64_t ResponseUs = 0;
+
+        //! Time until all values are published to MQTT
+        int64_t PublishedUs = 0;
+    };
+
+    //! Writes all controls in one Write request of a client session and waits for publishing of the values
+    TWriteServiceResult WriteService(PDeviceDriver driver,
+                                     const std::string& deviceId,
+                                     const std::vector<PControl>& controls,
+                                     OPCUA::TWriteMode mode,
+                                     uint16_t port)
+    {
+        OPCUA::TServerConfig config;
+        config.BindPort = port;
+        config.WriteMode = mode;
+        config.WriteQueueSize = controls.size();
+        for (const auto& control: controls) {
+            config.ObjectNodes[deviceId].push_back(OPCUA::TVariableNodeConfig{deviceId + "/" + control->GetId()});
+        }
+        auto server = std::make_unique<TBenchServer>(config, driver);
+        driver->WaitForReady();
+        for (const auto& control: controls) {
+            server->ControlValueEventCallback(TControlValueEvent(control, "0"));
+        }
+
+        std::vector<std::string> nodeNames;
+        for (const auto& control: controls) {
+            nodeNames.push_back(deviceId + "/" + control->GetId());
+        }
+        UA_Double value = 1;
+        std::vector<UA_WriteValue> nodes(controls.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            UA_WriteValue_init(&nodes[i]);
+            nodes[i].nodeId = UA_NODEID_STRING(1, (char*)nodeNames[i].c_str());
+            nodes[i].attributeId = UA_ATTRIBUTEID_VALUE;
+            nodes[i].value.hasValue = true;
+            UA_Variant_setScalar(&nodes[i].value.value, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+        }
+        UA_WriteRequest request;
+        UA_WriteRequest_init(&request);
+        request.nodesToWrite = nodes.data();
+        request.nodesToWriteSize = nodes.size();
+
+        auto client = UA_Client_new();
+        UA_ClientConfig_setDefault(UA_Client_getConfig(client));
+        auto url = "opc.tcp://localhost:" + std::to_string(port);
+        auto deadline = TClock::now() + CONNECT_TIMEOUT;
+        auto res = UA_Client_connect(client, url.c_str());
+        while (res != UA_STATUSCODE_GOOD && TClock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            res = UA_Client_connect(client, url.c_str());
+        }
+        EXPECT_EQ(UA_STATUSCODE_GOOD, res);
+
+        TWriteServiceResult result;
+        if (res == UA_STATUSCODE_GOOD) {
+            auto start = TClock::now();
+            auto response = UA_Client_Service_write(client, request);
+            result.ResponseUs = ElapsedUs(start);
+            EXPECT_EQ(UA_STATUSCODE_GOOD, response.responseHeader.serviceResult);
+            EXPECT_EQ(nodes.size(), response.resultsSize);
+            for (size_t i = 0; i < response.resultsSize; ++i) {
+                EXPECT_EQ(UA_STATUSCODE_GOOD, response.results[i]);
+            }
+            UA_WriteResponse_clear(&response);
+            deadline = TClock::now() + PUBLISH_TIMEOUT;
+            while (server->GetWriteQueue().GetStats().Published < controls.size() && TClock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            result.PublishedUs = ElapsedUs(start);
+        }
+        UA_Client_disconnect(client);
+        UA_Client_delete(client);
+        return result;
+    }
+}
+
+class TWriteQueueBenchmark: public Testing::TLoggedFixture
+{
+protected:
+    // Benchmarks don't compare MQTT traffic with reference logs
+    void TearDown() override
+    {}
+};
+
+// Compares publishing of OPC UA Write requests with 10/100/1000 nodes node by node,
+// as WriteVariable did before the write queue, with publishing by TWriteQueue in batches
+TEST_F(TWriteQueueBenchmark, per_node_vs_batched)
+{
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto mqttClient = mqttBroker->MakeClient("bench");
+    auto backend = NewDriverBackend(mqttClient);
+    auto driver = NewDriver(TDriverArgs{}.SetId("bench").SetBackend(backend));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    for (size_t count: {10, 100, 1000}) {
+        auto deviceId = "bench" + std::to_string(count);
+        std::vector<PControl> controls;
+        {
+            auto tx = driver->BeginTx();
+            auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId(deviceId)).GetValue();
+            for (size_t i = 0; i < count; ++i) {
+                controls.push_back(
+                    device
+                        ->CreateControl(tx,
+                                        TControlArgs{}.SetId("c" + std::to_string(i)).SetType("value").SetReadonly(false))
+                        .GetValue());
+            }
+            tx->End();
+        }
+
+        auto start = TClock::now();
+        for (auto& control: controls) {
+            auto tx = driver->BeginTx();
+            control->SetValue(tx, 1.0).Sync();
+        }
+        auto perNodeUs = ElapsedUs(start);
+
+        OPCUA::TWriteQueue queue(driver, count);
+        start = TClock::now();
+        std::vector<std::future<UA_StatusCode>> results;
+        for (auto& control: controls) {
+            OPCUA::TWriteRequest request;
+            request.NodeName = deviceId + "/" + control->GetId();
+            request.Control = control;
+            request.Value = 2.0;
+            results.push_back(queue.Push(std::move(request)));
+        }
+        for (auto& result: results) {
+            ASSERT_EQ(UA_STATUSCODE_GOOD, result.get());
+        }
+        auto batchedUs = ElapsedUs(start);
+
+        Bench::Report("write_queue",
+                      {{"nodes", count},
+                       {"per_node_us", perNodeUs},
+                       {"batched_us", batchedUs},
+                       {"batches", queue.GetStats().Batches}});
+    }
+}
+
+/**! Sends OPC UA Write requests with 10/100/1000 nodes through a client session in both write modes.
+ *   In wait mode every node of the request waits for its own publish, so the response time grows
+ *   with the per-node cost. In enqueue mode the request is published in batches after the response
+ */
+TEST_F(TWriteQueueBenchmark, write_service)
+{
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto mqttClient = mqttBroker->MakeClient("bench");
+    auto backend = NewDriverBackend(mqttClient);
+    auto driver = NewDriver(TDriverArgs{}.SetId("bench").SetBackend(backend));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    uint16_t port = BASE_PORT;
+    for (size_t count: {10, 100, 1000}) {
+        auto deviceId = "service" + std::to_string(count);
+        std::vector<PControl> controls;
+        {
+            auto tx = driver->BeginTx();
+            auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId(deviceId)).GetValue();
+            for (size_t i = 0; i < count; ++i) {
+                controls.push_back(
+                    device
+                        ->CreateControl(tx,
+                                        TControlArgs{}.SetId("c" + std::to_string(i)).SetType("value").SetReadonly(false))
+                        .GetValue());
+            }
+            tx->End();
+        }
+
+        auto wait = WriteService(driver, deviceId, controls, OPCUA::TWriteMode::Wait, port++);
+        auto enqueue = WriteService(driver, deviceId, controls, OPCUA::TWriteMode::Enqueue, port++);
+
+        Bench::Report("write_service",
+                      {{"nodes", count},
+                       {"wait_response_us", wait.ResponseUs},
+                       {"wait_per_node_us", static_cast<double>(wait.ResponseUs) / count},
+                       {"enqueue_response_us", enqueue.ResponseUs},
+                       {"enqueue_published_us", enqueue.PublishedUs},
+                       {"enqueue_per_node_us", static_cast<double>(enqueue.PublishedUs) / count}});
+    }
+
+    driver->StopLoop();
+}
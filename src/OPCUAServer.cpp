@@ -1,46 +1,153 @@
 #include "OPCUAServer.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 #include <functional>
+#include <mutex>
 #include <stdexcept>
 #include <vector>
 
+#include <signal.h>
+
 #include "log.h"
 
-#define LOG(logger) ::logger.Log() << "[OPCUA] "
+#include <open62541/plugin/pki_default.h>
+#include <open62541/plugin/pubsub_udp.h>
+#include <open62541/server_pubsub.h>
+
+#define LOG(logger) LOG_WITH_PREFIX(logger, "[OPCUA] ")
 
 namespace
 {
     const char* LogCategoryNames[7] =
         {"network", "channel", "session", "server", "client", "userland", "securitypolicy"};
 
-    void PrintLogMessage(WBMQTT::TLogger& logger, UA_LogCategory category, const char* msg, va_list args)
+    /**! Writes of the current service request in enqueue mode, set by server threads.
+     *   They are queued at once after the loop iteration, so the worker publishes them in one batch.
+     */
+    thread_local std::vector<OPCUA::TWriteRequest>* ServiceWrites = nullptr;
+
+    /**! Access control context of a server instance. Keeps the context and the session callbacks
+     *   of open62541 default access control, which are wrapped to track client connections
+     */
+    struct TAccessControlContext
+    {
+        //! Gateway server owning the instance, nullptr while the instance is being deleted
+        OPCUA::TServerImpl* Owner = nullptr;
+
+        void* DefaultContext = nullptr;
+        decltype(UA_AccessControl::activateSession) DefaultActivateSession = nullptr;
+        decltype(UA_AccessControl::closeSession) DefaultCloseSession = nullptr;
+        decltype(UA_AccessControl::clear) DefaultClear = nullptr;
+    };
+
+    //! Errors triggered by client requests are logged once per period, so clients can't flood the log
+    const auto CLIENT_ERROR_LOG_PERIOD = std::chrono::seconds(10);
+    OPCUA::TLogRateLimit WriteErrorLogLimit(CLIENT_ERROR_LOG_PERIOD);
+    OPCUA::TLogRateLimit WriteTimeoutLogLimit(CLIENT_ERROR_LOG_PERIOD);
+    OPCUA::TLogRateLimit ReadErrorLogLimit(CLIENT_ERROR_LOG_PERIOD);
+
+    //! Verification results of client certificates are reused while clients reconnect
+    const size_t CERTIFICATE_CACHE_SIZE = 64;
+    const auto CERTIFICATE_CACHE_TTL = std::chrono::minutes(5);
+
+    const char* BASIC256SHA256_POLICY_URI = "http://opcfoundation.org/UA/SecurityPolicy#Basic256Sha256";
+    const char* AES128SHA256RSAOAEP_POLICY_URI = "http://opcfoundation.org/UA/SecurityPolicy#Aes128_Sha256_RsaOaep";
+
+    const char* UADP_TRANSPORT_PROFILE_URI = "http://opcfoundation.org/UA-Profile/Transport/pubsub-udp-uadp";
+
+    //! Every Nth DataSetMessage carries all fields
+    const UA_UInt32 PUBSUB_KEY_FRAME_COUNT = 10;
+
+    //! Period of server load measurement
+    const auto LOAD_GOVERNOR_PERIOD = std::chrono::milliseconds(1000);
+
+    const std::string SNAPSHOT_NODE_NAME = "Snapshot";
+    const std::string SNAPSHOT_CONTROLS_NODE_NAME = "SnapshotControls";
+    const std::string GET_VALUES_METHOD_NAME = "GetValues";
+    const std::string SET_VALUES_METHOD_NAME = "SetValues";
+    const std::string METRICS_DEVICE_ID = "wb-mqtt-opcua";
+
+    //! Names of metric variable nodes and MQTT controls
+    const std::vector<std::string> MetricNames = {"events_per_s",
+                                                  "reads_per_s",
+                                                  "writes_per_s",
+                                                  "failed_writes",
+                                                  "materialized_nodes",
+                                                  "sessions",
+                                                  "monitored_items",
+                                                  "mutex_wait_ms",
+                                                  "write_queue_depth",
+                                                  "rss_kb",
+                                                  "load_factor"};
+
+    //! Binary key of the node id, equal ids have equal keys
+    std::string GetNodeIdKey(const UA_NodeId& nodeId)
+    {
+        std::string res(reinterpret_cast<const char*>(&nodeId.namespaceIndex), sizeof(nodeId.namespaceIndex));
+        res += static_cast<char>(nodeId.identifierType);
+        switch (nodeId.identifierType) {
+            case UA_NODEIDTYPE_NUMERIC:
+                res.append(reinterpret_cast<const char*>(&nodeId.identifier.numeric), sizeof(nodeId.identifier.numeric));
+                break;
+            case UA_NODEIDTYPE_GUID:
+                res.append(reinterpret_cast<const char*>(&nodeId.identifier.guid), sizeof(nodeId.identifier.guid));
+                break;
+            default:
+                // String and ByteString identifiers have the same layout
+                res.append(reinterpret_cast<const char*>(nodeId.identifier.string.data),
+                           nodeId.identifier.string.length);
+        }
+        return res;
+    }
+
+    TAccessControlContext* GetAccessControlContext(UA_Server* server)
+    {
+        return static_cast<TAccessControlContext*>(UA_Server_getConfig(server)->accessControl.context);
+    }
+
+    //! Default access control with its own context. Other default callbacks don't use the context
+    UA_AccessControl GetDefaultAccessControl(const UA_AccessControl& ac)
+    {
+        auto res = ac;
+        res.context = static_cast<TAccessControlContext*>(ac.context)->DefaultContext;
+        return res;
+    }
+
+    //! Locks the mutex and counts the wait time
+    std::unique_lock<std::mutex> LockMeasured(std::mutex& mutex)
     {
-        va_list args2;
-        va_copy(args2, args);
-        auto bufSize = 1 + vsnprintf(nullptr, 0, msg, args);
-        std::string str(bufSize, '\0');
-        vsnprintf(&str[0], bufSize, msg, args2);
-        va_end(args2);
-        logger.Log() << "[OPCUA] " << LogCategoryNames[category] << ": " << str;
+        auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        OPCUA::Metrics::Add(
+            OPCUA::TCounter::MutexWaitUs,
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        return lock;
     }
 
     extern "C" {
+    //! Context is the async log of the gateway server
     void Log(void* context, UA_LogLevel level, UA_LogCategory category, const char* msg, va_list args)
     {
+        auto log = static_cast<OPCUA::TAsyncLog*>(context);
         switch (level) {
             case UA_LOGLEVEL_TRACE:
             case UA_LOGLEVEL_DEBUG:
-                PrintLogMessage(Debug, category, msg, args);
+                log->Push(Debug, LogCategoryNames[category], msg, args);
                 break;
             case UA_LOGLEVEL_INFO:
-                PrintLogMessage(Info, category, msg, args);
+                log->Push(Info, LogCategoryNames[category], msg, args);
                 break;
             case UA_LOGLEVEL_WARNING:
-                PrintLogMessage(Warn, category, msg, args);
+                log->Push(Warn, LogCategoryNames[category], msg, args);
                 break;
             case UA_LOGLEVEL_ERROR:
             case UA_LOGLEVEL_FATAL:
-                PrintLogMessage(Error, category, msg, args);
+                log->Push(Error, LogCategoryNames[category], msg, args);
                 break;
         }
     }
@@ -57,8 +164,62 @@ namespace
                                        const UA_NumericRange* range,
                                        UA_DataValue* dataValue)
     {
-        OPCUA::TServerImpl* server = (OPCUA::TServerImpl*)(snodeContext);
-        return server->ReadVariable(snodeId, dataValue);
+        auto slot = (OPCUA::TVariableNodeSlot*)(snodeContext);
+        return slot->Server->ReadVariable(*slot, dataValue, ssourceTimeStamp);
+    }
+
+    UA_StatusCode ReadSnapshotCallback(UA_Server* server,
+                                       const UA_NodeId* sessionId,
+                                       void* sessionContext,
+                                       const UA_NodeId* nodeId,
+                                       void* nodeContext,
+                                       UA_Boolean sourceTimeStamp,
+                                       const UA_NumericRange* range,
+                                       UA_DataValue* dataValue)
+    {
+        auto snapshot = (OPCUA::TGroupSnapshot*)(nodeContext);
+        return snapshot->Server->ReadSnapshot(*snapshot, dataValue);
+    }
+
+    std::string GetObjectNodeName(const UA_NodeId& objectId)
+    {
+        if (objectId.identifierType != UA_NODEIDTYPE_STRING) {
+            return std::string();
+        }
+        return std::string((const char*)objectId.identifier.string.data, objectId.identifier.string.length);
+    }
+
+    //! Method context is the gateway server, object node id is the group name
+    UA_StatusCode GetValuesMethodCallback(UA_Server* server,
+                                          const UA_NodeId* sessionId,
+                                          void* sessionContext,
+                                          const UA_NodeId* methodId,
+                                          void* methodContext,
+                                          const UA_NodeId* objectId,
+                                          void* objectContext,
+                                          size_t inputSize,
+                                          const UA_Variant* input,
+                                          size_t outputSize,
+                                          UA_Variant* output)
+    {
+        auto owner = (OPCUA::TServerImpl*)(methodContext);
+        return owner->GetGroupValues(GetObjectNodeName(*objectId), output);
+    }
+
+    UA_StatusCode SetValuesMethodCallback(UA_Server* server,
+                                          const UA_NodeId* sessionId,
+                                          void* sessionContext,
+                                          const UA_NodeId* methodId,
+                                          void* methodContext,
+                                          const UA_NodeId* objectId,
+                                          void* objectContext,
+                                          size_t inputSize,
+                                          const UA_Variant* input,
+                                          size_t outputSize,
+                                          UA_Variant* output)
+    {
+        auto owner = (OPCUA::TServerImpl*)(methodContext);
+        return owner->SetGroupValues(GetObjectNodeName(*objectId), input, output);
     }
 
     UA_StatusCode WriteVariableCallback(UA_Server* server,
@@ -69,327 +230,2301 @@ namespace
                                         const UA_NumericRange* range,
                                         const UA_DataValue* data)
     {
-        OPCUA::TServerImpl* s = (OPCUA::TServerImpl*)(nodeContext);
-        return s->WriteVariable(nodeId, data);
+        auto slot = (OPCUA::TVariableNodeSlot*)(nodeContext);
+        return slot->Server->WriteVariable(*slot, data);
     }
+
+    UA_StatusCode ActivateSession(UA_Server* server,
+                                  UA_AccessControl* ac,
+                                  const UA_EndpointDescription* endpointDescription,
+                                  const UA_ByteString* secureChannelRemoteCertificate,
+                                  const UA_NodeId* sessionId,
+                                  const UA_ExtensionObject* userIdentityToken,
+                                  void** sessionContext)
+    {
+        auto context = static_cast<TAccessControlContext*>(ac->context);
+        auto defaultAc = GetDefaultAccessControl(*ac);
+        auto res = context->DefaultActivateSession(server,
+                                                   &defaultAc,
+                                                   endpointDescription,
+                                                   secureChannelRemoteCertificate,
+                                                   sessionId,
+                                                   userIdentityToken,
+                                                   sessionContext);
+        if (res == UA_STATUSCODE_GOOD && context->Owner) {
+            context->Owner->SessionActivated(server, *sessionId);
+        }
+        return res;
     }
 
-    UA_Logger MakeLogger()
+    void CloseSession(UA_Server* server, UA_AccessControl* ac, const UA_NodeId* sessionId, void* sessionContext)
     {
-        UA_Logger logger = {Log, nullptr, LogClear};
-        return logger;
+        auto context = static_cast<TAccessControlContext*>(ac->context);
+        if (context->Owner) {
+            context->Owner->SessionClosed(server, *sessionId);
+        }
+        auto defaultAc = GetDefaultAccessControl(*ac);
+        context->DefaultCloseSession(server, &defaultAc, sessionId, sessionContext);
     }
 
-    void SetVariableAttributes(UA_VariableAttributes& attr, WBMQTT::PControl control)
+    //! Restores default access control and lets it free its context
+    void ClearAccessControl(UA_AccessControl* ac)
     {
-        attr.accessLevel =
-            control->IsReadonly() ? UA_ACCESSLEVELMASK_READ : UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
-        attr.displayName = UA_LOCALIZEDTEXT((char*)"en-US", (char*)control->GetId().c_str());
-        attr.valueRank = UA_VALUERANK_SCALAR;
-        attr.dataType = UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATATYPE);
-        try {
-            auto v = control->GetValue();
-            if (v.Is<bool>()) {
-                attr.dataType = UA_NODEID_NUMERIC(0, UA_NS0ID_BOOLEAN);
-                return;
-            }
-            if (v.Is<double>()) {
-                attr.dataType = UA_NODEID_NUMERIC(0, UA_NS0ID_DOUBLE);
-                return;
-            }
-            return;
-        } catch (...) {
+        std::unique_ptr<TAccessControlContext> context(static_cast<TAccessControlContext*>(ac->context));
+        ac->context = context->DefaultContext;
+        ac->activateSession = context->DefaultActivateSession;
+        ac->closeSession = context->DefaultCloseSession;
+        ac->clear = context->DefaultClear;
+        if (ac->clear) {
+            ac->clear(ac);
         }
     }
 
-    void ConfigureOpcUaServer(UA_ServerConfig* serverCfg, const OPCUA::TServerConfig& config)
+    void MonitoredItemRegisterCallback(UA_Server* server,
+                                       const UA_NodeId* sessionId,
+                                       void* sessionContext,
+                                       const UA_NodeId* nodeId,
+                                       void* nodeContext,
+                                       UA_UInt32 attributeId,
+                                       UA_Boolean removed)
     {
-        serverCfg->logger = MakeLogger();
+        auto owner = GetAccessControlContext(server)->Owner;
+        if (owner) {
+            owner->MonitoredItemRegistered(removed);
+        }
+    }
 
-        UA_ServerConfig_setBasics(serverCfg);
-        serverCfg->allowEmptyVariables = UA_RULEHANDLING_ACCEPT;
+    //! Longest network wait of a server loop iteration, UA_MAXTIMEOUT of open62541
+    const auto SERVER_LOOP_MAX_WAIT = std::chrono::milliseconds(50);
 
-        UA_BuildInfo_clear(&serverCfg->buildInfo);
-        UA_ApplicationDescription_clear(&serverCfg->applicationDescription);
-        serverCfg->applicationDescription.applicationUri = UA_STRING_ALLOC("urn:wb-mqtt-opcua.server.application");
-        serverCfg->applicationDescription.productUri = UA_STRING_ALLOC("https://wirenboard.com");
-        serverCfg->applicationDescription.applicationName =
-            UA_LOCALIZEDTEXT_ALLOC("en", "Wiren Board MQTT to OPC UA gateway");
-        serverCfg->applicationDescription.applicationType = UA_APPLICATIONTYPE_SERVER;
+    //! Bounds the network wait of the server loop, so values are written within the loop latency on a missed wakeup
+    void LoopLatencyCallback(UA_Server* server, void* data)
+    {}
 
-        if (!config.BindIp.empty()) {
-            UA_String_clear(&serverCfg->customHostname);
-            serverCfg->customHostname = UA_String_fromChars(config.BindIp.c_str());
-        }
+    /**! Signal waking server threads up. It interrupts select of the network layer,
+     *   which open62541 treats as a timeout, other system calls are restarted
+     */
+    int GetWakeupSignal()
+    {
+        return SIGRTMIN;
+    }
 
-        auto res = UA_ServerConfig_addNetworkLayerTCP(serverCfg, config.BindPort, 0, 0);
-        if (res != UA_STATUSCODE_GOOD) {
-            throw std::runtime_error(std::string("OPC UA network layer configuration failed: ") +
-                                     UA_StatusCode_name(res));
-        }
+    void WakeupSignalHandler(int)
+    {}
 
-        res = UA_ServerConfig_addSecurityPolicyNone(serverCfg, nullptr);
-        if (res != UA_STATUSCODE_GOOD) {
-            throw std::runtime_error(std::string("OPC UA security policy addition failed: ") + UA_StatusCode_name(res));
-        }
+    void InstallWakeupSignalHandler()
+    {
+        static std::once_flag installed;
+        std::call_once(installed, []() {
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = WakeupSignalHandler;
+            action.sa_flags = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            if (sigaction(GetWakeupSignal(), &action, nullptr) != 0) {
+                throw std::runtime_error(std::string("Server thread wakeup setup failed: ") + strerror(errno));
+            }
+        });
+    }
 
-        res = UA_AccessControl_default(serverCfg,
-                                       true,
-                                       &serverCfg->securityPolicies[serverCfg->securityPoliciesSize - 1].policyUri,
-                                       0,
-                                       nullptr);
-        if (res != UA_STATUSCODE_GOOD) {
-            throw std::runtime_error(std::string("OPC UA access control configuration failed: ") +
-                                     UA_StatusCode_name(res));
+    //! Runs in the server loop, so the limits are changed without racing with subscription services
+    void GovernLoadCallback(UA_Server* server, void* data)
+    {
+        auto governor = static_cast<OPCUA::TLoadGovernor*>(data);
+        if (!governor->Update(std::chrono::steady_clock::now(), OPCUA::Metrics::GetCpuTimes())) {
+            return;
         }
-
-        res = UA_ServerConfig_addEndpoint(serverCfg, UA_SECURITY_POLICY_NONE_URI, UA_MESSAGESECURITYMODE_NONE);
-        if (res != UA_STATUSCODE_GOOD) {
-            throw std::runtime_error(std::string("OPC UA server endpoint allocation failed: ") +
-                                     UA_StatusCode_name(res));
+        auto config = UA_Server_getConfig(server);
+        config->samplingIntervalLimits.min = governor->GetMinSamplingInterval();
+        config->publishingIntervalLimits.min = governor->GetMinPublishingInterval();
+        if (governor->GetFactor() > 1) {
+            UA_LOG_WARNING(&config->logger,
+                           UA_LOGCATEGORY_SERVER,
+                           "Server is overloaded, minimum sampling interval is raised to %.0f ms, "
+                           "publishing interval to %.0f ms",
+                           config->samplingIntervalLimits.min,
+                           config->publishingIntervalLimits.min);
+        } else {
+            UA_LOG_INFO(&config->logger,
+                        UA_LOGCATEGORY_SERVER,
+                        "Server load is normal, minimum sampling and publishing intervals are restored");
         }
     }
 
-}
+    //! HistoryRead continuation point, values with the same time are told apart by their order
+    struct THistoryContinuationPoint
+    {
+        UA_DateTime Time;
+        uint64_t Offset;
+    };
 
-namespace OPCUA
-{
-    TServerImpl::TServerImpl(const TServerConfig& config, WBMQTT::PDeviceDriver driver)
-        : Server(UA_Server_new()),
-          IsRunning(true),
-          Config(config),
-          Driver(driver)
+    void HistoryDatabaseClear(UA_HistoryDatabase* hdb)
+    {}
+
+    void ReadRawHistory(UA_Server* server,
+                        void* hdbContext,
+                        const UA_NodeId* sessionId,
+                        void* sessionContext,
+                        const UA_RequestHeader* requestHeader,
+                        const UA_ReadRawModifiedDetails* historyReadDetails,
+                        UA_TimestampsToReturn timestampsToReturn,
+                        UA_Boolean releaseContinuationPoints,
+                        size_t nodesToReadSize,
+                        const UA_HistoryReadValueId* nodesToRead,
+                        UA_HistoryReadResponse* response,
+                        UA_HistoryData* const* const historyData)
     {
-        if (!Server) {
-            throw std::runtime_error("OPC UA server initilization failed");
+        auto owner = static_cast<OPCUA::TServerImpl*>(hdbContext);
+        for (size_t i = 0; i < nodesToReadSize; ++i) {
+            auto& result = response->results[i];
+            if (releaseContinuationPoints) {
+                // Continuation points keep no server state
+                result.statusCode = UA_STATUSCODE_GOOD;
+                continue;
+            }
+            result.statusCode = owner->ReadHistory(*historyReadDetails,
+                                                   timestampsToReturn,
+                                                   nodesToRead[i],
+                                                   result.continuationPoint,
+                                                   *historyData[i]);
         }
+    }
 
-        Driver->On<WBMQTT::TControlValueEvent>(
-            [&](const WBMQTT::TControlValueEvent& event) { ControlValueEventCallback(event); });
-
-        // Load external controls
-        std::vector<std::string> deviceIds;
-        for (const auto& device: config.ObjectNodes) {
-            LOG(Debug) << "'" << device.first << "' is added to filter";
-            deviceIds.emplace_back(device.first);
+    //! Recorded values are never modified, so there are no modified values to return
+    void ReadModifiedHistory(UA_Server* server,
+                             void* hdbContext,
+                             const UA_NodeId* sessionId,
+                             void* sessionContext,
+                             const UA_RequestHeader* requestHeader,
+                             const UA_ReadRawModifiedDetails* historyReadDetails,
+                             UA_TimestampsToReturn timestampsToReturn,
+                             UA_Boolean releaseContinuationPoints,
+                             size_t nodesToReadSize,
+                             const UA_HistoryReadValueId* nodesToRead,
+                             UA_HistoryReadResponse* response,
+                             UA_HistoryModifiedData* const* const historyData)
+    {
+        auto owner = static_cast<OPCUA::TServerImpl*>(hdbContext);
+        for (size_t i = 0; i < nodesToReadSize; ++i) {
+            response->results[i].statusCode = owner->HasHistory(nodesToRead[i].nodeId)
+                                                  ? UA_STATUSCODE_GOOD
+                                                  : UA_STATUSCODE_BADHISTORYOPERATIONUNSUPPORTED;
         }
-        Driver->SetFilter(WBMQTT::GetDeviceListFilter(deviceIds));
-        Driver->WaitForReady();
+    }
+    }
 
-        // Setup and run OPC UA server
-        ConfigureOpcUaServer(UA_Server_getConfig(Server), config);
-        ServerThread = std::thread([this]() {
-            auto res = UA_Server_run(Server, &IsRunning);
-            if (res != UA_STATUSCODE_GOOD) {
-                LOG(Error) << UA_StatusCode_name(res);
-                exit(1);
-            }
-        });
+    UA_Logger MakeLogger(OPCUA::TAsyncLog* log)
+    {
+        UA_Logger logger = {Log, log, LogClear};
+        return logger;
     }
 
-    TServerImpl::~TServerImpl()
+    //! Attributes of a variable node created before its control appears in MQTT
+    bool HasHistory(const OPCUA::TVariableNodeSlot& slot)
     {
-        if (IsRunning) {
-            IsRunning = false;
-            if (ServerThread.joinable()) {
-                ServerThread.join();
-            }
-        }
-        if (Server) {
-            UA_Server_delete(Server);
+        return slot.History || slot.HistoryFile;
+    }
+
+    void SetHistoryAttributes(UA_VariableAttributes& attr, const OPCUA::TVariableNodeSlot& slot)
+    {
+        if (HasHistory(slot)) {
+            attr.accessLevel |= UA_ACCESSLEVELMASK_HISTORYREAD;
+            attr.historizing = true;
         }
     }
 
-    bool TServerImpl::ControlExists(const std::string& nodeName)
+    void SetInitialVariableAttributes(UA_VariableAttributes& attr, const OPCUA::TVariableNodeSlot& slot)
     {
-        std::unique_lock<std::mutex> lock(Mutex);
-        return ControlMap.find(nodeName) != ControlMap.end();
+        attr.accessLevel = UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
+        SetHistoryAttributes(attr, slot);
+        attr.displayName = UA_LOCALIZEDTEXT((char*)"en-US", (char*)slot.ControlId.c_str());
+        attr.valueRank = UA_VALUERANK_SCALAR;
+        attr.dataType = UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATATYPE);
     }
 
-    void TServerImpl::AddControl(const std::string& nodeName, WBMQTT::PControl control)
+    /**! Chooses value kind of the slot from the control meta type.
+     *   Controls of unknown types get the kind of their current value.
+     *   Returns DataType of the variable node, nullptr for BaseDataType.
+     */
+    const UA_DataType* SetVariableAttributes(UA_VariableAttributes& attr, OPCUA::TVariableNodeSlot& slot)
     {
-        std::unique_lock<std::mutex> lock(Mutex);
-        ControlMap[nodeName] = control;
+        const auto& control = *slot.ControlOwner;
+        attr.accessLevel =
+            control.IsReadonly() ? UA_ACCESSLEVELMASK_READ : UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
+        attr.displayName = UA_LOCALIZEDTEXT((char*)"en-US", (char*)control.GetId().c_str());
+        attr.valueRank = UA_VALUERANK_SCALAR;
+        attr.dataType = UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATATYPE);
+        auto kind = OPCUA::GetValueKind(control.GetType(), control.GetMin(), control.GetPrecision());
+        if (kind == OPCUA::TValueKind::Unknown) {
+            try {
+                auto v = control.GetValue();
+                if (v.Is<bool>()) {
+                    kind = OPCUA::TValueKind::Boolean;
+                } else if (v.Is<double>()) {
+                    kind = OPCUA::TValueKind::Double;
+                }
+            } catch (...) {
+            }
+        }
+        slot.ValueKind = kind;
+        auto dataType = OPCUA::GetDataType(kind);
+        if (dataType) {
+            attr.dataType = dataType->typeId;
+        }
+        return dataType;
     }
 
-    void TServerImpl::RemoveControl(const std::string& nodeName)
+    bool HasDeadband(const OPCUA::TVariableNodeSlot& slot)
     {
-        std::unique_lock<std::mutex> lock(Mutex);
-        ControlMap.erase(nodeName);
+        auto kind = slot.ValueKind.load();
+        return OPCUA::IsNumeric(kind) && kind != OPCUA::TValueKind::Boolean &&
+               (slot.AbsoluteDeadband > 0 || slot.PercentDeadband > 0);
     }
 
-    WBMQTT::PControl TServerImpl::GetControl(const std::string& nodeName)
+    bool IsError(const WBMQTT::TControl& control)
     {
-        std::unique_lock<std::mutex> lock(Mutex);
-        auto it = ControlMap.find(nodeName);
-        return it != ControlMap.end() ? it->second : nullptr;
+        return control.GetError().find("r") != std::string::npos;
     }
 
-    UA_StatusCode TServerImpl::WriteVariable(const UA_NodeId* snodeId, const UA_DataValue* dataValue)
+    /**! Returns false if the control value change doesn't exceed the slot deadbands and the error state is the same.
+     *   Otherwise remembers the value as committed to the node, so reads don't parse it again.
+     */
+    bool CommitValue(OPCUA::TVariableNodeSlot& slot, const WBMQTT::TControl& control)
     {
-        std::string nodeIdName((const char*)snodeId->identifier.string.data, snodeId->identifier.string.length);
-        auto ctrl = GetControl(nodeIdName);
-        if (!ctrl || ctrl->IsReadonly()) {
-            LOG(Error) << "Variable node '" + nodeIdName + "' writing failed. "
-                       << (ctrl ? "It is read only" : "It is not presented in MQTT");
-            return UA_STATUSCODE_BADDEVICEFAILURE;
+        auto error = IsError(control);
+        auto errorChanged = (error != slot.CommittedError.load(std::memory_order_relaxed));
+        slot.CommittedError.store(error, std::memory_order_relaxed);
+        auto kind = slot.ValueKind.load();
+        if (kind == OPCUA::TValueKind::String) {
+            std::unique_lock<std::mutex> lock(slot.TextMutex);
+            slot.CommittedText = control.GetRawValue();
+            return true;
         }
-        auto tx = Driver->BeginTx();
-        try {
-            if (dataValue->hasValue) {
-                if (UA_Variant_hasScalarType(&dataValue->value, &UA_TYPES[UA_TYPES_BOOLEAN])) {
-                    auto value = *(UA_Boolean*)dataValue->value.data;
-                    ctrl->SetValue(tx, value).Sync();
-                    LOG(Info) << "Variable node '" + nodeIdName + "' = " << value;
-                    return UA_STATUSCODE_GOOD;
-                }
-                if (UA_Variant_hasScalarType(&dataValue->value, &UA_TYPES[UA_TYPES_DOUBLE])) {
-                    auto value = *(UA_Double*)dataValue->value.data;
-                    ctrl->SetValue(tx, value).Sync();
-                    LOG(Info) << "Variable node '" + nodeIdName + "' = " << value;
-                    return UA_STATUSCODE_GOOD;
-                }
-                if (UA_Variant_hasScalarType(&dataValue->value, &UA_TYPES[UA_TYPES_STRING])) {
-                    auto value = (char*)((UA_String*)dataValue->value.data)->data;
-                    ctrl->SetRawValue(tx, value).Sync();
-                    LOG(Info) << "Variable node '" + nodeIdName + "' = " << value;
-                    return UA_STATUSCODE_GOOD;
-                }
+        if (!OPCUA::IsNumeric(kind)) {
+            return true;
+        }
+        double value;
+        if (!OPCUA::ParseNumber(kind, control.GetRawValue(), value)) {
+            // Malformed values are converted by the control on reads
+            slot.CommittedValue.store(std::numeric_limits<double>::quiet_NaN(), std::memory_order_relaxed);
+            return true;
+        }
+        auto last = slot.CommittedValue.load(std::memory_order_relaxed);
+        if (HasDeadband(slot) && !std::isnan(last) && !error && !errorChanged) {
+            auto range = control.GetMax() - control.GetMin();
+            auto base = (range > 0) ? range : std::fabs(last);
+            auto deadband = std::max(slot.AbsoluteDeadband, base * slot.PercentDeadband / 100);
+            if (std::fabs(value - last) <= deadband) {
+                return false;
             }
-            return UA_STATUSCODE_BADDATATYPEIDUNKNOWN;
-        } catch (const std::exception& e) {
-            LOG(Error) << "Variable node '" + nodeIdName + "' write error: " << e.what();
-            return UA_STATUSCODE_BADDEVICEFAILURE;
         }
+        slot.CommittedValue.store(value, std::memory_order_relaxed);
+        return true;
     }
 
-    UA_StatusCode TServerImpl::ReadVariable(const UA_NodeId* snodeId, UA_DataValue* dataValue)
+    //! Returns committed numeric value of the slot, converts the control value if there is none
+    double GetCommittedValue(const OPCUA::TVariableNodeSlot& slot, const WBMQTT::TControl& control)
     {
-        std::string nodeIdName((const char*)snodeId->identifier.string.data, snodeId->identifier.string.length);
-        auto ctrl = GetControl(nodeIdName);
-        if (!ctrl) {
-            LOG(Error) << "Control is not found '" + nodeIdName + "'";
-            dataValue->hasStatus = true;
-            dataValue->status = UA_STATUSCODE_BADNOCOMMUNICATION;
-            return UA_STATUSCODE_GOOD;
+        auto value = slot.CommittedValue.load(std::memory_order_relaxed);
+        if (!std::isnan(value)) {
+            return value;
         }
-        try {
-            dataValue->hasStatus = true;
-            if (ctrl->GetError().find("r") != std::string::npos) {
-                dataValue->status = UA_STATUSCODE_BAD;
+        auto v = control.GetValue();
+        return (slot.ValueKind == OPCUA::TValueKind::Boolean) ? v.As<bool>() : v.As<double>();
+    }
+
+    void SetStringValue(UA_DataValue* dataValue, const std::string& text)
+    {
+        UA_String value;
+        value.length = text.size();
+        value.data = (UA_Byte*)text.data();
+        UA_Variant_setScalarCopy(&dataValue->value, &value, &UA_TYPES[UA_TYPES_STRING]);
+    }
+
+    /**! Fills value and status of dataValue from the slot and the control. Throws on value conversion errors.
+     *   Numeric values are kept in storage if it is set, so the value is valid while storage lives.
+     *   Otherwise dataValue owns the value.
+     */
+    void SetDataValue(UA_DataValue* dataValue,
+                      const WBMQTT::TControl& control,
+                      OPCUA::TVariableNodeSlot& slot,
+                      OPCUA::TNumberStorage* storage = nullptr)
+    {
+        dataValue->hasStatus = true;
+        if (IsError(control)) {
+            dataValue->status = UA_STATUSCODE_BAD;
+        } else {
+            dataValue->status = UA_STATUSCODE_GOOD;
+        }
+        auto kind = slot.ValueKind.load();
+        if (OPCUA::IsNumeric(kind)) {
+            // Values within the deadband are not visible to clients
+            auto value = GetCommittedValue(slot, control);
+            if (storage) {
+                OPCUA::SetNumber(dataValue->value, kind, value, *storage);
+            } else {
+                OPCUA::TNumberStorage number;
+                UA_Variant variant;
+                OPCUA::SetNumber(variant, kind, value, number);
+                UA_Variant_setScalarCopy(&dataValue->value, variant.data, variant.type);
+            }
+        } else if (kind == OPCUA::TValueKind::String) {
+            std::unique_lock<std::mutex> lock(slot.TextMutex);
+            if (slot.CommittedText.empty()) {
+                lock.unlock();
+                SetStringValue(dataValue, control.GetRawValue());
             } else {
-                dataValue->status = UA_STATUSCODE_GOOD;
+                SetStringValue(dataValue, slot.CommittedText);
             }
-            auto v = ctrl->GetValue();
+        } else {
+            auto v = control.GetValue();
             if (v.Is<bool>()) {
                 auto value = v.As<bool>();
                 UA_Variant_setScalarCopy(&dataValue->value, &value, &UA_TYPES[UA_TYPES_BOOLEAN]);
+            } else if (v.Is<double>()) {
+                auto value = v.As<double>();
+                UA_Variant_setScalarCopy(&dataValue->value, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
             } else {
-                if (v.Is<double>()) {
-                    auto value = v.As<double>();
-                    UA_Variant_setScalarCopy(&dataValue->value, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
-                } else {
-                    UA_String stringValue = UA_String_fromChars((char*)v.As<std::string>().c_str());
-                    UA_Variant_setScalarCopy(&dataValue->value, &stringValue, &UA_TYPES[UA_TYPES_STRING]);
-                    UA_String_clear(&stringValue);
-                }
+                SetStringValue(dataValue, v.As<std::string>());
             }
-            dataValue->hasValue = true;
-        } catch (const std::exception& e) {
-            LOG(Error) << "Variable node '" + nodeIdName + "' read error: " << e.what();
-            dataValue->hasStatus = true;
-            dataValue->status = UA_STATUSCODE_BADNOCOMMUNICATION;
         }
-        return UA_STATUSCODE_GOOD;
+        dataValue->hasValue = true;
     }
 
-    void TServerImpl::ControlValueEventCallback(const WBMQTT::TControlValueEvent& event)
+    /**! Fills dataValue from the value committed to the slot without touching the control.
+     *   Returns false if the slot has no committed value of its kind, so the value is converted by the control.
+     */
+    bool SetCommittedDataValue(UA_DataValue* dataValue, OPCUA::TVariableNodeSlot& slot)
     {
-        if (event.RawValue.empty()) {
+        auto kind = slot.ValueKind.load();
+        if (OPCUA::IsNumeric(kind)) {
+            auto value = slot.CommittedValue.load(std::memory_order_relaxed);
+            if (std::isnan(value)) {
+                return false;
+            }
+            OPCUA::TNumberStorage number;
+            UA_Variant variant;
+            OPCUA::SetNumber(variant, kind, value, number);
+            UA_Variant_setScalarCopy(&dataValue->value, variant.data, variant.type);
+        } else if (kind == OPCUA::TValueKind::String) {
+            std::unique_lock<std::mutex> lock(slot.TextMutex);
+            if (slot.CommittedText.empty()) {
+                return false;
+            }
+            SetStringValue(dataValue, slot.CommittedText);
+        } else {
+            return false;
+        }
+        dataValue->hasStatus = true;
+        dataValue->status =
+            slot.CommittedError.load(std::memory_order_relaxed) ? UA_STATUSCODE_BAD : UA_STATUSCODE_GOOD;
+        dataValue->hasValue = true;
+        return true;
+    }
+
+    //! Array argument of a method node. Strings are not copied
+    UA_Argument MakeArrayArgument(const char* name, UA_UInt32 dataType, const char* description)
+    {
+        UA_Argument res;
+        UA_Argument_init(&res);
+        res.name = UA_STRING((char*)name);
+        res.dataType = UA_NODEID_NUMERIC(0, dataType);
+        res.valueRank = UA_VALUERANK_ONE_DIMENSION;
+        res.description = UA_LOCALIZEDTEXT((char*)"en-US", (char*)description);
+        return res;
+    }
+
+    /**! Fills dataValue with Variant array of the group control values.
+     *   Values of controls without values from MQTT, with errors or conversion failures are empty variants.
+     *   SourceTimestamp is the time of the latest received value.
+     */
+    void SetSnapshotDataValue(UA_DataValue* dataValue, const OPCUA::TGroupSnapshot& snapshot)
+    {
+        dataValue->hasStatus = true;
+        auto values = (UA_Variant*)UA_Array_new(snapshot.Slots.size(), &UA_TYPES[UA_TYPES_VARIANT]);
+        if (!values) {
+            dataValue->status = UA_STATUSCODE_BADOUTOFMEMORY;
             return;
         }
-        auto it = Config.ObjectNodes.find(event.Control->GetDevice()->GetId());
-        if (it == Config.ObjectNodes.end()) {
+        UA_DateTime receivedTime = 0;
+        for (size_t i = 0; i < snapshot.Slots.size(); ++i) {
+            auto& slot = *snapshot.Slots[i];
+            auto ctrl = slot.Control.load(std::memory_order_acquire);
+            if (!ctrl) {
+                continue;
+            }
+            UA_DataValue item;
+            UA_DataValue_init(&item);
+            try {
+                SetDataValue(&item, *ctrl, slot);
+                if (item.status == UA_STATUSCODE_GOOD) {
+                    // The array takes ownership of the value
+                    values[i] = item.value;
+                    UA_Variant_init(&item.value);
+                }
+            } catch (const std::exception&) {
+            }
+            UA_DataValue_clear(&item);
+            receivedTime = std::max(receivedTime, slot.ReceivedTime.load(std::memory_order_relaxed));
+        }
+        UA_Variant_setArray(&dataValue->value, values, snapshot.Slots.size(), &UA_TYPES[UA_TYPES_VARIANT]);
+        dataValue->hasValue = true;
+        dataValue->status = UA_STATUSCODE_GOOD;
+        if (receivedTime != 0) {
+            dataValue->sourceTimestamp = receivedTime;
+            dataValue->hasSourceTimestamp = true;
+        }
+        dataValue->serverTimestamp = UA_DateTime_now();
+        dataValue->hasServerTimestamp = true;
+    }
+
+    void SetTimestamps(UA_DataValue* dataValue, const OPCUA::TVariableNodeSlot& slot, bool sourceTimestamp)
+    {
+        auto receivedTime = slot.ReceivedTime.load(std::memory_order_relaxed);
+        if (sourceTimestamp && receivedTime != 0) {
+            dataValue->sourceTimestamp = receivedTime;
+            dataValue->hasSourceTimestamp = true;
+        }
+        dataValue->serverTimestamp = UA_DateTime_now();
+        dataValue->hasServerTimestamp = true;
+    }
+
+    //! Records committed numeric and boolean values, text values have no compact representation
+    void RecordHistory(OPCUA::TVariableNodeSlot& slot, const WBMQTT::TControl& control, UA_DateTime time)
+    {
+        if (!HasHistory(slot)) {
             return;
         }
-        std::string nodeName = it->first + "/" + event.Control->GetId();
-        if (ControlExists(nodeName)) {
+        auto kind = slot.ValueKind.load();
+        if (!OPCUA::IsNumeric(kind)) {
             return;
         }
+        OPCUA::THistorySample sample;
+        sample.Time = time;
+        sample.Bad = IsError(control);
+        if (kind == OPCUA::TValueKind::Boolean) {
+            sample.Type = OPCUA::THistoryValueType::Boolean;
+        }
         try {
-            auto browseName = UA_QUALIFIEDNAME(1, (char*)it->first.c_str());
-            auto res = UA_Server_browseSimplifiedBrowsePath(Server,
-                                                            UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
-                                                            1,
-                                                            &browseName);
-            auto parentNodeId =
-                res.statusCode == UA_STATUSCODE_GOOD ? res.targets[0].targetId.nodeId : CreateObjectNode(it->first);
-            for (auto& valueNode: it->second) {
-                if (valueNode.DeviceControlPair != nodeName) {
-                    continue;
-                }
-                browseName = UA_QUALIFIEDNAME(1, (char*)event.Control->GetId().c_str());
-                res = UA_Server_browseSimplifiedBrowsePath(Server, parentNodeId, 1, &browseName);
-                if (res.statusCode != UA_STATUSCODE_GOOD) {
-                    AddControl(nodeName, event.Control);
-                    try {
-                        CreateVariableNode(parentNodeId, nodeName, event.Control);
-                    } catch (...) {
-                        RemoveControl(nodeName);
-                        throw;
-                    }
-                    break;
+            sample.Value = GetCommittedValue(slot, control);
+        } catch (...) {
+            return;
+        }
+        if (slot.History) {
+            slot.History->Add(sample);
+        }
+        if (slot.HistoryFile) {
+            slot.HistoryFile->Add(slot.NodeName, sample);
+        }
+    }
+
+    void SetHistoryDataValue(UA_DataValue& dataValue,
+                             const OPCUA::THistorySample& sample,
+                             UA_TimestampsToReturn timestampsToReturn)
+    {
+        if (sample.Type == OPCUA::THistoryValueType::Boolean) {
+            UA_Boolean value = sample.Value != 0;
+            UA_Variant_setScalarCopy(&dataValue.value, &value, &UA_TYPES[UA_TYPES_BOOLEAN]);
+        } else {
+            UA_Variant_setScalarCopy(&dataValue.value, &sample.Value, &UA_TYPES[UA_TYPES_DOUBLE]);
+        }
+        dataValue.hasValue = true;
+        dataValue.hasStatus = true;
+        dataValue.status = sample.Bad ? UA_STATUSCODE_BAD : UA_STATUSCODE_GOOD;
+        if (timestampsToReturn == UA_TIMESTAMPSTORETURN_SOURCE || timestampsToReturn == UA_TIMESTAMPSTORETURN_BOTH) {
+            dataValue.sourceTimestamp = sample.Time;
+            dataValue.hasSourceTimestamp = true;
+        }
+        if (timestampsToReturn == UA_TIMESTAMPSTORETURN_SERVER || timestampsToReturn == UA_TIMESTAMPSTORETURN_BOTH) {
+            dataValue.serverTimestamp = sample.Time;
+            dataValue.hasServerTimestamp = true;
+        }
+    }
+
+    void ConfigureHistoryDatabase(UA_ServerConfig* serverCfg, OPCUA::TServerImpl* owner)
+    {
+        serverCfg->historyDatabase.context = owner;
+        serverCfg->historyDatabase.clear = HistoryDatabaseClear;
+        // Values are recorded from MQTT events, not from writes to nodes
+        serverCfg->historyDatabase.setValue = nullptr;
+        serverCfg->historyDatabase.readRaw = ReadRawHistory;
+        serverCfg->historyDatabase.readModified = ReadModifiedHistory;
+        serverCfg->accessHistoryDataCapability = true;
+    }
+
+    //! Returns nullptr if no group keeps history on disk
+    std::unique_ptr<OPCUA::THistoryStorage> MakeHistoryStorage(const OPCUA::TServerConfig& config,
+                                                               const OPCUA::TObjectNodesConfig& objectNodes)
+    {
+        for (const auto& objectNode: objectNodes) {
+            for (const auto& variableNode: objectNode.second) {
+                if (variableNode.HistoryRetention.count() > 0) {
+                    return std::make_unique<OPCUA::THistoryStorage>(config.HistoryDir, config.HistoryFlushInterval);
                 }
             }
-        } catch (const std::exception& e) {
-            LOG(Error) << "Failed to add control '" << nodeName << "': " << e.what();
         }
+        return nullptr;
     }
 
-    UA_NodeId TServerImpl::CreateObjectNode(const std::string& nodeName)
+    //! Reads the whole file, throws on failure
+    std::string ReadFile(const std::string& path)
     {
-        UA_NodeId nodeId = UA_NODEID_STRING(1, (char*)nodeName.c_str());
-        UA_ObjectAttributes oAttr = UA_ObjectAttributes_default;
-        oAttr.displayName = UA_LOCALIZEDTEXT((char*)"en-US", (char*)nodeName.c_str());
-        auto res = UA_Server_addObjectNode(Server,
-                                           nodeId,
-                                           UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
-                                           UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
-                                           UA_QUALIFIEDNAME(1, (char*)nodeName.c_str()),
-                                           UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE),
-                                           oAttr,
-                                           nullptr,
-                                           nullptr);
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("Can't open '" + path + "'");
+        }
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    //! Adds Basic256Sha256 and Aes128_Sha256_RsaOaep policies with Sign and SignAndEncrypt endpoints
+    void AddSecureEndpoints(UA_ServerConfig* serverCfg, const OPCUA::TServerConfig& config)
+    {
+        // Policies copy the certificate and parse the key, so the buffers are not owned by the config
+        auto certificateBytes = ReadFile(config.Certificate);
+        auto privateKeyBytes = ReadFile(config.PrivateKey);
+        UA_ByteString certificate{certificateBytes.size(), (UA_Byte*)certificateBytes.data()};
+        UA_ByteString privateKey{privateKeyBytes.size(), (UA_Byte*)privateKeyBytes.data()};
+
+        auto res = UA_ServerConfig_addSecurityPolicyBasic256Sha256(serverCfg, &certificate, &privateKey);
+        if (res == UA_STATUSCODE_GOOD) {
+            res = UA_ServerConfig_addSecurityPolicyAes128Sha256RsaOaep(serverCfg, &certificate, &privateKey);
+        }
         if (res != UA_STATUSCODE_GOOD) {
-            throw std::runtime_error("Object node '" + nodeName + "' creation failed: " + UA_StatusCode_name(res));
+            throw std::runtime_error(std::string("OPC UA security policy addition failed: ") + UA_StatusCode_name(res));
+        }
+
+        for (auto policyUri: {BASIC256SHA256_POLICY_URI, AES128SHA256RSAOAEP_POLICY_URI}) {
+            for (auto mode: {UA_MESSAGESECURITYMODE_SIGN, UA_MESSAGESECURITYMODE_SIGNANDENCRYPT}) {
+                res = UA_ServerConfig_addEndpoint(serverCfg, UA_STRING((char*)policyUri), mode);
+                if (res != UA_STATUSCODE_GOOD) {
+                    throw std::runtime_error(std::string("OPC UA server endpoint allocation failed: ") +
+                                             UA_StatusCode_name(res));
+                }
+            }
         }
-        return nodeId;
     }
 
-    void TServerImpl::CreateVariableNode(const UA_NodeId& parentNodeId,
-                                         const std::string& nodeName,
-                                         WBMQTT::PControl control)
+    void ConfigureOpcUaServer(UA_ServerConfig* serverCfg,
+                              OPCUA::TServerImpl* owner,
+                              const OPCUA::TServerConfig& config,
+                              uint16_t port,
+                              OPCUA::TAsyncLog* log,
+                              OPCUA::TCertificateCache* certificateCache)
     {
-        UA_VariableAttributes oAttr = UA_VariableAttributes_default;
-        SetVariableAttributes(oAttr, control);
+        serverCfg->logger = MakeLogger(log);
 
-        UA_DataSource dataSource;
-        dataSource.read = ReadVariableCallback;
-        dataSource.write = WriteVariableCallback;
+        UA_ServerConfig_setBasics(serverCfg);
+        serverCfg->allowEmptyVariables = UA_RULEHANDLING_ACCEPT;
 
-        auto res = UA_Server_addDataSourceVariableNode(Server,
-                                                       UA_NODEID_STRING(1, (char*)nodeName.c_str()),
-                                                       parentNodeId,
-                                                       UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-                                                       UA_QUALIFIEDNAME(1, (char*)control->GetId().c_str()),
-                                                       UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
-                                                       oAttr,
-                                                       dataSource,
-                                                       this,
-                                                       nullptr);
-        if (res != UA_STATUSCODE_GOOD) {
-            throw std::runtime_error("Variable node '" + nodeName + "' creation failed: " + UA_StatusCode_name(res));
+        serverCfg->maxSessions = static_cast<UA_UInt16>(std::min<size_t>(config.MaxSessions, UINT16_MAX));
+        serverCfg->maxSubscriptionsPerSession = config.MaxSubscriptionsPerSession;
+        serverCfg->maxMonitoredItemsPerSubscription = config.MaxMonitoredItemsPerSubscription;
+        serverCfg->maxMonitoredItems = config.MaxMonitoredItems;
+        serverCfg->samplingIntervalLimits.min = config.MinSamplingInterval;
+        serverCfg->publishingIntervalLimits.min = config.MinPublishingInterval;
+
+        UA_BuildInfo_clear(&serverCfg->buildInfo);
+        UA_ApplicationDescription_clear(&serverCfg->applicationDescription);
+        serverCfg->applicationDescription.applicationUri = UA_STRING_ALLOC("urn:wb-mqtt-opcua.server.application");
+        serverCfg->applicationDescription.productUri = UA_STRING_ALLOC("https://wirenboard.com");
+        serverCfg->applicationDescription.applicationName =
+            UA_LOCALIZEDTEXT_ALLOC("en", "Wiren Board MQTT to OPC UA gateway");
+        serverCfg->applicationDescription.applicationType = UA_APPLICATIONTYPE_SERVER;
+
+        if (!config.BindIp.empty()) {
+            UA_String_clear(&serverCfg->customHostname);
+            serverCfg->customHostname = UA_String_fromChars(config.BindIp.c_str());
+        }
+
+        auto res = UA_ServerConfig_addNetworkLayerTCP(serverCfg, port, 0, 0);
+        if (res != UA_STATUSCODE_GOOD) {
+            throw std::runtime_error(std::string("OPC UA network layer configuration failed: ") +
+                                     UA_StatusCode_name(res));
+        }
+
+        res = UA_ServerConfig_addSecurityPolicyNone(serverCfg, nullptr);
+        if (res != UA_STATUSCODE_GOOD) {
+            throw std::runtime_error(std::string("OPC UA security policy addition failed: ") + UA_StatusCode_name(res));
+        }
+
+        res = UA_AccessControl_default(serverCfg,
+                                       true,
+                                       &serverCfg->securityPolicies[serverCfg->securityPoliciesSize - 1].policyUri,
+                                       0,
+                                       nullptr);
+        if (res != UA_STATUSCODE_GOOD) {
+            throw std::runtime_error(std::string("OPC UA access control configuration failed: ") +
+                                     UA_StatusCode_name(res));
+        }
+        auto context = std::make_unique<TAccessControlContext>();
+        auto& ac = serverCfg->accessControl;
+        context->Owner = owner;
+        context->DefaultContext = ac.context;
+        context->DefaultActivateSession = ac.activateSession;
+        context->DefaultCloseSession = ac.closeSession;
+        context->DefaultClear = ac.clear;
+        ac.context = context.release();
+        ac.activateSession = ActivateSession;
+        ac.closeSession = CloseSession;
+        ac.clear = ClearAccessControl;
+        serverCfg->monitoredItemRegisterCallback = MonitoredItemRegisterCallback;
+
+        serverCfg->maxSecureChannels = config.MaxSecureChannels;
+        serverCfg->maxSecurityTokenLifetime =
+            std::chrono::duration_cast<std::chrono::milliseconds>(config.MaxSecurityTokenLifetime).count();
+
+        if (!config.Certificate.empty()) {
+            AddSecureEndpoints(serverCfg, config);
+        }
+        if (!config.TrustListDir.empty()) {
+            serverCfg->certificateVerification.clear(&serverCfg->certificateVerification);
+            res = UA_CertificateVerification_CertFolders(&serverCfg->certificateVerification,
+                                                         config.TrustListDir.c_str(),
+                                                         "",
+                                                         "");
+            if (res != UA_STATUSCODE_GOOD) {
+                throw std::runtime_error(std::string("OPC UA trust list loading failed: ") + UA_StatusCode_name(res));
+            }
+        }
+        CacheCertificateVerification(serverCfg->certificateVerification, *certificateCache);
+
+        // The None policy is still needed to get endpoints of the server
+        serverCfg->securityPolicyNoneDiscoveryOnly = !config.SecurityNone;
+        if (config.SecurityNone) {
+            res = UA_ServerConfig_addEndpoint(serverCfg, UA_SECURITY_POLICY_NONE_URI, UA_MESSAGESECURITYMODE_NONE);
+            if (res != UA_STATUSCODE_GOOD) {
+                throw std::runtime_error(std::string("OPC UA server endpoint allocation failed: ") +
+                                         UA_StatusCode_name(res));
+            }
+        }
+    }
+
+    //! Groups with PubSub writer ids by the ids
+    std::map<uint16_t, OPCUA::TPublishedGroup> GetPublishedGroups(const OPCUA::TObjectNodesConfig& objectNodes)
+    {
+        std::map<uint16_t, OPCUA::TPublishedGroup> res;
+        for (const auto& objectNode: objectNodes) {
+            if (objectNode.second.empty() || objectNode.second.front().PubSubWriterId == 0) {
+                continue;
+            }
+            auto& group = res[objectNode.second.front().PubSubWriterId];
+            group.ObjectNodeName = objectNode.first;
+            for (const auto& variableNode: objectNode.second) {
+                group.NodeNames.push_back(variableNode.DeviceControlPair);
+            }
+            group.PublishedDataSetId = UA_NODEID_NULL;
+            group.WriterGroupId = UA_NODEID_NULL;
+        }
+        return res;
+    }
+
+    //! Sets slot lists and snapshots of groups from slots of the index
+    void SetGroups(OPCUA::TVariableNodeIndex& index,
+                   const OPCUA::TObjectNodesConfig& objectNodes,
+                   OPCUA::TServerImpl* server)
+    {
+        index.ByObjectNodeName.clear();
+        index.Snapshots.clear();
+        for (const auto& objectNode: objectNodes) {
+            auto& slots = index.ByObjectNodeName[objectNode.first];
+            for (const auto& variableNode: objectNode.second) {
+                auto it = index.ByNodeName.find(variableNode.DeviceControlPair);
+                if (it != index.ByNodeName.end() && it->second->ObjectNodeName == objectNode.first) {
+                    slots.push_back(it->second);
+                }
+            }
+            if (slots.empty() || !objectNode.second.front().Snapshot) {
+                continue;
+            }
+            auto snapshot = std::make_shared<OPCUA::TGroupSnapshot>();
+            snapshot->Server = server;
+            snapshot->NodeName = objectNode.first + "#" + SNAPSHOT_NODE_NAME;
+            snapshot->ControlsNodeName = objectNode.first + "#" + SNAPSHOT_CONTROLS_NODE_NAME;
+            snapshot->ObjectNodeName = objectNode.first;
+            snapshot->Slots = slots;
+            index.Snapshots.emplace(objectNode.first, snapshot);
+        }
+    }
+
+    std::unique_ptr<OPCUA::TVariableNodeIndex> MakeVariableNodeIndex(const OPCUA::TObjectNodesConfig& objectNodes,
+                                                                     OPCUA::TServerImpl* server,
+                                                                     OPCUA::THistoryStorage* historyStorage)
+    {
+        auto res = std::make_unique<OPCUA::TVariableNodeIndex>();
+        for (const auto& objectNode: objectNodes) {
+            for (const auto& variableNode: objectNode.second) {
+                auto pos = variableNode.DeviceControlPair.find('/');
+                OPCUA::TControlKey key(variableNode.DeviceControlPair.substr(0, pos),
+                                       variableNode.DeviceControlPair.substr(pos + 1));
+                auto slot = std::make_shared<OPCUA::TVariableNodeSlot>();
+                slot->Server = server;
+                slot->NodeName = variableNode.DeviceControlPair;
+                slot->ControlId = variableNode.DeviceControlPair.substr(pos + 1);
+                slot->AbsoluteDeadband = variableNode.AbsoluteDeadband;
+                slot->PercentDeadband = variableNode.PercentDeadband;
+                slot->ObjectNodeName = objectNode.first;
+                slot->HistoryDepth = variableNode.HistoryDepth;
+                slot->HistoryRetention = variableNode.HistoryRetention;
+                if (slot->HistoryDepth > 0) {
+                    slot->History = std::make_unique<OPCUA::THistoryBuffer>(slot->HistoryDepth);
+                }
+                if (historyStorage && slot->HistoryRetention.count() > 0) {
+                    try {
+                        slot->HistoryFile = historyStorage->GetFile(objectNode.first, slot->HistoryRetention);
+                    } catch (const std::exception& e) {
+                        LOG(Error) << "History of '" << objectNode.first << "' can't be stored on disk: " << e.what();
+                    }
+                }
+                if (!res->ByControl.emplace(std::move(key), slot).second) {
+                    LOG(Warn) << "'" << variableNode.DeviceControlPair << "' is already added to another group, '"
+                              << objectNode.first << "' entry is ignored";
+                    continue;
+                }
+                res->ByNodeName.emplace(slot->NodeName, slot);
+            }
+        }
+        SetGroups(*res, objectNodes, server);
+        return res;
+    }
+
+}
+
+namespace OPCUA
+{
+    TServerImpl::TServerImpl(const TServerConfig& config, WBMQTT::PDeviceDriver driver)
+        : AsyncLog(std::make_unique<TAsyncLog>()),
+          CertificateCache(std::make_unique<TCertificateCache>(CERTIFICATE_CACHE_SIZE, CERTIFICATE_CACHE_TTL)),
+          IsRunning(true),
+          Config(config),
+          Driver(driver),
+          HistoryStorage(MakeHistoryStorage(config, config.ObjectNodes)),
+          Index(MakeVariableNodeIndex(config.ObjectNodes, this, HistoryStorage.get())),
+          WriteQueue(std::make_unique<TWriteQueue>(driver, config.WriteQueueSize))
+    {
+        for (size_t i = 0; i < std::max<size_t>(config.Threads, 1); ++i) {
+            PServer server(UA_Server_new());
+            if (!server) {
+                throw std::runtime_error("OPC UA server initilization failed");
+            }
+            Servers.push_back(std::move(server));
+        }
+
+        // Setup OPC UA server instances and start listening before MQTT controls are loaded,
+        // nodes are filled in as retained values arrive
+        for (size_t i = 0; i < Servers.size(); ++i) {
+            ConfigureOpcUaServer(UA_Server_getConfig(Servers[i].get()),
+                                 this,
+                                 config,
+                                 config.BindPort + i,
+                                 AsyncLog.get(),
+                                 CertificateCache.get());
+            ConfigureHistoryDatabase(UA_Server_getConfig(Servers[i].get()), this);
+            if (config.LoadGovernor) {
+                LoadGovernors.push_back(std::make_unique<TLoadGovernor>(LOAD_GOVERNOR_PERIOD,
+                                                                        config.MaxLoopLag,
+                                                                        config.MaxCpuLoad,
+                                                                        config.MinSamplingInterval,
+                                                                        config.MinPublishingInterval));
+                auto res = UA_Server_addRepeatedCallback(Servers[i].get(),
+                                                         GovernLoadCallback,
+                                                         LoadGovernors.back().get(),
+                                                         LOAD_GOVERNOR_PERIOD.count(),
+                                                         nullptr);
+                if (res != UA_STATUSCODE_GOOD) {
+                    throw std::runtime_error(std::string("OPC UA load governor setup failed: ") +
+                                             UA_StatusCode_name(res));
+                }
+            }
+        }
+        for (size_t i = 0; config.PushValues && i < Servers.size(); ++i) {
+            PendingPushes.push_back(std::make_unique<TPendingPushes>());
+        }
+        if (config.PushValues) {
+            InstallWakeupSignalHandler();
+        } else if (config.LoopLatency.count() > 0) {
+            LOG(Warn) << "Loop latency is used only with pushing values";
+        }
+        // A wakeup arriving after taking pending snapshots and before the network wait is lost,
+        // the timer bounds the wait then
+        if (config.PushValues && config.LoopLatency.count() > 0) {
+            auto interval = std::min(config.LoopLatency, SERVER_LOOP_MAX_WAIT);
+            for (const auto& server: Servers) {
+                auto res = UA_Server_addRepeatedCallback(server.get(),
+                                                         LoopLatencyCallback,
+                                                         nullptr,
+                                                         interval.count(),
+                                                         nullptr);
+                if (res != UA_STATUSCODE_GOOD) {
+                    throw std::runtime_error(std::string("OPC UA server loop setup failed: ") +
+                                             UA_StatusCode_name(res));
+                }
+            }
+        }
+        if (!config.Certificate.empty() && config.TrustListDir.empty()) {
+            LOG(Warn) << "Trust list directory is not set, all client certificates are accepted";
+        }
+        BuildAddressSpace();
+        if (!config.PubSubAddress.empty()) {
+            // PubSub is optional, so the server keeps serving clients without it
+            try {
+                CreatePubSub();
+            } catch (const std::exception& e) {
+                LOG(Error) << e.what() << ", groups are not published";
+            }
+        }
+        // Everything that may throw is done before the threads start and the driver callback is registered,
+        // so a failed constructor doesn't leave running threads with a dangling this
+        if (Config.MetricsInterval.count() > 0) {
+            CreateMetrics();
+        }
+        try {
+            for (size_t i = 0; i < Servers.size(); ++i) {
+                ServerThreads.emplace_back([this, i]() { RunServer(i); });
+            }
+        } catch (...) {
+            IsRunning = false;
+            for (auto& thread: ServerThreads) {
+                thread.join();
+            }
+            throw;
+        }
+        if (Servers.size() > 1) {
+            LOG(Info) << Servers.size() << " server threads listen to ports " << config.BindPort << "-"
+                      << config.BindPort + Servers.size() - 1;
+        }
+
+        ControlValueHandler = Driver->On<WBMQTT::TControlValueEvent>(
+            [&](const WBMQTT::TControlValueEvent& event) { ControlValueEventCallback(event); });
+
+        // Load external controls. Retained values fill in the nodes in background, so a slow load after reboot
+        // doesn't delay the startup. The event callback logs when all configured controls have values
+        SetDeviceFilter(config.ObjectNodes);
+
+        if (Config.MetricsInterval.count() > 0) {
+            MetricsThread = std::thread([this]() {
+                WBMQTT::SetThreadName("opcua-metrics");
+                RunMetrics();
+            });
+        }
+    }
+
+    TServerImpl::~TServerImpl()
+    {
+        {
+            std::unique_lock<std::mutex> lock(MetricsMutex);
+            StopMetrics = true;
+        }
+        MetricsStopped.notify_all();
+        if (MetricsThread.joinable()) {
+            MetricsThread.join();
+        }
+        LogLatency();
+        Driver->RemoveEventHandler(ControlValueHandler);
+        if (IsRunning) {
+            {
+                // A callback still running may be waking a server thread, its handle must not be joined yet
+                std::unique_lock<std::mutex> lock(WakeupMutex);
+                IsRunning = false;
+            }
+            for (auto& thread: ServerThreads) {
+                if (thread.joinable()) {
+                    thread.join();
+                }
+            }
+        }
+        // Deleted before node contexts and the rest of the server state
+        Servers.clear();
+        for (auto& objectNode: ObjectNodeIds) {
+            UA_NodeId_clear(&objectNode.second);
+        }
+    }
+
+    void TServerDeleter::operator()(UA_Server* server) const
+    {
+        // Sessions are closed on deletion, the server is partially destroyed already.
+        // An instance which failed before configuration keeps the default access control
+        if (UA_Server_getConfig(server)->accessControl.clear == ClearAccessControl) {
+            GetAccessControlContext(server)->Owner = nullptr;
+        }
+        UA_Server_delete(server);
+    }
+
+    PVariableNodeSlot TServerImpl::FindVariableNodeSlot(const std::string& nodeName) const
+    {
+        auto index = Index.Read();
+        auto it = index->ByNodeName.find(nodeName);
+        return it != index->ByNodeName.end() ? it->second : nullptr;
+    }
+
+    UA_Server* TServerImpl::GetServerInstance(size_t index) const
+    {
+        return Servers[index].get();
+    }
+
+    const TWriteQueue& TServerImpl::GetWriteQueue() const
+    {
+        return *WriteQueue;
+    }
+
+    bool TServerImpl::ControlExists(const std::string& nodeName)
+    {
+        auto slot = FindVariableNodeSlot(nodeName);
+        return slot && slot->Control.load(std::memory_order_acquire);
+    }
+
+    void TServerImpl::AddControl(const std::string& nodeName, WBMQTT::PControl control)
+    {
+        auto slot = FindVariableNodeSlot(nodeName);
+        if (!slot) {
+            throw std::runtime_error("Control '" + nodeName + "' is not configured");
+        }
+        PublishControl(*slot, control);
+    }
+
+    void TServerImpl::RemoveControl(const std::string& nodeName)
+    {
+        auto slot = FindVariableNodeSlot(nodeName);
+        if (slot) {
+            // The owner is kept, readers could still use the control
+            slot->Control.store(nullptr, std::memory_order_release);
+        }
+    }
+
+    WBMQTT::PControl TServerImpl::GetControl(const std::string& nodeName)
+    {
+        auto slot = FindVariableNodeSlot(nodeName);
+        if (!slot) {
+            return nullptr;
+        }
+        auto lock = LockMeasured(Mutex);
+        return slot->Control.load(std::memory_order_acquire) ? slot->ControlOwner : nullptr;
+    }
+
+    void TServerImpl::PublishControl(TVariableNodeSlot& slot, WBMQTT::PControl control)
+    {
+        auto lock = LockMeasured(Mutex);
+        auto previous = std::move(slot.ControlOwner);
+        slot.ControlOwner = control;
+        slot.Control.store(control.get());
+        if (previous && previous != control) {
+            // Readers could still use the previous control, the epoch is taken after it is unlinked
+            RetiredControls.emplace_back(ControlReaders.GetEpoch(), std::move(previous));
+        }
+        ReleaseRetiredControls();
+    }
+
+    void TServerImpl::ReleaseRetiredControls()
+    {
+        // Without readers a grace period takes two epochs, so a control retired just now is released too
+        for (int i = 0; i < 2 && !RetiredControls.empty(); ++i) {
+            ControlReaders.TryAdvance();
+        }
+        RetiredControls.erase(std::remove_if(RetiredControls.begin(),
+                                             RetiredControls.end(),
+                                             [this](const std::pair<uint32_t, WBMQTT::PControl>& retired) {
+                                                 return ControlReaders.IsGracePeriodOver(retired.first);
+                                             }),
+                              RetiredControls.end());
+    }
+
+    UA_StatusCode TServerImpl::MakeWriteRequest(TVariableNodeSlot& slot,
+                                                const UA_Variant* value,
+                                                TWriteRequest& request)
+    {
+        const auto& nodeIdName = slot.NodeName;
+        WBMQTT::PControl ctrl;
+        {
+            // The request keeps the control while it is queued
+            auto lock = LockMeasured(Mutex);
+            if (slot.Control.load(std::memory_order_relaxed)) {
+                ctrl = slot.ControlOwner;
+            }
+        }
+        if (!ctrl || ctrl->IsReadonly()) {
+            Metrics::Add(TCounter::FailedWrites);
+            uint64_t suppressed;
+            if (WriteErrorLogLimit.Allow(suppressed)) {
+                LOG(Error) << "Variable node '" << nodeIdName << "' writing failed. "
+                           << (ctrl ? "It is read only" : "It is not presented in MQTT") << TSuppressed{suppressed};
+            }
+            return UA_STATUSCODE_BADDEVICEFAILURE;
+        }
+        if (!value || !GetWriteValue(request.Value, slot.ValueKind, *value)) {
+            Metrics::Add(TCounter::FailedWrites);
+            return UA_STATUSCODE_BADDATATYPEIDUNKNOWN;
+        }
+        request.NodeName = nodeIdName;
+        request.Control = std::move(ctrl);
+        return UA_STATUSCODE_GOOD;
+    }
+
+    UA_StatusCode TServerImpl::GetWriteResult(std::future<UA_StatusCode>& res,
+                                              const std::string& nodeName,
+                                              std::chrono::steady_clock::time_point deadline)
+    {
+        if (Config.WriteMode == TWriteMode::Enqueue) {
+            // The request is already completed if it was rejected
+            return (res.wait_for(std::chrono::seconds(0)) == std::future_status::ready) ? res.get()
+                                                                                        : UA_STATUSCODE_GOOD;
+        }
+        if (res.wait_until(deadline) != std::future_status::ready) {
+            WriteQueue->AddTimeout();
+            uint64_t suppressed;
+            if (WriteTimeoutLogLimit.Allow(suppressed)) {
+                LOG(Warn) << "Variable node '" << nodeName << "' is not published to MQTT in "
+                          << Config.WriteTimeout.count() << " ms, write queue depth is "
+                          << WriteQueue->GetStats().Depth << TSuppressed{suppressed};
+            }
+            return UA_STATUSCODE_BADTIMEOUT;
+        }
+        return res.get();
+    }
+
+    UA_StatusCode TServerImpl::WriteVariable(TVariableNodeSlot& slot, const UA_DataValue* dataValue)
+    {
+        TLatencyTimer timer(WriteLatency);
+        Metrics::Add(TCounter::Writes);
+        TWriteRequest request;
+        auto status = MakeWriteRequest(slot, dataValue->hasValue ? &dataValue->value : nullptr, request);
+        if (status != UA_STATUSCODE_GOOD) {
+            return status;
+        }
+        if (ServiceWrites && Config.WriteMode == TWriteMode::Enqueue) {
+            // The place is reserved now, so a full queue is still reported to the client
+            if (!WriteQueue->Reserve(request.NodeName)) {
+                return UA_STATUSCODE_BADTOOMANYOPERATIONS;
+            }
+            ServiceWrites->emplace_back(std::move(request));
+            return UA_STATUSCODE_GOOD;
+        }
+        auto res = WriteQueue->Push(std::move(request));
+        return GetWriteResult(res, slot.NodeName, std::chrono::steady_clock::now() + Config.WriteTimeout);
+    }
+
+    UA_StatusCode TServerImpl::ReadVariable(TVariableNodeSlot& slot, UA_DataValue* dataValue, bool sourceTimestamp)
+    {
+        TLatencyTimer timer(ReadLatency);
+        Metrics::Add(TCounter::Reads);
+        const auto& nodeIdName = slot.NodeName;
+        auto section = ControlReaders.Read();
+        auto ctrl = slot.Control.load(std::memory_order_acquire);
+        if (!ctrl) {
+            // The control hasn't appeared in MQTT yet
+            dataValue->hasStatus = true;
+            dataValue->status = UA_STATUSCODE_UNCERTAININITIALVALUE;
+            return UA_STATUSCODE_GOOD;
+        }
+        try {
+            // Sampling of monitored items in push mode doesn't touch the control
+            if (!Config.PushValues || !SetCommittedDataValue(dataValue, slot)) {
+                SetDataValue(dataValue, *ctrl, slot);
+            }
+        } catch (const std::exception& e) {
+            uint64_t suppressed;
+            if (ReadErrorLogLimit.Allow(suppressed)) {
+                LOG(Error) << "Variable node '" << nodeIdName << "' read error: " << e.what()
+                           << TSuppressed{suppressed};
+            }
+            dataValue->hasStatus = true;
+            dataValue->status = UA_STATUSCODE_BADNOCOMMUNICATION;
+        }
+        SetTimestamps(dataValue, slot, sourceTimestamp);
+        return UA_STATUSCODE_GOOD;
+    }
+
+    UA_StatusCode TServerImpl::ReadSnapshot(TGroupSnapshot& snapshot, UA_DataValue* dataValue)
+    {
+        TLatencyTimer timer(ReadLatency);
+        Metrics::Add(TCounter::Reads);
+        auto section = ControlReaders.Read();
+        SetSnapshotDataValue(dataValue, snapshot);
+        return UA_STATUSCODE_GOOD;
+    }
+
+    UA_StatusCode TServerImpl::GetGroupValues(const std::string& objectNodeName, UA_Variant* output)
+    {
+        TLatencyTimer timer(ReadLatency);
+        auto index = Index.Read();
+        auto section = ControlReaders.Read();
+        auto it = index->ByObjectNodeName.find(objectNodeName);
+        if (it == index->ByObjectNodeName.end()) {
+            return UA_STATUSCODE_BADNODEIDUNKNOWN;
+        }
+        const auto& slots = it->second;
+        Metrics::Add(TCounter::Reads, slots.size());
+        auto names = (UA_String*)UA_Array_new(slots.size(), &UA_TYPES[UA_TYPES_STRING]);
+        auto values = (UA_Variant*)UA_Array_new(slots.size(), &UA_TYPES[UA_TYPES_VARIANT]);
+        auto statuses = (UA_StatusCode*)UA_Array_new(slots.size(), &UA_TYPES[UA_TYPES_STATUSCODE]);
+        if (!names || !values || !statuses) {
+            UA_Array_delete(names, names ? slots.size() : 0, &UA_TYPES[UA_TYPES_STRING]);
+            UA_Array_delete(values, values ? slots.size() : 0, &UA_TYPES[UA_TYPES_VARIANT]);
+            UA_Array_delete(statuses, statuses ? slots.size() : 0, &UA_TYPES[UA_TYPES_STATUSCODE]);
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        }
+        // Outputs are freed by the server
+        UA_Variant_setArray(&output[0], names, slots.size(), &UA_TYPES[UA_TYPES_STRING]);
+        UA_Variant_setArray(&output[1], values, slots.size(), &UA_TYPES[UA_TYPES_VARIANT]);
+        UA_Variant_setArray(&output[2], statuses, slots.size(), &UA_TYPES[UA_TYPES_STATUSCODE]);
+        for (size_t i = 0; i < slots.size(); ++i) {
+            auto& slot = *slots[i];
+            names[i] = UA_STRING_ALLOC(slot.NodeName.c_str());
+            auto ctrl = slot.Control.load(std::memory_order_acquire);
+            if (!ctrl) {
+                statuses[i] = UA_STATUSCODE_UNCERTAININITIALVALUE;
+                continue;
+            }
+            UA_DataValue item;
+            UA_DataValue_init(&item);
+            try {
+                SetDataValue(&item, *ctrl, slot);
+                statuses[i] = item.status;
+                // The array takes ownership of the value
+                values[i] = item.value;
+                UA_Variant_init(&item.value);
+            } catch (const std::exception& e) {
+                uint64_t suppressed;
+                if (ReadErrorLogLimit.Allow(suppressed)) {
+                    LOG(Error) << "Variable node '" << slot.NodeName << "' read error: " << e.what()
+                               << TSuppressed{suppressed};
+                }
+                statuses[i] = UA_STATUSCODE_BADNOCOMMUNICATION;
+            }
+            UA_DataValue_clear(&item);
+        }
+        return UA_STATUSCODE_GOOD;
+    }
+
+    UA_StatusCode TServerImpl::SetGroupValues(const std::string& objectNodeName,
+                                              const UA_Variant* input,
+                                              UA_Variant* output)
+    {
+        TLatencyTimer timer(WriteLatency);
+        if (!UA_Variant_hasArrayType(&input[0], &UA_TYPES[UA_TYPES_STRING]) ||
+            !UA_Variant_hasArrayType(&input[1], &UA_TYPES[UA_TYPES_VARIANT]) ||
+            input[0].arrayLength != input[1].arrayLength)
+        {
+            return UA_STATUSCODE_BADINVALIDARGUMENT;
+        }
+        auto names = (const UA_String*)input[0].data;
+        auto values = (const UA_Variant*)input[1].data;
+        size_t count = input[0].arrayLength;
+        Metrics::Add(TCounter::Writes, count);
+        auto results = (UA_StatusCode*)UA_Array_new(count, &UA_TYPES[UA_TYPES_STATUSCODE]);
+        if (!results) {
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        }
+        UA_Variant_setArray(&output[0], results, count, &UA_TYPES[UA_TYPES_STATUSCODE]);
+
+        auto index = Index.Read();
+        std::vector<TWriteRequest> requests;
+        std::vector<size_t> positions;
+        for (size_t i = 0; i < count; ++i) {
+            auto it = index->ByNodeName.find(std::string((const char*)names[i].data, names[i].length));
+            if (it == index->ByNodeName.end() || it->second->ObjectNodeName != objectNodeName) {
+                Metrics::Add(TCounter::FailedWrites);
+                results[i] = UA_STATUSCODE_BADNODEIDUNKNOWN;
+                continue;
+            }
+            TWriteRequest request;
+            results[i] = MakeWriteRequest(*it->second, &values[i], request);
+            if (results[i] == UA_STATUSCODE_GOOD) {
+                requests.push_back(std::move(request));
+                positions.push_back(i);
+            }
+        }
+        if (requests.empty()) {
+            return UA_STATUSCODE_GOOD;
+        }
+        std::vector<std::string> nodeNames;
+        for (const auto& request: requests) {
+            nodeNames.push_back(request.NodeName);
+        }
+        auto res = WriteQueue->Push(std::move(requests));
+        auto deadline = std::chrono::steady_clock::now() + Config.WriteTimeout;
+        for (size_t i = 0; i < res.size(); ++i) {
+            results[positions[i]] = GetWriteResult(res[i], nodeNames[i], deadline);
+        }
+        return UA_STATUSCODE_GOOD;
+    }
+
+    void TServerImpl::ControlValueEventCallback(const WBMQTT::TControlValueEvent& event)
+    {
+        if (event.RawValue.empty()) {
+            return;
+        }
+        auto index = Index.Read();
+        auto it = index->ByControl.find(
+            std::pair<std::string_view, std::string_view>(event.Control->GetDevice()->GetId(), event.Control->GetId()));
+        if (it == index->ByControl.end()) {
+            return;
+        }
+        auto receivedTime = UA_DateTime_now();
+        TLatencyTimer timer(EventLatency);
+        Metrics::Add(TCounter::Events);
+        auto& slot = *it->second;
+        if (slot.Materialized) {
+            CommitControlValue(*index, slot, *event.Control, receivedTime);
+            return;
+        }
+        auto lock = LockMeasured(AddressSpaceMutex);
+        if (slot.Removed) {
+            // Reload has replaced the slot
+            return;
+        }
+        if (slot.Materialized) {
+            // Reload has set up the node with the value it has read before, the event may bring a newer one
+            CommitControlValue(*index, slot, *event.Control, receivedTime);
+            return;
+        }
+        MaterializeSlot(*index, slot, event.Control, receivedTime);
+    }
+
+    void TServerImpl::CommitControlValue(const TVariableNodeIndex& index,
+                                         TVariableNodeSlot& slot,
+                                         const WBMQTT::TControl& control,
+                                         UA_DateTime receivedTime)
+    {
+        if (CommitValue(slot, control)) {
+            slot.ReceivedTime.store(receivedTime, std::memory_order_relaxed);
+            RecordHistory(slot, control, receivedTime);
+            if (Config.PushValues) {
+                PushSnapshot(index, slot.ObjectNodeName);
+            }
+        }
+    }
+
+    void TServerImpl::MaterializeSlot(const TVariableNodeIndex& index,
+                                      TVariableNodeSlot& slot,
+                                      const WBMQTT::PControl& control,
+                                      UA_DateTime receivedTime)
+    {
+        try {
+            if (!slot.NodeCreated) {
+                // Node creation at startup failed, try again
+                CreateVariableNode(GetObjectNode(slot.ObjectNodeName), slot);
+                slot.NodeCreated = true;
+            }
+            PublishControl(slot, control);
+            try {
+                SetupVariableNode(slot);
+            } catch (...) {
+                slot.Control.store(nullptr, std::memory_order_release);
+                throw;
+            }
+            CommitValue(slot, *control);
+            slot.ReceivedTime.store(receivedTime, std::memory_order_relaxed);
+            RecordHistory(slot, *control, receivedTime);
+            slot.Materialized = true;
+            if (Config.PushValues) {
+                PushSnapshot(index, slot.ObjectNodeName);
+            }
+            if (PendingValues.fetch_sub(1) == 1) {
+                LOG(Info) << "All configured controls have values in " << GetUptimeMs() << " ms";
+            }
+        } catch (const std::exception& e) {
+            LOG(Error) << "Failed to add control '" << slot.NodeName << "': " << e.what();
+        }
+    }
+
+    UA_StatusCode TServerImpl::ReadHistory(const UA_ReadRawModifiedDetails& details,
+                                           UA_TimestampsToReturn timestampsToReturn,
+                                           const UA_HistoryReadValueId& node,
+                                           UA_ByteString& continuationPoint,
+                                           UA_HistoryData& data)
+    {
+        if (node.nodeId.namespaceIndex != 1 || node.nodeId.identifierType != UA_NODEIDTYPE_STRING) {
+            return UA_STATUSCODE_BADHISTORYOPERATIONUNSUPPORTED;
+        }
+        auto slot = FindVariableNodeSlot(
+            std::string((const char*)node.nodeId.identifier.string.data, node.nodeId.identifier.string.length));
+        if (!slot || !::HasHistory(*slot)) {
+            return UA_STATUSCODE_BADHISTORYOPERATIONUNSUPPORTED;
+        }
+        if (details.startTime == 0 && (details.endTime == 0 || details.numValuesPerNode == 0)) {
+            return UA_STATUSCODE_BADHISTORYOPERATIONINVALID;
+        }
+
+        // Without start time or with start after end values go in reverse order
+        bool reverse = details.endTime != 0 && (details.startTime == 0 || details.startTime > details.endTime);
+        UA_DateTime start = details.startTime;
+        UA_DateTime end = details.endTime;
+        if (reverse) {
+            start = std::min(details.startTime, details.endTime);
+            end = std::max(details.startTime, details.endTime);
+        }
+        if (end == 0) {
+            end = std::numeric_limits<UA_DateTime>::max();
+        }
+
+        // Continuation point is the time of the next value to return
+        // and the number of already returned values with the same time
+        THistoryContinuationPoint next{0, 0};
+        if (node.continuationPoint.length == sizeof(next)) {
+            memcpy(&next, node.continuationPoint.data, sizeof(next));
+            if (reverse) {
+                end = next.Time;
+            } else {
+                start = next.Time;
+            }
+        } else if (node.continuationPoint.length != 0) {
+            return UA_STATUSCODE_BADCONTINUATIONPOINTINVALID;
+        }
+
+        std::vector<THistorySample> samples;
+        auto oldestTime = slot->History ? slot->History->GetOldestTime() : 0;
+        if (slot->History && (!slot->HistoryFile || (oldestTime != 0 && oldestTime <= start))) {
+            slot->History->Read(start, end, samples);
+        } else {
+            slot->HistoryFile->Read(slot->NodeName, start, end, samples);
+        }
+        if (reverse) {
+            std::reverse(samples.begin(), samples.end());
+        }
+        size_t first = 0;
+        while (first < next.Offset && first < samples.size() && samples[first].Time == next.Time) {
+            ++first;
+        }
+
+        size_t count = samples.size() - first;
+        if (details.numValuesPerNode != 0 && count > details.numValuesPerNode) {
+            count = details.numValuesPerNode;
+            THistoryContinuationPoint point{samples[first + count].Time, 0};
+            for (auto i = first + count; i > 0 && samples[i - 1].Time == point.Time; --i) {
+                ++point.Offset;
+            }
+            auto res = UA_ByteString_allocBuffer(&continuationPoint, sizeof(point));
+            if (res != UA_STATUSCODE_GOOD) {
+                return res;
+            }
+            memcpy(continuationPoint.data, &point, sizeof(point));
+        }
+        if (count == 0) {
+            return UA_STATUSCODE_GOODNODATA;
+        }
+        data.dataValues = (UA_DataValue*)UA_Array_new(count, &UA_TYPES[UA_TYPES_DATAVALUE]);
+        if (!data.dataValues) {
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        }
+        data.dataValuesSize = count;
+        for (size_t i = 0; i < count; ++i) {
+            SetHistoryDataValue(data.dataValues[i], samples[first + i], timestampsToReturn);
+        }
+        return UA_STATUSCODE_GOOD;
+    }
+
+    bool TServerImpl::HasHistory(const UA_NodeId& nodeId) const
+    {
+        if (nodeId.namespaceIndex != 1 || nodeId.identifierType != UA_NODEIDTYPE_STRING) {
+            return false;
+        }
+        auto slot = FindVariableNodeSlot(
+            std::string((const char*)nodeId.identifier.string.data, nodeId.identifier.string.length));
+        return slot && ::HasHistory(*slot);
+    }
+
+    UA_NodeId TServerImpl::CreateObjectNode(const std::string& nodeName)
+    {
+        UA_NodeId nodeId = UA_NODEID_STRING(1, (char*)nodeName.c_str());
+        UA_ObjectAttributes oAttr = UA_ObjectAttributes_default;
+        oAttr.displayName = UA_LOCALIZEDTEXT((char*)"en-US", (char*)nodeName.c_str());
+        for (size_t i = 0; i < Servers.size(); ++i) {
+            auto res = UA_Server_addObjectNode(Servers[i].get(),
+                                               nodeId,
+                                               UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                               UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                               UA_QUALIFIEDNAME(1, (char*)nodeName.c_str()),
+                                               UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE),
+                                               oAttr,
+                                               nullptr,
+                                               nullptr);
+            if (res != UA_STATUSCODE_GOOD) {
+                DeleteNode(nodeId, i);
+                throw std::runtime_error("Object node '" + nodeName + "' creation failed: " + UA_StatusCode_name(res));
+            }
+        }
+        return nodeId;
+    }
+
+    void TServerImpl::CreateVariableNode(const UA_NodeId& parentNodeId, TVariableNodeSlot& slot)
+    {
+        const auto& nodeName = slot.NodeName;
+        UA_VariableAttributes oAttr = UA_VariableAttributes_default;
+        SetInitialVariableAttributes(oAttr, slot);
+
+        auto nodeId = UA_NODEID_STRING(1, (char*)nodeName.c_str());
+        for (size_t i = 0; i < Servers.size(); ++i) {
+            auto res = AddVariableNode(Servers[i].get(), nodeId, parentNodeId, oAttr, slot);
+            if (res != UA_STATUSCODE_GOOD) {
+                DeleteNode(nodeId, i);
+                throw std::runtime_error("Variable node '" + nodeName + "' creation failed: " +
+                                         UA_StatusCode_name(res));
+            }
+        }
+    }
+
+    void TServerImpl::SetupVariableNode(TVariableNodeSlot& slot)
+    {
+        const auto& nodeName = slot.NodeName;
+        UA_VariableAttributes oAttr = UA_VariableAttributes_default;
+        slot.DataType = SetVariableAttributes(oAttr, slot);
+        SetHistoryAttributes(oAttr, slot);
+
+        auto nodeId = UA_NODEID_STRING(1, (char*)nodeName.c_str());
+        for (const auto& server: Servers) {
+            auto res = WriteVariableNodeAttributes(server.get(), nodeId, oAttr);
+            if (res != UA_STATUSCODE_GOOD) {
+                throw std::runtime_error("Variable node '" + nodeName + "' setup failed: " + UA_StatusCode_name(res));
+            }
+        }
+    }
+
+    UA_StatusCode TServerImpl::WriteVariableNodeAttributes(UA_Server* server,
+                                                           const UA_NodeId& nodeId,
+                                                           const UA_VariableAttributes& attr)
+    {
+        auto res = UA_Server_writeAccessLevel(server, nodeId, attr.accessLevel);
+        if (res != UA_STATUSCODE_GOOD) {
+            return res;
+        }
+        return UA_Server_writeDataType(server, nodeId, attr.dataType);
+    }
+
+    UA_StatusCode TServerImpl::AddVariableNode(UA_Server* server,
+                                               const UA_NodeId& nodeId,
+                                               const UA_NodeId& parentNodeId,
+                                               const UA_VariableAttributes& attr,
+                                               TVariableNodeSlot& slot)
+    {
+        auto browseName = UA_QUALIFIEDNAME(1, (char*)slot.ControlId.c_str());
+        // Writes return the result of publishing, so a client learns about a failed write in both modes
+        UA_DataSource dataSource;
+        dataSource.read = ReadVariableCallback;
+        dataSource.write = WriteVariableCallback;
+
+        return UA_Server_addDataSourceVariableNode(server,
+                                                   nodeId,
+                                                   parentNodeId,
+                                                   UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                   browseName,
+                                                   UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                                   attr,
+                                                   dataSource,
+                                                   &slot,
+                                                   nullptr);
+    }
+
+    void TServerImpl::CreateMethodNodes(const UA_NodeId& objectNodeId, const std::string& objectNodeName)
+    {
+        UA_Argument getValuesOutput[] = {
+            MakeArrayArgument("Controls", UA_NS0ID_STRING, "DEVICE/CONTROL names of the group controls"),
+            MakeArrayArgument("Values", UA_NS0ID_BASEDATATYPE, "Values of the controls, empty if there is no value"),
+            MakeArrayArgument("Statuses", UA_NS0ID_STATUSCODE, "Statuses of the values")};
+        UA_Argument setValuesInput[] = {
+            MakeArrayArgument("Controls", UA_NS0ID_STRING, "DEVICE/CONTROL names of the controls to write"),
+            MakeArrayArgument("Values", UA_NS0ID_BASEDATATYPE, "Values to write")};
+        UA_Argument setValuesOutput[] = {
+            MakeArrayArgument("Results", UA_NS0ID_STATUSCODE, "Results of publishing the values to MQTT")};
+
+        struct TMethod
+        {
+            const std::string& Name;
+            UA_MethodCallback Callback;
+            size_t InputSize;
+            const UA_Argument* Input;
+            size_t OutputSize;
+            const UA_Argument* Output;
+        };
+        TMethod methods[] = {{GET_VALUES_METHOD_NAME, GetValuesMethodCallback, 0, nullptr, 3, getValuesOutput},
+                             {SET_VALUES_METHOD_NAME, SetValuesMethodCallback, 2, setValuesInput, 1, setValuesOutput}};
+
+        for (const auto& method: methods) {
+            auto nodeName = objectNodeName + "#" + method.Name;
+            auto nodeId = UA_NODEID_STRING(1, (char*)nodeName.c_str());
+            UA_MethodAttributes attr = UA_MethodAttributes_default;
+            attr.displayName = UA_LOCALIZEDTEXT((char*)"en-US", (char*)method.Name.c_str());
+            attr.executable = true;
+            attr.userExecutable = true;
+            for (size_t i = 0; i < Servers.size(); ++i) {
+                auto res = UA_Server_addMethodNode(Servers[i].get(),
+                                                   nodeId,
+                                                   objectNodeId,
+                                                   UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                   UA_QUALIFIEDNAME(1, (char*)method.Name.c_str()),
+                                                   attr,
+                                                   method.Callback,
+                                                   method.InputSize,
+                                                   method.Input,
+                                                   method.OutputSize,
+                                                   method.Output,
+                                                   this,
+                                                   nullptr);
+                if (res != UA_STATUSCODE_GOOD) {
+                    DeleteNode(nodeId, i);
+                    DeleteMethodNodes(objectNodeName);
+                    throw std::runtime_error("Method node '" + nodeName + "' creation failed: " +
+                                             UA_StatusCode_name(res));
+                }
+            }
+        }
+    }
+
+    void TServerImpl::DeleteMethodNodes(const std::string& objectNodeName)
+    {
+        for (const auto& name: {GET_VALUES_METHOD_NAME, SET_VALUES_METHOD_NAME}) {
+            auto nodeName = objectNodeName + "#" + name;
+            DeleteNode(UA_NODEID_STRING(1, (char*)nodeName.c_str()), Servers.size());
+        }
+    }
+
+    void TServerImpl::CreateSnapshotNodes(const UA_NodeId& parentNodeId, TGroupSnapshot& snapshot)
+    {
+        UA_VariableAttributes attr = UA_VariableAttributes_default;
+        attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+        attr.displayName = UA_LOCALIZEDTEXT((char*)"en-US", (char*)SNAPSHOT_NODE_NAME.c_str());
+        attr.valueRank = UA_VALUERANK_ONE_DIMENSION;
+        attr.dataType = UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATATYPE);
+        auto nodeId = UA_NODEID_STRING(1, (char*)snapshot.NodeName.c_str());
+        for (size_t i = 0; i < Servers.size(); ++i) {
+            auto res = AddSnapshotNode(Servers[i].get(), nodeId, parentNodeId, attr, snapshot);
+            if (res != UA_STATUSCODE_GOOD) {
+                DeleteNode(nodeId, i);
+                throw std::runtime_error("Variable node '" + snapshot.NodeName + "' creation failed: " +
+                                         UA_StatusCode_name(res));
+            }
+        }
+
+        // Names of the controls don't change, so the node keeps them as its value
+        std::vector<UA_String> names;
+        names.reserve(snapshot.Slots.size());
+        for (const auto& slot: snapshot.Slots) {
+            names.push_back(UA_STRING((char*)slot->NodeName.c_str()));
+        }
+        UA_VariableAttributes controlsAttr = UA_VariableAttributes_default;
+        controlsAttr.accessLevel = UA_ACCESSLEVELMASK_READ;
+        controlsAttr.displayName = UA_LOCALIZEDTEXT((char*)"en-US", (char*)SNAPSHOT_CONTROLS_NODE_NAME.c_str());
+        controlsAttr.valueRank = UA_VALUERANK_ONE_DIMENSION;
+        controlsAttr.dataType = UA_NODEID_NUMERIC(0, UA_NS0ID_STRING);
+        UA_Variant_setArray(&controlsAttr.value, names.data(), names.size(), &UA_TYPES[UA_TYPES_STRING]);
+        auto controlsNodeId = UA_NODEID_STRING(1, (char*)snapshot.ControlsNodeName.c_str());
+        for (size_t i = 0; i < Servers.size(); ++i) {
+            auto res = UA_Server_addVariableNode(Servers[i].get(),
+                                                 controlsNodeId,
+                                                 parentNodeId,
+                                                 UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                 UA_QUALIFIEDNAME(1, (char*)SNAPSHOT_CONTROLS_NODE_NAME.c_str()),
+                                                 UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                                 controlsAttr,
+                                                 nullptr,
+                                                 nullptr);
+            if (res != UA_STATUSCODE_GOOD) {
+                DeleteNode(controlsNodeId, i);
+                DeleteNode(nodeId, Servers.size());
+                throw std::runtime_error("Variable node '" + snapshot.ControlsNodeName + "' creation failed: " +
+                                         UA_StatusCode_name(res));
+            }
+        }
+        snapshot.NodeCreated = true;
+        if (Config.PushValues) {
+            PushSnapshot(snapshot, Servers);
+        }
+    }
+
+    void TServerImpl::DeleteSnapshotNodes(TGroupSnapshot& snapshot)
+    {
+        if (!snapshot.NodeCreated) {
+            return;
+        }
+        snapshot.NodeCreated = false;
+        DeleteNode(UA_NODEID_STRING(1, (char*)snapshot.NodeName.c_str()), Servers.size());
+        DeleteNode(UA_NODEID_STRING(1, (char*)snapshot.ControlsNodeName.c_str()), Servers.size());
+    }
+
+    UA_StatusCode TServerImpl::AddSnapshotNode(UA_Server* server,
+                                               const UA_NodeId& nodeId,
+                                               const UA_NodeId& parentNodeId,
+                                               const UA_VariableAttributes& attr,
+                                               TGroupSnapshot& snapshot)
+    {
+        auto browseName = UA_QUALIFIEDNAME(1, (char*)SNAPSHOT_NODE_NAME.c_str());
+        if (Config.PushValues) {
+            // ControlValueEventCallback writes the whole array on every change of the group controls
+            return UA_Server_addVariableNode(server,
+                                             nodeId,
+                                             parentNodeId,
+                                             UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                             browseName,
+                                             UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                             attr,
+                                             &snapshot,
+                                             nullptr);
+        }
+        UA_DataSource dataSource;
+        dataSource.read = ReadSnapshotCallback;
+        dataSource.write = nullptr;
+
+        return UA_Server_addDataSourceVariableNode(server,
+                                                   nodeId,
+                                                   parentNodeId,
+                                                   UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                   browseName,
+                                                   UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                                   attr,
+                                                   dataSource,
+                                                   &snapshot,
+                                                   nullptr);
+    }
+
+    void TServerImpl::DeleteNode(const UA_NodeId& nodeId, size_t instanceCount)
+    {
+        for (size_t i = 0; i < instanceCount; ++i) {
+            UA_Server_deleteNode(Servers[i].get(), nodeId, true);
+        }
+    }
+
+    void TServerImpl::BuildAddressSpace()
+    {
+        auto index = Index.Read();
+        size_t created = 0;
+        ObjectNodeIds.reserve(Config.ObjectNodes.size());
+        for (const auto& objectNode: Config.ObjectNodes) {
+            UA_NodeId parentNodeId;
+            try {
+                parentNodeId = GetObjectNode(objectNode.first);
+            } catch (const std::exception& e) {
+                LOG(Error) << e.what();
+                continue;
+            }
+            for (const auto& variableNode: objectNode.second) {
+                auto it = index->ByNodeName.find(variableNode.DeviceControlPair);
+                if (it == index->ByNodeName.end() || it->second->ObjectNodeName != objectNode.first) {
+                    continue;
+                }
+                try {
+                    CreateVariableNode(parentNodeId, *it->second);
+                    it->second->NodeCreated = true;
+                    ++created;
+                } catch (const std::exception& e) {
+                    LOG(Error) << e.what();
+                }
+            }
+            auto snapshot = index->Snapshots.find(objectNode.first);
+            if (snapshot != index->Snapshots.end()) {
+                try {
+                    CreateSnapshotNodes(parentNodeId, *snapshot->second);
+                } catch (const std::exception& e) {
+                    LOG(Error) << e.what();
+                }
+            }
+        }
+        PendingValues = index->ByNodeName.size();
+        LOG(Info) << created << " of " << index->ByNodeName.size() << " variable nodes are created in "
+                  << GetUptimeMs() << " ms";
+    }
+
+    UA_NodeId TServerImpl::GetObjectNode(const std::string& nodeName)
+    {
+        auto it = ObjectNodeIds.find(nodeName);
+        if (it != ObjectNodeIds.end()) {
+            return it->second;
+        }
+        auto nodeId = CreateObjectNode(nodeName);
+        try {
+            CreateMethodNodes(nodeId, nodeName);
+        } catch (const std::exception& e) {
+            // The group stays available without bulk methods
+            LOG(Error) << e.what();
+        }
+        it = ObjectNodeIds.emplace(nodeName, UA_NODEID_NULL).first;
+        UA_NodeId_copy(&nodeId, &it->second);
+        return it->second;
+    }
+
+    void TServerImpl::SetDeviceFilter(const TObjectNodesConfig& objectNodes)
+    {
+        auto deviceIds = GetFilterDeviceIds(objectNodes);
+        if (!deviceIds.empty() && deviceIds == FilterDeviceIds) {
+            // Avoid resubscription on reload
+            return;
+        }
+        for (const auto& deviceId: deviceIds) {
+            LOG(Debug) << "'" << deviceId << "' is added to filter";
+        }
+        Driver->SetFilter(WBMQTT::GetDeviceListFilter(deviceIds));
+        FilterDeviceIds = std::move(deviceIds);
+    }
+
+    void TServerImpl::Reload(const TObjectNodesConfig& objectNodes)
+    {
+        std::unique_lock<std::mutex> reloadLock(ReloadMutex);
+        auto start = std::chrono::steady_clock::now();
+
+        if (!HistoryStorage) {
+            HistoryStorage = MakeHistoryStorage(Config, objectNodes);
+        }
+
+        // Unchanged controls keep their slots, so their nodes stay untouched
+        auto newIndex = MakeVariableNodeIndex(objectNodes, this, HistoryStorage.get());
+        std::vector<PVariableNodeSlot> added;
+        std::vector<PVariableNodeSlot> removed;
+        {
+            auto index = Index.Read();
+            for (auto& item: newIndex->ByControl) {
+                auto it = index->ByControl.find(item.first);
+                if (it != index->ByControl.end() && it->second->ObjectNodeName == item.second->ObjectNodeName &&
+                    it->second->AbsoluteDeadband == item.second->AbsoluteDeadband &&
+                    it->second->PercentDeadband == item.second->PercentDeadband &&
+                    it->second->HistoryDepth == item.second->HistoryDepth &&
+                    it->second->HistoryRetention == item.second->HistoryRetention) {
+                    item.second = it->second;
+                } else {
+                    added.push_back(item.second);
+                }
+            }
+            for (const auto& item: index->ByControl) {
+                auto it = newIndex->ByControl.find(item.first);
+                if (it == newIndex->ByControl.end() || it->second != item.second) {
+                    removed.push_back(item.second);
+                }
+            }
+        }
+        newIndex->ByNodeName.clear();
+        for (const auto& item: newIndex->ByControl) {
+            newIndex->ByNodeName.emplace(item.second->NodeName, item.second);
+        }
+
+        // Snapshots of groups with the same slots keep their nodes
+        SetGroups(*newIndex, objectNodes, this);
+        std::vector<PGroupSnapshot> addedSnapshots;
+        std::vector<PGroupSnapshot> removedSnapshots;
+        {
+            auto index = Index.Read();
+            for (auto& item: newIndex->Snapshots) {
+                auto it = index->Snapshots.find(item.first);
+                if (it != index->Snapshots.end() && it->second->Slots == item.second->Slots) {
+                    item.second = it->second;
+                } else {
+                    addedSnapshots.push_back(item.second);
+                }
+            }
+            for (const auto& item: index->Snapshots) {
+                auto it = newIndex->Snapshots.find(item.first);
+                if (it == newIndex->Snapshots.end() || it->second != item.second) {
+                    removedSnapshots.push_back(item.second);
+                }
+            }
+        }
+
+        // New slots aren't visible to the MQTT thread until the index is updated
+        {
+            std::unique_lock<std::mutex> lock(AddressSpaceMutex);
+            for (const auto& objectNode: objectNodes) {
+                try {
+                    GetObjectNode(objectNode.first);
+                } catch (const std::exception& e) {
+                    LOG(Error) << e.what();
+                }
+            }
+            // Replaced slots keep node ids, so old nodes are deleted first
+            for (auto& slot: removed) {
+                if (slot->NodeCreated) {
+                    DeleteNode(UA_NODEID_STRING(1, (char*)slot->NodeName.c_str()), Servers.size());
+                }
+                slot->Removed = true;
+                if (!slot->Materialized) {
+                    --PendingValues;
+                }
+                RetiredSlots.push_back(slot);
+            }
+            for (auto& slot: added) {
+                try {
+                    CreateVariableNode(GetObjectNode(slot->ObjectNodeName), *slot);
+                    slot->NodeCreated = true;
+                } catch (const std::exception& e) {
+                    LOG(Error) << e.what();
+                }
+            }
+            PendingValues += added.size();
+
+            // Changed snapshots keep node ids, so old nodes are deleted first
+            for (auto& snapshot: removedSnapshots) {
+                DeleteSnapshotNodes(*snapshot);
+                RetiredSnapshots.push_back(snapshot);
+            }
+            for (auto& snapshot: addedSnapshots) {
+                try {
+                    CreateSnapshotNodes(GetObjectNode(snapshot->ObjectNodeName), *snapshot);
+                } catch (const std::exception& e) {
+                    LOG(Error) << e.what();
+                }
+            }
+        }
+
+        Index.Update(std::move(newIndex));
+
+        if (Config.PushValues) {
+            // The MQTT thread could push old snapshots into the new nodes before the index update
+            std::unique_lock<std::mutex> lock(AddressSpaceMutex);
+            for (auto& snapshot: addedSnapshots) {
+                PushSnapshot(*snapshot, Servers);
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(AddressSpaceMutex);
+            for (auto it = ObjectNodeIds.begin(); it != ObjectNodeIds.end();) {
+                if (objectNodes.count(it->first)) {
+                    ++it;
+                    continue;
+                }
+                DeleteMethodNodes(it->first);
+                DeleteNode(it->second, Servers.size());
+                UA_NodeId_clear(&it->second);
+                it = ObjectNodeIds.erase(it);
+            }
+            UpdatePubSub(objectNodes);
+        }
+
+        SetDeviceFilter(objectNodes);
+
+        // Controls of already subscribed devices don't get retained values again
+        std::vector<std::pair<PVariableNodeSlot, WBMQTT::PControl>> controls;
+        {
+            auto tx = Driver->BeginTx();
+            for (const auto& slot: added) {
+                auto device = tx->GetDevice(slot->NodeName.substr(0, slot->NodeName.find('/')));
+                auto control = device ? device->GetControl(slot->ControlId) : nullptr;
+                if (control) {
+                    controls.emplace_back(slot, control);
+                }
+            }
+        }
+        // Values of materialized slots are committed only by MQTT events. An event which finds the slot
+        // materialized here after waiting for the lock commits its value again, so a newer value isn't lost
+        if (!controls.empty()) {
+            auto index = Index.Read();
+            auto receivedTime = UA_DateTime_now();
+            std::unique_lock<std::mutex> lock(AddressSpaceMutex);
+            for (const auto& item: controls) {
+                if (!item.first->Materialized && !item.second->GetRawValue().empty()) {
+                    MaterializeSlot(*index, *item.first, item.second, receivedTime);
+                }
+            }
+        }
+
+        LOG(Info) << "Config is reloaded in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start)
+                         .count()
+                  << " ms, " << added.size() << " variable nodes are added, " << removed.size() << " are removed";
+    }
+
+    void TServerImpl::LogLatency()
+    {
+        LOG(Info) << "MQTT value to node latency: " << EventLatency.ToString();
+        LOG(Info) << "OPC UA read latency: " << ReadLatency.ToString();
+        LOG(Info) << "OPC UA write latency: " << WriteLatency.ToString();
+        LOG(Info) << "OPC UA write to MQTT publish latency: " << WriteQueue->GetPublishLatency().ToString();
+    }
+
+    std::chrono::milliseconds::rep TServerImpl::GetUptimeMs() const
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - StartTime)
+            .count();
+    }
+
+    uint32_t TServerImpl::GetLoadFactor() const
+    {
+        uint32_t res = 1;
+        for (const auto& governor: LoadGovernors) {
+            res = std::max(res, governor->GetFactor());
+        }
+        return res;
+    }
+
+    void TServerImpl::SessionActivated(const UA_Server* server, const UA_NodeId& sessionId)
+    {
+        {
+            std::unique_lock<std::mutex> lock(SessionsMutex);
+            Sessions.emplace(server, GetNodeIdKey(sessionId));
+        }
+        if (!HasActivatedSessions.exchange(true)) {
+            LOG(Info) << "First OPC UA session is activated in " << GetUptimeMs() << " ms";
+        }
+    }
+
+    void TServerImpl::SessionClosed(const UA_Server* server, const UA_NodeId& sessionId)
+    {
+        std::unique_lock<std::mutex> lock(SessionsMutex);
+        Sessions.erase(std::make_pair(server, GetNodeIdKey(sessionId)));
+    }
+
+    void TServerImpl::MonitoredItemRegistered(bool removed)
+    {
+        MonitoredItems += removed ? -1 : 1;
+    }
+
+    void TServerImpl::CreatePubSub()
+    {
+        auto server = Servers[0].get();
+        auto res = UA_ServerConfig_addPubSubTransportLayer(UA_Server_getConfig(server), UA_PubSubTransportLayerUDPMP());
+        if (res != UA_STATUSCODE_GOOD) {
+            throw std::runtime_error(std::string("OPC UA PubSub transport layer setup failed: ") +
+                                     UA_StatusCode_name(res));
+        }
+
+        UA_PubSubConnectionConfig connectionConfig;
+        memset(&connectionConfig, 0, sizeof(connectionConfig));
+        connectionConfig.name = UA_STRING((char*)"wb-mqtt-opcua");
+        connectionConfig.transportProfileUri = UA_STRING((char*)UADP_TRANSPORT_PROFILE_URI);
+        connectionConfig.enabled = true;
+        UA_NetworkAddressUrlDataType address{UA_STRING((char*)Config.PubSubInterface.c_str()),
+                                             UA_STRING((char*)Config.PubSubAddress.c_str())};
+        UA_Variant_setScalar(&connectionConfig.address, &address, &UA_TYPES[UA_TYPES_NETWORKADDRESSURLDATATYPE]);
+        connectionConfig.publisherIdType = UA_PUBSUB_PUBLISHERID_NUMERIC;
+        connectionConfig.publisherId.numeric = Config.PubSubPublisherId;
+        res = UA_Server_addPubSubConnection(server, &connectionConfig, &PubSubConnectionId);
+        if (res != UA_STATUSCODE_GOOD) {
+            throw std::runtime_error("OPC UA PubSub connection to '" + Config.PubSubAddress +
+                                     "' failed: " + UA_StatusCode_name(res));
+        }
+        UpdatePubSub(Config.ObjectNodes);
+        LOG(Info) << PublishedGroups.size() << " groups are published to " << Config.PubSubAddress;
+    }
+
+    void TServerImpl::UpdatePubSub(const TObjectNodesConfig& objectNodes)
+    {
+        // PubSub is disabled or its connection failed
+        if (UA_NodeId_isNull(&PubSubConnectionId)) {
+            return;
+        }
+        // Unchanged groups keep publishing without gaps
+        auto groups = GetPublishedGroups(objectNodes);
+        for (auto it = PublishedGroups.begin(); it != PublishedGroups.end();) {
+            auto group = groups.find(it->first);
+            if (group != groups.end() && group->second.ObjectNodeName == it->second.ObjectNodeName &&
+                group->second.NodeNames == it->second.NodeNames)
+            {
+                groups.erase(group);
+                ++it;
+                continue;
+            }
+            UnpublishGroup(it->second);
+            it = PublishedGroups.erase(it);
+        }
+        for (const auto& group: groups) {
+            try {
+                PublishGroup(group.first, group.second);
+            } catch (const std::exception& e) {
+                LOG(Error) << e.what();
+            }
+        }
+    }
+
+    void TServerImpl::PublishGroup(uint16_t writerId, const TPublishedGroup& groupConfig)
+    {
+        auto server = Servers[0].get();
+        auto group = groupConfig;
+        auto fail = [&](const std::string& what, UA_StatusCode res) {
+            UnpublishGroup(group);
+            throw std::runtime_error(what + " of group '" + group.ObjectNodeName +
+                                     "' creation failed: " + UA_StatusCode_name(res));
+        };
+
+        UA_PublishedDataSetConfig dataSetConfig;
+        memset(&dataSetConfig, 0, sizeof(dataSetConfig));
+        dataSetConfig.publishedDataSetType = UA_PUBSUB_DATASET_PUBLISHEDITEMS;
+        dataSetConfig.name = UA_STRING((char*)group.ObjectNodeName.c_str());
+        auto res = UA_Server_addPublishedDataSet(server, &dataSetConfig, &group.PublishedDataSetId).addResult;
+        if (res != UA_STATUSCODE_GOOD) {
+            fail("PublishedDataSet", res);
+        }
+
+        // Fields read the variable nodes, so they get values committed by the MQTT event callback
+        for (const auto& nodeName: group.NodeNames) {
+            UA_DataSetFieldConfig fieldConfig;
+            memset(&fieldConfig, 0, sizeof(fieldConfig));
+            fieldConfig.dataSetFieldType = UA_PUBSUB_DATASETFIELD_VARIABLE;
+            fieldConfig.field.variable.fieldNameAlias = UA_STRING((char*)nodeName.c_str());
+            fieldConfig.field.variable.publishParameters.publishedVariable =
+                UA_NODEID_STRING(1, (char*)nodeName.c_str());
+            fieldConfig.field.variable.publishParameters.attributeId = UA_ATTRIBUTEID_VALUE;
+            res = UA_Server_addDataSetField(server, group.PublishedDataSetId, &fieldConfig, nullptr).result;
+            if (res != UA_STATUSCODE_GOOD) {
+                fail("DataSet field '" + nodeName + "'", res);
+            }
+        }
+
+        UA_UadpWriterGroupMessageDataType message;
+        UA_UadpWriterGroupMessageDataType_init(&message);
+        message.networkMessageContentMask = (UA_UadpNetworkMessageContentMask)(
+            UA_UADPNETWORKMESSAGECONTENTMASK_PUBLISHERID | UA_UADPNETWORKMESSAGECONTENTMASK_GROUPHEADER |
+            UA_UADPNETWORKMESSAGECONTENTMASK_WRITERGROUPID | UA_UADPNETWORKMESSAGECONTENTMASK_PAYLOADHEADER);
+        UA_WriterGroupConfig writerGroupConfig;
+        memset(&writerGroupConfig, 0, sizeof(writerGroupConfig));
+        writerGroupConfig.name = UA_STRING((char*)group.ObjectNodeName.c_str());
+        writerGroupConfig.publishingInterval = Config.PubSubInterval.count();
+        writerGroupConfig.writerGroupId = writerId;
+        writerGroupConfig.encodingMimeType = UA_PUBSUB_ENCODING_UADP;
+        writerGroupConfig.messageSettings.encoding = UA_EXTENSIONOBJECT_DECODED;
+        writerGroupConfig.messageSettings.content.decoded.type = &UA_TYPES[UA_TYPES_UADPWRITERGROUPMESSAGEDATATYPE];
+        writerGroupConfig.messageSettings.content.decoded.data = &message;
+        res = UA_Server_addWriterGroup(server, PubSubConnectionId, &writerGroupConfig, &group.WriterGroupId);
+        if (res != UA_STATUSCODE_GOOD) {
+            fail("WriterGroup", res);
+        }
+
+        UA_DataSetWriterConfig writerConfig;
+        memset(&writerConfig, 0, sizeof(writerConfig));
+        writerConfig.name = UA_STRING((char*)group.ObjectNodeName.c_str());
+        writerConfig.dataSetWriterId = writerId;
+        writerConfig.keyFrameCount = PUBSUB_KEY_FRAME_COUNT;
+        res = UA_Server_addDataSetWriter(server, group.WriterGroupId, group.PublishedDataSetId, &writerConfig, nullptr);
+        if (res != UA_STATUSCODE_GOOD) {
+            fail("DataSetWriter", res);
+        }
+
+        res = UA_Server_setWriterGroupOperational(server, group.WriterGroupId);
+        if (res != UA_STATUSCODE_GOOD) {
+            fail("Operational WriterGroup", res);
+        }
+        PublishedGroups[writerId] = group;
+    }
+
+    void TServerImpl::UnpublishGroup(TPublishedGroup& group)
+    {
+        // Removing the WriterGroup removes its DataSetWriter
+        if (!UA_NodeId_isNull(&group.WriterGroupId)) {
+            UA_Server_removeWriterGroup(Servers[0].get(), group.WriterGroupId);
+            group.WriterGroupId = UA_NODEID_NULL;
+        }
+        if (!UA_NodeId_isNull(&group.PublishedDataSetId)) {
+            UA_Server_removePublishedDataSet(Servers[0].get(), group.PublishedDataSetId);
+            group.PublishedDataSetId = UA_NODEID_NULL;
+        }
+    }
+
+    void TServerImpl::CreateMetrics()
+    {
+        // Not kept in ObjectNodeIds, so config reload doesn't remove it
+        auto parentNodeId = CreateObjectNode(DIAGNOSTICS_NODE_NAME);
+        for (const auto& name: MetricNames) {
+            auto nodeName = DIAGNOSTICS_NODE_NAME + "/" + name;
+            auto nodeId = UA_NODEID_STRING(1, (char*)nodeName.c_str());
+            UA_VariableAttributes attr = UA_VariableAttributes_default;
+            attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+            attr.displayName = UA_LOCALIZEDTEXT((char*)"en-US", (char*)name.c_str());
+            attr.valueRank = UA_VALUERANK_SCALAR;
+            attr.dataType = UA_NODEID_NUMERIC(0, UA_NS0ID_DOUBLE);
+            double value = 0;
+            UA_Variant_setScalar(&attr.value, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+            for (size_t i = 0; i < Servers.size(); ++i) {
+                auto res = UA_Server_addVariableNode(Servers[i].get(),
+                                                     nodeId,
+                                                     parentNodeId,
+                                                     UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                                     UA_QUALIFIEDNAME(1, (char*)name.c_str()),
+                                                     UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                                     attr,
+                                                     nullptr,
+                                                     nullptr);
+                if (res != UA_STATUSCODE_GOOD) {
+                    DeleteNode(nodeId, i);
+                    throw std::runtime_error("Variable node '" + nodeName + "' creation failed: " +
+                                             UA_StatusCode_name(res));
+                }
+            }
+        }
+
+        auto tx = Driver->BeginTx();
+        MetricsDevice = tx->CreateDevice(WBMQTT::TLocalDeviceArgs{}
+                                             .SetId(METRICS_DEVICE_ID)
+                                             .SetTitle("MQTT to OPC UA gateway")
+                                             .SetIsVirtual(true)
+                                             .SetDoLoadPrevious(false))
+                            .GetValue();
+        for (size_t i = 0; i < MetricNames.size(); ++i) {
+            MetricsControls.push_back(MetricsDevice
+                                          ->CreateControl(tx,
+                                                          WBMQTT::TControlArgs{}
+                                                              .SetId(MetricNames[i])
+                                                              .SetType("value")
+                                                              .SetOrder(i)
+                                                              .SetReadonly(true)
+                                                              .SetRawValue("0"))
+                                          .GetValue());
+        }
+    }
+
+    void TServerImpl::RunMetrics()
+    {
+        auto prevCounters = Metrics::Collect();
+        auto prevTime = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(MetricsMutex);
+        while (!MetricsStopped.wait_for(lock, Config.MetricsInterval, [this]() { return StopMetrics; })) {
+            lock.unlock();
+            try {
+                PublishMetrics(CollectMetrics(prevCounters, prevTime));
+            } catch (const std::exception& e) {
+                LOG(Error) << "Metrics publishing failed: " << e.what();
+            }
+            lock.lock();
+        }
+    }
+
+    std::vector<double> TServerImpl::CollectMetrics(TCounters& prevCounters,
+                                                    std::chrono::steady_clock::time_point& prevTime)
+    {
+        auto counters = Metrics::Collect();
+        auto now = std::chrono::steady_clock::now();
+        auto seconds = std::chrono::duration<double>(now - prevTime).count();
+        auto rate = [&](TCounter counter) {
+            auto i = static_cast<size_t>(counter);
+            return (seconds > 0) ? (counters[i] - prevCounters[i]) / seconds : 0;
+        };
+        prevCounters = counters;
+        prevTime = now;
+
+        auto stats = WriteQueue->GetStats();
+        size_t sessions;
+        {
+            std::unique_lock<std::mutex> lock(SessionsMutex);
+            sessions = Sessions.size();
+        }
+        size_t nodes = Index.Read()->ByNodeName.size();
+        size_t pending = std::min(PendingValues.load(), nodes);
+
+        return {rate(TCounter::Events),
+                rate(TCounter::Reads),
+                rate(TCounter::Writes),
+                double(counters[static_cast<size_t>(TCounter::FailedWrites)] + stats.Failed + stats.Rejected),
+                double(nodes - pending),
+                double(sessions),
+                double(std::max<int64_t>(MonitoredItems.load(), 0)),
+                counters[static_cast<size_t>(TCounter::MutexWaitUs)] / 1000.0,
+                double(stats.Depth),
+                double(Metrics::GetRssKb()),
+                double(GetLoadFactor())};
+    }
+
+    void TServerImpl::PublishMetrics(const std::vector<double>& values)
+    {
+        for (size_t i = 0; i < values.size(); ++i) {
+            auto nodeName = DIAGNOSTICS_NODE_NAME + "/" + MetricNames[i];
+            UA_Variant value;
+            UA_Variant_setScalar(&value, (void*)&values[i], &UA_TYPES[UA_TYPES_DOUBLE]);
+            for (const auto& server: Servers) {
+                UA_Server_writeValue(server.get(), UA_NODEID_STRING(1, (char*)nodeName.c_str()), value);
+            }
+        }
+        auto tx = Driver->BeginTx();
+        for (size_t i = 0; i < values.size(); ++i) {
+            MetricsControls[i]->SetValue(tx, values[i]);
+        }
+    }
+
+    void TServerImpl::RunServer(size_t index)
+    {
+        auto server = Servers[index].get();
+        std::vector<TWriteRequest> writes;
+        ServiceWrites = &writes;
+        if (!PendingPushes.empty()) {
+            // Signals could be blocked by the main thread, which the server thread is created from
+            sigset_t signals;
+            sigemptyset(&signals);
+            sigaddset(&signals, GetWakeupSignal());
+            pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+        }
+        auto res = UA_Server_run_startup(server);
+        while (res == UA_STATUSCODE_GOOD && IsRunning) {
+            if (!PendingPushes.empty()) {
+                PushPendingValues(index);
+            }
+            UA_Server_run_iterate(server, true);
+            if (!writes.empty()) {
+                WriteQueue->PushReserved(writes);
+            }
+        }
+        ServiceWrites = nullptr;
+        if (res == UA_STATUSCODE_GOOD) {
+            res = UA_Server_run_shutdown(server);
+        }
+        if (res != UA_STATUSCODE_GOOD) {
+            LOG(Error) << UA_StatusCode_name(res);
+            exit(1);
+        }
+    }
+
+    void TServerImpl::WakeServer(size_t index)
+    {
+        std::unique_lock<std::mutex> lock(WakeupMutex);
+        if (IsRunning && index < ServerThreads.size()) {
+            pthread_kill(ServerThreads[index].native_handle(), GetWakeupSignal());
+        }
+    }
+
+    void TServerImpl::PushPendingValues(size_t serverIndex)
+    {
+        // The buffer is reused by the thread, so taking snapshots doesn't allocate in a steady state
+        thread_local std::vector<std::string> snapshots;
+        if (!PendingPushes[serverIndex]->Take(snapshots)) {
+            return;
+        }
+        std::span<const PServer> servers(&Servers[serverIndex], 1);
+        auto index = Index.Read();
+        for (const auto& objectNodeName: snapshots) {
+            auto it = index->Snapshots.find(objectNodeName);
+            if (it != index->Snapshots.end() && it->second->NodeCreated) {
+                PushSnapshot(*it->second, servers);
+            }
+        }
+    }
+
+    void TServerImpl::PushSnapshot(const TVariableNodeIndex& index, const std::string& objectNodeName)
+    {
+        if (index.Snapshots.empty()) {
+            return;
+        }
+        auto it = index.Snapshots.find(objectNodeName);
+        if (it == index.Snapshots.end() || !it->second->NodeCreated) {
+            return;
+        }
+        // Rebuilding of the array takes all group values, so changes are coalesced
+        // and server threads rebuild it once per loop iteration
+        for (size_t i = 0; i < PendingPushes.size(); ++i) {
+            if (PendingPushes[i]->AddSnapshot(objectNodeName)) {
+                WakeServer(i);
+            }
+        }
+    }
+
+    void TServerImpl::PushSnapshot(TGroupSnapshot& snapshot, std::span<const PServer> servers)
+    {
+        UA_DataValue dataValue;
+        UA_DataValue_init(&dataValue);
+        {
+            auto section = ControlReaders.Read();
+            SetSnapshotDataValue(&dataValue, snapshot);
+        }
+        auto nodeId = UA_NODEID_STRING(1, (char*)snapshot.NodeName.c_str());
+        for (const auto& server: servers) {
+            auto res = UA_Server_writeDataValue(server.get(), nodeId, dataValue);
+            if (res != UA_STATUSCODE_GOOD) {
+                LOG(Error) << "Variable node '" + snapshot.NodeName + "' update failed: " << UA_StatusCode_name(res);
+            }
+        }
+        UA_DataValue_clear(&dataValue);
+    }
+
+    std::vector<std::string> GetFilterDeviceIds(const TObjectNodesConfig& objectNodes)
+    {
+        std::vector<std::string> res;
+        for (const auto& objectNode: objectNodes) {
+            for (const auto& variableNode: objectNode.second) {
+                res.push_back(variableNode.DeviceControlPair.substr(0, variableNode.DeviceControlPair.find('/')));
+            }
         }
+        std::sort(res.begin(), res.end());
+        res.erase(std::unique(res.begin(), res.end()), res.end());
+        return res;
     }
 
     std::unique_ptr<IServer> MakeServer(const TServerConfig& config, WBMQTT::PDeviceDriver driver)
@@ -1,8 +1,19 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <open62541/plugin/accesscontrol_default.h>
@@ -12,12 +23,44 @@
 
 #include <wblib/wbmqtt.h>
 
+#include "async_log.h"
+#include "certificate_cache.h"
+#include "history.h"
+#include "latency.h"
+#include "load_governor.h"
+#include "metrics.h"
+#include "pending_pushes.h"
+#include "rcu.h"
+#include "value_codec.h"
+#include "write_queue.h"
+
 namespace OPCUA
 {
+    //! Name of the object node with metrics, groups can't have it
+    inline const std::string DIAGNOSTICS_NODE_NAME = "Diagnostics";
+
     struct TVariableNodeConfig
     {
         std::string
             DeviceControlPair; //! DEVICE_NAME/CONTROL_NAME from MQTT (/devices/DEVICE_NAME/controls/CONTROL_NAME)
+
+        //! Numeric value changes not exceeding the deadband aren't committed to the node. 0 disables the deadband
+        double AbsoluteDeadband = 0;
+
+        //! Deadband in percents of the control range (max - min). If the range is unknown, of the last committed value
+        double PercentDeadband = 0;
+
+        //! Number of values kept in memory for HistoryRead, set for all controls of a group. 0 disables the buffer
+        size_t HistoryDepth = 0;
+
+        //! Time to keep values on disk, set for all controls of a group. 0 disables the on-disk history
+        std::chrono::seconds HistoryRetention = std::chrono::seconds(0);
+
+        //! Values of the group controls are also exposed as a single array node, set for all controls of a group
+        bool Snapshot = false;
+
+        //! DataSetWriter id of the group in PubSub messages, set for all controls of a group. 0 - not published
+        uint16_t PubSubWriterId = 0;
     };
 
     typedef std::vector<TVariableNodeConfig> TVariableNodesConfig;
@@ -25,6 +68,15 @@ namespace OPCUA
     //! map with object nodes name as keys
     typedef std::map<std::string, TVariableNodesConfig> TObjectNodesConfig;
 
+    enum class TWriteMode
+    {
+        //! Respond to OPC UA Write after the value is published to MQTT or the timeout expires
+        Wait,
+
+        //! Respond to OPC UA Write right after the value is queued for publishing
+        Enqueue
+    };
+
     //! OPC UA server configuration parameters
     struct TServerConfig
     {
@@ -34,14 +86,254 @@ namespace OPCUA
         //! Port to listen
         uint32_t BindPort = 4840;
 
+        /**! Number of server threads. Every thread runs its own server instance with the same address space.
+         *   Instance N listens to BindPort + N, so clients could be distributed among threads.
+         */
+        size_t Threads = 1;
+
+        /**! Serve reads of variable nodes from values committed on receiving from MQTT instead of reading controls,
+         *   and keep values of group snapshot nodes in the nodes
+         */
+        bool PushValues = false;
+
+        /**! Maximum delay of rebuilding snapshot nodes of server instances, if a server thread misses its wakeup.
+         *   Every server thread rebuilds coalesced snapshots in its own instance between loop iterations,
+         *   a change wakes the thread up. 0 - the network wait of the server loop bounds the delay
+         */
+        std::chrono::milliseconds LoopLatency = std::chrono::milliseconds(0);
+
+        TWriteMode WriteMode = TWriteMode::Wait;
+
+        //! Maximum time to wait for publishing to MQTT in TWriteMode::Wait mode
+        std::chrono::milliseconds WriteTimeout = std::chrono::milliseconds(1000);
+
+        //! Maximum number of writes waiting for publishing to MQTT, exceeding writes are rejected
+        size_t WriteQueueSize = 1000;
+
+        //! Period of metrics update in Diagnostics object node and MQTT device. 0 disables metrics publishing
+        std::chrono::seconds MetricsInterval = std::chrono::seconds(0);
+
+        //! Directory of on-disk history, every group with history retention gets a subdirectory
+        std::string HistoryDir = "/var/lib/wb-mqtt-opcua/history";
+
+        //! Period of appending recorded values to disk. Longer periods reduce flash wear
+        std::chrono::seconds HistoryFlushInterval = std::chrono::seconds(300);
+
+        //! Limits of every server instance. 0 means no limit
+        size_t MaxSessions = 100;
+        size_t MaxSubscriptionsPerSession = 0;
+        size_t MaxMonitoredItemsPerSubscription = 0;
+        size_t MaxMonitoredItems = 0;
+
+        //! Shorter intervals requested by clients are revised to these values, ms
+        double MinSamplingInterval = 50;
+        double MinPublishingInterval = 10;
+
+        //! Raise minimum sampling and publishing intervals when the controller is overloaded, see TLoadGovernor
+        bool LoadGovernor = true;
+
+        //! Server loop delay considered as overload
+        std::chrono::milliseconds MaxLoopLag = std::chrono::milliseconds(100);
+
+        //! System CPU load considered as overload, percents
+        double MaxCpuLoad = 90;
+
+        //! Paths to the server certificate and private key in DER format. If set, encrypted endpoints are added
+        std::string Certificate;
+        std::string PrivateKey;
+
+        //! Directory with trusted client certificates in DER format. If empty, all client certificates are accepted
+        std::string TrustListDir;
+
+        //! Add the endpoint without security. Otherwise the None security policy is allowed only for discovery
+        bool SecurityNone = true;
+
+        //! Maximum lifetime of secure channel tokens granted to clients. Token renewal takes asymmetric operations
+        std::chrono::seconds MaxSecurityTokenLifetime = std::chrono::seconds(3600);
+
+        //! Maximum number of secure channels of every server instance
+        size_t MaxSecureChannels = 40;
+
+        //! UDP multicast address of UADP PubSub messages, e.g. "opc.udp://224.0.0.22:4840/". Empty disables PubSub
+        std::string PubSubAddress;
+
+        //! Network interface for PubSub messages. If empty, the interface is chosen by the routing table
+        std::string PubSubInterface;
+
+        uint32_t PubSubPublisherId = 1;
+
+        //! Period of publishing values of every group
+        std::chrono::milliseconds PubSubInterval = std::chrono::milliseconds(100);
+
         TObjectNodesConfig ObjectNodes;
     };
 
+    class TServerImpl;
+
+    //! Variable node prepared from config before the control appears in MQTT. Used as the node context
+    struct TVariableNodeSlot
+    {
+        TServerImpl* Server = nullptr;
+
+        //! DEVICE_NAME/CONTROL_NAME, used as variable node id
+        std::string NodeName;
+
+        //! CONTROL_NAME, used as variable node browse and display name
+        std::string ControlId;
+
+        //! Name of the object node (group) holding the variable node
+        std::string ObjectNodeName;
+
+        //! The variable node is created in OPC UA address space. Guarded by TServerImpl::AddressSpaceMutex after startup
+        bool NodeCreated = false;
+
+        //! The variable node is set up for the control. Changed under TServerImpl::AddressSpaceMutex
+        std::atomic<bool> Materialized = false;
+
+        //! Reload has replaced the slot and deleted its node. Guarded by TServerImpl::AddressSpaceMutex
+        bool Removed = false;
+
+        //! Published control, may be read from any thread without locking in TServerImpl::ControlReaders sections
+        std::atomic<WBMQTT::TControl*> Control = nullptr;
+
+        //! Keeps published control alive, guarded by TServerImpl::Mutex
+        WBMQTT::PControl ControlOwner;
+
+        //! DataType of the variable node, nullptr for BaseDataType. Set after the control is published
+        std::atomic<const UA_DataType*> DataType = nullptr;
+
+        /**! Representation of values chosen from the control meta type, Unknown until the control is published.
+         *   Server threads may see the published control before the kind is set, Unknown values are converted by type
+         */
+        std::atomic<TValueKind> ValueKind = TValueKind::Unknown;
+
+        double AbsoluteDeadband = 0;
+        double PercentDeadband = 0;
+
+        /**! Last numeric value passed through the deadbands, NaN if there is none.
+         *   Written from the MQTT driver thread, or by reload under TServerImpl::AddressSpaceMutex before materializing
+         */
+        std::atomic<double> CommittedValue = std::numeric_limits<double>::quiet_NaN();
+
+        //! Error state of the committed value. Written together with CommittedValue
+        std::atomic<bool> CommittedError = false;
+
+        //! Last raw value of a control with String value kind, guarded by TextMutex
+        std::string CommittedText;
+        std::mutex TextMutex;
+
+        //! Time of receiving the committed value from MQTT, used as SourceTimestamp. 0 if no value is received
+        std::atomic<UA_DateTime> ReceivedTime = 0;
+
+        size_t HistoryDepth = 0;
+        std::chrono::seconds HistoryRetention = std::chrono::seconds(0);
+
+        //! Recent committed values, nullptr if the group has no history depth
+        std::unique_ptr<THistoryBuffer> History;
+
+        //! On-disk history of the group, nullptr if the group has no history retention
+        THistoryFile* HistoryFile = nullptr;
+    };
+
+    //! (DEVICE_NAME, CONTROL_NAME) pair
+    typedef std::pair<std::string, std::string> TControlKey;
+
+    //! Hash of TControlKey, allows lookup by string views without building a key
+    struct TControlKeyHash
+    {
+        using is_transparent = void;
+
+        size_t operator()(const std::pair<std::string_view, std::string_view>& key) const
+        {
+            auto h = std::hash<std::string_view>()(key.first);
+            return h ^ (std::hash<std::string_view>()(key.second) + 0x9e3779b9 + (h << 6) + (h >> 2));
+        }
+    };
+
+    struct TControlKeyEqual
+    {
+        using is_transparent = void;
+
+        bool operator()(const std::pair<std::string_view, std::string_view>& a,
+                        const std::pair<std::string_view, std::string_view>& b) const
+        {
+            return a == b;
+        }
+    };
+
+    typedef std::shared_ptr<TVariableNodeSlot> PVariableNodeSlot;
+
+    //! Array variable node with values of all controls of a group. Used as the node context
+    struct TGroupSnapshot
+    {
+        TServerImpl* Server = nullptr;
+
+        //! GROUP_NAME#Snapshot, used as variable node id. '#' can't appear in MQTT topics, so ids don't clash
+        std::string NodeName;
+
+        //! GROUP_NAME#SnapshotControls, id of the node with DEVICE_NAME/CONTROL_NAME of the values
+        std::string ControlsNodeName;
+
+        std::string ObjectNodeName;
+
+        //! Slots of the group controls in config order, values go in the same order
+        std::vector<PVariableNodeSlot> Slots;
+
+        //! The nodes are created in OPC UA address space. Changed under TServerImpl::AddressSpaceMutex
+        std::atomic<bool> NodeCreated = false;
+    };
+
+    typedef std::shared_ptr<TGroupSnapshot> PGroupSnapshot;
+
+    //! Group published over PubSub by its own WriterGroup with DataSetWriter and PublishedDataSet
+    struct TPublishedGroup
+    {
+        std::string ObjectNodeName;
+
+        //! Variable node names of the DataSet fields in config order
+        std::vector<std::string> NodeNames;
+
+        UA_NodeId PublishedDataSetId;
+        UA_NodeId WriterGroupId;
+    };
+
+    //! Routing index of MQTT controls to variable nodes
+    typedef std::unordered_map<TControlKey, PVariableNodeSlot, TControlKeyHash, TControlKeyEqual> TVariableNodeSlots;
+
+    //! Immutable snapshot of variable node slots built from config
+    struct TVariableNodeIndex
+    {
+        TVariableNodeSlots ByControl;
+        std::unordered_map<std::string, PVariableNodeSlot> ByNodeName;
+
+        //! Slots of groups in config order by object node names
+        std::unordered_map<std::string, std::vector<PVariableNodeSlot>> ByObjectNodeName;
+
+        //! Snapshots of groups by object node names
+        std::unordered_map<std::string, PGroupSnapshot> Snapshots;
+    };
+
+    //! Deletes a server instance. Its sessions are closed on deletion, so they are detached from the owner first
+    struct TServerDeleter
+    {
+        void operator()(UA_Server* server) const;
+    };
+
+    typedef std::unique_ptr<UA_Server, TServerDeleter> PServer;
+
     //! Interface of OPCUA server.
     class IServer
     {
     public:
         virtual ~IServer() = default;
+
+        /**! Applies new groups configuration to the running server.
+         *   Only added and removed nodes are changed, sessions and subscriptions of other nodes are kept.
+         */
+        virtual void Reload(const TObjectNodesConfig& objectNodes) = 0;
+
+        //! Prints latency histograms to log
+        virtual void LogLatency() = 0;
     };
 
     /**! Basic gateway implementation.
@@ -58,31 +350,245 @@ namespace OPCUA
         bool ControlExists(const std::string& nodeName);
         void AddControl(const std::string& nodeName, WBMQTT::PControl control);
         void RemoveControl(const std::string& nodeName);
+
+        //! Takes the writers lock, not intended for hot paths
         WBMQTT::PControl GetControl(const std::string& nodeName);
 
-        UA_StatusCode WriteVariable(const UA_NodeId* snodeId, const UA_DataValue* dataValue);
-        UA_StatusCode ReadVariable(const UA_NodeId* snodeId, UA_DataValue* dataValue);
+        UA_StatusCode WriteVariable(TVariableNodeSlot& slot, const UA_DataValue* dataValue);
+
+        UA_StatusCode ReadVariable(TVariableNodeSlot& slot, UA_DataValue* dataValue, bool sourceTimestamp = false);
+        UA_StatusCode ReadSnapshot(TGroupSnapshot& snapshot, UA_DataValue* dataValue);
+
+        //! GetValues method of group objects. Outputs names, values and statuses of all group controls
+        UA_StatusCode GetGroupValues(const std::string& objectNodeName, UA_Variant* output);
+
+        /**! SetValues method of group objects. Publishes values of the group controls to MQTT in one transaction.
+         *   Inputs are arrays of control names and values, output is an array of per-control results.
+         */
+        UA_StatusCode SetGroupValues(const std::string& objectNodeName, const UA_Variant* input, UA_Variant* output);
 
         void ControlValueEventCallback(const WBMQTT::TControlValueEvent& event);
 
+        /**! Reads recorded values of the node for HistoryRead service.
+         *   Values from the in-memory buffer are returned if it covers the requested period, otherwise from disk.
+         */
+        UA_StatusCode ReadHistory(const UA_ReadRawModifiedDetails& details,
+                                  UA_TimestampsToReturn timestampsToReturn,
+                                  const UA_HistoryReadValueId& node,
+                                  UA_ByteString& continuationPoint,
+                                  UA_HistoryData& data);
+
+        bool HasHistory(const UA_NodeId& nodeId) const;
+
+        //! Called by server threads on every activated OPC UA session
+        void SessionActivated(const UA_Server* server, const UA_NodeId& sessionId);
+        void SessionClosed(const UA_Server* server, const UA_NodeId& sessionId);
+        void MonitoredItemRegistered(bool removed);
+
+        void Reload(const TObjectNodesConfig& objectNodes) override;
+        void LogLatency() override;
+
     private:
+        //! Creates object and variable nodes for all configured controls before the server starts listening
+        void BuildAddressSpace();
+
+        //! Returns cached object node id, creates the node if it doesn't exist
+        UA_NodeId GetObjectNode(const std::string& nodeName);
+
+        void SetDeviceFilter(const TObjectNodesConfig& objectNodes);
+
+        //! Creates Diagnostics object node and MQTT device for metrics
+        void CreateMetrics();
+        void RunMetrics();
+
+        //! Metric values in the order of metric names
+        std::vector<double> CollectMetrics(TCounters& prevCounters,
+                                           std::chrono::steady_clock::time_point& prevTime);
+        void PublishMetrics(const std::vector<double>& values);
+        std::chrono::milliseconds::rep GetUptimeMs() const;
+
+        //! Maximum multiplier of minimum intervals among server instances
+        uint32_t GetLoadFactor() const;
+
+        //! Server thread loop, writes pending snapshots between iterations
+        void RunServer(size_t index);
+
+        //! Interrupts the network wait of the server thread, so it writes pending snapshots
+        void WakeServer(size_t index);
+
+        //! Writes snapshots pending for the server instance
+        void PushPendingValues(size_t serverIndex);
+
+        //! Writes values of the group controls into the snapshot node if the group has it
+        void PushSnapshot(const TVariableNodeIndex& index, const std::string& objectNodeName);
+        void PushSnapshot(TGroupSnapshot& snapshot, std::span<const PServer> servers);
+
+        //! Creates GetValues and SetValues method nodes of the group object node
+        void CreateMethodNodes(const UA_NodeId& objectNodeId, const std::string& objectNodeName);
+        void DeleteMethodNodes(const std::string& objectNodeName);
+
+        //! Returns bad status if the value can't be written to the control of the slot
+        UA_StatusCode MakeWriteRequest(TVariableNodeSlot& slot, const UA_Variant* value, TWriteRequest& request);
+
+        //! Waits for publishing of the queued request according to the write mode
+        UA_StatusCode GetWriteResult(std::future<UA_StatusCode>& res,
+                                     const std::string& nodeName,
+                                     std::chrono::steady_clock::time_point deadline);
+
+        //! Creates Snapshot and SnapshotControls variable nodes of the group
+        void CreateSnapshotNodes(const UA_NodeId& parentNodeId, TGroupSnapshot& snapshot);
+        void DeleteSnapshotNodes(TGroupSnapshot& snapshot);
+        UA_StatusCode AddSnapshotNode(UA_Server* server,
+                                      const UA_NodeId& nodeId,
+                                      const UA_NodeId& parentNodeId,
+                                      const UA_VariableAttributes& attr,
+                                      TGroupSnapshot& snapshot);
+
+        void PublishControl(TVariableNodeSlot& slot, WBMQTT::PControl control);
+
+        //! Commits the control value into the materialized slot. Called from the MQTT driver thread
+        void CommitControlValue(const TVariableNodeIndex& index,
+                                TVariableNodeSlot& slot,
+                                const WBMQTT::TControl& control,
+                                UA_DateTime receivedTime);
+
+        /**! Publishes the control in the slot, sets up its node and commits the first value. Called under
+         *   AddressSpaceMutex, so values of a slot are committed by one thread at a time
+         */
+        void MaterializeSlot(const TVariableNodeIndex& index,
+                             TVariableNodeSlot& slot,
+                             const WBMQTT::PControl& control,
+                             UA_DateTime receivedTime);
+
+        //! Frees retired controls which readers can't use anymore, doesn't wait for readers. Called under Mutex
+        void ReleaseRetiredControls();
+        UA_StatusCode AddVariableNode(UA_Server* server,
+                                      const UA_NodeId& nodeId,
+                                      const UA_NodeId& parentNodeId,
+                                      const UA_VariableAttributes& attr,
+                                      TVariableNodeSlot& slot);
+        UA_StatusCode WriteVariableNodeAttributes(UA_Server* server,
+                                                  const UA_NodeId& nodeId,
+                                                  const UA_VariableAttributes& attr);
+
+        /**! Publishes groups with PubSub writer ids over UADP multicast from the first server instance.
+         *   Throws if the connection can't be set up
+         */
+        void CreatePubSub();
+
+        //! Adds and removes published groups according to the config
+        void UpdatePubSub(const TObjectNodesConfig& objectNodes);
+        void PublishGroup(uint16_t writerId, const TPublishedGroup& group);
+        void UnpublishGroup(TPublishedGroup& group);
+
+        //! Deletes the node from the first instanceCount server instances
+        void DeleteNode(const UA_NodeId& nodeId, size_t instanceCount);
+
+        //! Serializes control publication, readers don't take it
         std::mutex Mutex;
-        std::unordered_map<std::string, WBMQTT::PControl> ControlMap;
 
-        UA_Server* Server;
+        //! Read sections of raw control pointers of slots
+        TRcuDomain ControlReaders;
+
+        //! Controls replaced in slots with epochs of ControlReaders. Freed when readers of the epochs are gone
+        std::vector<std::pair<uint32_t, WBMQTT::PControl>> RetiredControls;
+
+        //! Serializes config reloads
+        std::mutex ReloadMutex;
+
+        //! Serializes node creation and deletion after startup
+        std::mutex AddressSpaceMutex;
+
+        //! Slots of nodes removed by reload. Server threads could still use them as node contexts
+        std::vector<PVariableNodeSlot> RetiredSlots;
+        std::vector<PGroupSnapshot> RetiredSnapshots;
+
+        //! Devices subscribed by the driver
+        std::vector<std::string> FilterDeviceIds;
+
+        //! Log of server instances, outlives them
+        std::unique_ptr<TAsyncLog> AsyncLog;
+
+        //! Client certificate verification results shared by server instances, outlives them
+        std::unique_ptr<TCertificateCache> CertificateCache;
+
+        //! Server instances with identical address spaces, one per thread. Deleted even if the constructor throws
+        std::vector<PServer> Servers;
+
+        //! Load governors of server instances, empty if disabled. Used by server threads as callback data
+        std::vector<std::unique_ptr<TLoadGovernor>> LoadGovernors;
+
+        /**! Values waiting for server threads, one per instance. Empty if values aren't pushed.
+         *   Values from MQTT go there only if the loop latency is set, otherwise just restored values.
+         */
+        std::vector<std::unique_ptr<TPendingPushes>> PendingPushes;
         volatile UA_Boolean IsRunning;
-        std::thread ServerThread;
+        std::vector<std::thread> ServerThreads;
+
+        //! Taken by WakeServer, so the destructor doesn't join a thread which is being signalled
+        std::mutex WakeupMutex;
 
         const TServerConfig& Config;
         WBMQTT::PDeviceDriver Driver;
+        WBMQTT::TDriverEventHandlerHandle ControlValueHandler{};
+
+        std::chrono::steady_clock::time_point StartTime = std::chrono::steady_clock::now();
+        std::atomic<bool> HasActivatedSessions = false;
+
+        //! Number of configured controls without values from MQTT
+        std::atomic<size_t> PendingValues = 0;
+
+        //! Time from receiving an MQTT value event to updating the node
+        TLatencyHistogram EventLatency;
+        TLatencyHistogram ReadLatency;
+        TLatencyHistogram WriteLatency;
+
+        //! Active sessions by server instance and binary session id, ids are unique only within an instance
+        std::mutex SessionsMutex;
+        std::set<std::pair<const UA_Server*, std::string>> Sessions;
+        std::atomic<int64_t> MonitoredItems = 0;
+
+        WBMQTT::PLocalDevice MetricsDevice;
+        std::vector<WBMQTT::PControl> MetricsControls;
+        std::mutex MetricsMutex;
+        std::condition_variable MetricsStopped;
+        bool StopMetrics = false;
+        std::thread MetricsThread;
+
+        //! On-disk history of groups, nullptr if no group has history retention. Used by slots of the index
+        std::unique_ptr<THistoryStorage> HistoryStorage;
+
+        //! Groups published over PubSub by writer ids. Guarded by TServerImpl::AddressSpaceMutex after startup
+        std::map<uint16_t, TPublishedGroup> PublishedGroups;
+        UA_NodeId PubSubConnectionId = UA_NODEID_NULL;
+
+        //! Ids of created object nodes by names. Used at startup and from the MQTT driver thread
+        std::unordered_map<std::string, UA_NodeId> ObjectNodeIds;
+
+        //! Slots are node contexts, so they must outlive their nodes
+        TRcuPtr<TVariableNodeIndex> Index;
+
+        //! Publishes queued requests on destruction, so it is destroyed before the index
+        std::unique_ptr<TWriteQueue> WriteQueue;
 
     protected:
+        PVariableNodeSlot FindVariableNodeSlot(const std::string& nodeName) const;
+        UA_Server* GetServerInstance(size_t index) const;
+        const TWriteQueue& GetWriteQueue() const;
+
         virtual UA_NodeId CreateObjectNode(const std::string& nodeName);
-        virtual void CreateVariableNode(const UA_NodeId& parentNodeId,
-                                        const std::string& nodeName,
-                                        WBMQTT::PControl control);
+        //! Creates variable node with BaseDataType and Uncertain_InitialValue status
+        virtual void CreateVariableNode(const UA_NodeId& parentNodeId, TVariableNodeSlot& slot);
+
+        //! Sets variable node data type and access level from the published control
+        virtual void SetupVariableNode(TVariableNodeSlot& slot);
     };
 
+    /**! Sorted ids of devices with enabled controls, subscribed by the MQTT driver.
+     *   Devices are taken from controls, so a group may contain controls of several devices
+     */
+    std::vector<std::string> GetFilterDeviceIds(const TObjectNodesConfig& objectNodes);
+
     //! Make a new instance of server
     std::unique_ptr<IServer> MakeServer(const TServerConfig& config, WBMQTT::PDeviceDriver driver);
 }
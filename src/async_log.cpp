@@ -0,0 +1,149 @@
+#include "async_log.h"
+
+#include <cstdio>
+
+#include <wblib/utils.h>
+
+#include "log.h"
+
+#define LOG(logger) LOG_WITH_PREFIX(logger, "[OPCUA] ")
+
+namespace
+{
+    //! Period of checking for messages queued without notification
+    const auto POLL_INTERVAL = std::chrono::milliseconds(100);
+
+    size_t GetRingSize(size_t capacity)
+    {
+        size_t res = 2;
+        while (res < capacity) {
+            res <<= 1;
+        }
+        return res;
+    }
+}
+
+namespace OPCUA
+{
+    TAsyncLog::TAsyncLog(size_t capacity, TWriter writer)
+        : Ring(std::make_unique<TRecord[]>(GetRingSize(capacity))),
+          Mask(GetRingSize(capacity) - 1),
+          Writer(std::move(writer))
+    {
+        for (size_t i = 0; i <= Mask; ++i) {
+            Ring[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+        Worker = std::thread([this]() {
+            WBMQTT::SetThreadName("opcua-log");
+            Run();
+        });
+    }
+
+    TAsyncLog::~TAsyncLog()
+    {
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            Stopped = true;
+        }
+        HasRecords.notify_all();
+        if (Worker.joinable()) {
+            Worker.join();
+        }
+    }
+
+    void TAsyncLog::Push(WBMQTT::TLogger& logger, const char* category, const char* format, va_list args)
+    {
+        if (!logger.IsEnabled()) {
+            return;
+        }
+        auto pos = Head.load(std::memory_order_relaxed);
+        TRecord* record;
+        while (true) {
+            record = &Ring[pos & Mask];
+            auto diff = static_cast<intptr_t>(record->Sequence.load(std::memory_order_acquire)) -
+                        static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (Head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                Dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = Head.load(std::memory_order_relaxed);
+            }
+        }
+        record->Logger = &logger;
+        record->Category = category;
+        vsnprintf(record->Text, MAX_MESSAGE_SIZE, format, args);
+        record->Sequence.store(pos + 1, std::memory_order_release);
+        // The worker polls the ring, so a lost wakeup only delays the message
+        HasRecords.notify_one();
+    }
+
+    uint64_t TAsyncLog::GetDropped() const
+    {
+        return Dropped.load(std::memory_order_relaxed);
+    }
+
+    void TAsyncLog::Run()
+    {
+        uint64_t reportedDropped = 0;
+        std::unique_lock<std::mutex> lock(Mutex);
+        while (true) {
+            auto stopped = Stopped;
+            lock.unlock();
+            WriteRecords();
+            auto dropped = GetDropped();
+            if (dropped != reportedDropped) {
+                LOG(Warn) << dropped - reportedDropped << " log messages are dropped";
+                reportedDropped = dropped;
+            }
+            lock.lock();
+            if (stopped) {
+                return;
+            }
+            HasRecords.wait_for(lock, POLL_INTERVAL);
+        }
+    }
+
+    void TAsyncLog::WriteRecords()
+    {
+        while (true) {
+            auto& record = Ring[Tail & Mask];
+            if (record.Sequence.load(std::memory_order_acquire) != Tail + 1) {
+                return;
+            }
+            if (Writer) {
+                Writer(*record.Logger, record.Category, record.Text);
+            } else {
+                record.Logger->Log() << "[OPCUA] " << record.Category << ": " << record.Text;
+            }
+            record.Sequence.store(Tail + Mask + 1, std::memory_order_release);
+            ++Tail;
+        }
+    }
+
+    TLogRateLimit::TLogRateLimit(std::chrono::steady_clock::duration period): Period(period.count())
+    {}
+
+    bool TLogRateLimit::Allow(uint64_t& suppressed)
+    {
+        auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        auto next = NextTime.load(std::memory_order_relaxed);
+        if (now < next || !NextTime.compare_exchange_strong(next, now + Period, std::memory_order_relaxed)) {
+            Suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        suppressed = Suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::ostream& operator<<(std::ostream& stream, const TSuppressed& suppressed)
+    {
+        if (suppressed.Count != 0) {
+            stream << " (" << suppressed.Count << " similar messages are suppressed)";
+        }
+        return stream;
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+#include <wblib/log.h>
+
+namespace OPCUA
+{
+    /**! Log of messages produced on OPC UA server threads.
+     *   A message is formatted once into a fixed-size record of a lock-free ring
+     *   and written to its logger from a background thread, so server threads never wait for log output.
+     *   Messages of disabled loggers are not formatted. Messages are dropped if the ring is full.
+     */
+    class TAsyncLog
+    {
+    public:
+        //! Longer messages are truncated
+        static const size_t MAX_MESSAGE_SIZE = 256;
+
+        //! Outputs a message on the log thread
+        typedef std::function<void(WBMQTT::TLogger& logger, const char* category, const char* text)> TWriter;
+
+        /**! capacity is rounded up to a power of two.
+         *   Messages are written to their loggers if writer is empty.
+         */
+        explicit TAsyncLog(size_t capacity = 1024, TWriter writer = nullptr);
+
+        //! Writes queued messages and stops the thread
+        ~TAsyncLog();
+
+        TAsyncLog(const TAsyncLog&) = delete;
+        TAsyncLog& operator=(const TAsyncLog&) = delete;
+
+        //! Queues printf-style message, category is written before it and must be a string literal
+        void Push(WBMQTT::TLogger& logger, const char* category, const char* format, va_list args);
+
+        uint64_t GetDropped() const;
+
+    private:
+        struct TRecord
+        {
+            //! Position of the record in the ring, see "Bounded MPMC queue" by D. Vyukov
+            std::atomic<size_t> Sequence;
+            WBMQTT::TLogger* Logger;
+            const char* Category;
+            char Text[MAX_MESSAGE_SIZE];
+        };
+
+        std::unique_ptr<TRecord[]> Ring;
+        size_t Mask;
+        std::atomic<size_t> Head = 0;
+
+        //! Used only by the worker thread
+        size_t Tail = 0;
+
+        std::atomic<uint64_t> Dropped = 0;
+
+        TWriter Writer;
+
+        std::mutex Mutex;
+        std::condition_variable HasRecords;
+        bool Stopped = false;
+        std::thread Worker;
+
+        void Run();
+
+        void WriteRecords();
+    };
+
+    //! Passes one message per period, so repeated errors triggered by clients don't flood the log
+    class TLogRateLimit
+    {
+    public:
+        explicit TLogRateLimit(std::chrono::steady_clock::duration period);
+
+        //! Returns true if the message should be logged. suppressed is set to the number of messages dropped since then
+        bool Allow(uint64_t& suppressed);
+
+    private:
+        std::chrono::steady_clock::duration::rep Period;
+        std::atomic<std::chrono::steady_clock::duration::rep> NextTime = 0;
+        std::atomic<uint64_t> Suppressed = 0;
+    };
+
+    //! Prints the number of suppressed messages if there are any
+    struct TSuppressed
+    {
+        uint64_t Count;
+    };
+
+    std::ostream& operator<<(std::ostream& stream, const TSuppressed& suppressed);
+}
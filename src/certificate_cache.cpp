@@ -0,0 +1,103 @@
+#include "certificate_cache.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+    std::string GetKey(const UA_ByteString& certificate)
+    {
+        return std::string(reinterpret_cast<const char*>(certificate.data), certificate.length);
+    }
+
+    struct TCachedVerification
+    {
+        UA_CertificateVerification Verification;
+        OPCUA::TCertificateCache* Cache;
+    };
+
+    extern "C" {
+    UA_StatusCode VerifyCertificate(void* context, const UA_ByteString* certificate)
+    {
+        auto cached = static_cast<TCachedVerification*>(context);
+        UA_StatusCode res;
+        if (cached->Cache->Find(*certificate, res)) {
+            return res;
+        }
+        res = cached->Verification.verifyCertificate(cached->Verification.context, certificate);
+        cached->Cache->Add(*certificate, res);
+        return res;
+    }
+
+    UA_StatusCode VerifyApplicationUri(void* context, const UA_ByteString* certificate, const UA_String* applicationUri)
+    {
+        auto cached = static_cast<TCachedVerification*>(context);
+        return cached->Verification.verifyApplicationURI(cached->Verification.context, certificate, applicationUri);
+    }
+
+    void ClearVerification(UA_CertificateVerification* verification)
+    {
+        auto cached = static_cast<TCachedVerification*>(verification->context);
+        if (cached->Verification.clear) {
+            cached->Verification.clear(&cached->Verification);
+        }
+        delete cached;
+        verification->context = nullptr;
+    }
+    }
+}
+
+namespace OPCUA
+{
+    TCertificateCache::TCertificateCache(size_t capacity, std::chrono::steady_clock::duration ttl)
+        : Capacity(capacity),
+          Ttl(ttl)
+    {}
+
+    bool TCertificateCache::Find(const UA_ByteString& certificate, UA_StatusCode& result)
+    {
+        auto key = GetKey(certificate);
+        std::unique_lock<std::mutex> lock(Mutex);
+        auto it = Entries.find(key);
+        if (it == Entries.end()) {
+            return false;
+        }
+        if (it->second.Expires <= std::chrono::steady_clock::now()) {
+            Entries.erase(it);
+            return false;
+        }
+        result = it->second.Result;
+        return true;
+    }
+
+    void TCertificateCache::Add(const UA_ByteString& certificate, UA_StatusCode result)
+    {
+        if (Capacity == 0) {
+            return;
+        }
+        auto key = GetKey(certificate);
+        auto now = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(Mutex);
+        if (Entries.size() >= Capacity && !Entries.count(key)) {
+            // The cache is small, so linear scans are cheaper than keeping an expiration order
+            for (auto it = Entries.begin(); it != Entries.end();) {
+                it = (it->second.Expires <= now) ? Entries.erase(it) : std::next(it);
+            }
+            if (Entries.size() >= Capacity) {
+                Entries.erase(std::min_element(Entries.begin(), Entries.end(), [](const auto& a, const auto& b) {
+                    return a.second.Expires < b.second.Expires;
+                }));
+            }
+        }
+        Entries[key] = TEntry{result, now + Ttl};
+    }
+
+    void CacheCertificateVerification(UA_CertificateVerification& verification, TCertificateCache& cache)
+    {
+        auto cached = new TCachedVerification{verification, &cache};
+        verification.context = cached;
+        verification.verifyCertificate = VerifyCertificate;
+        verification.verifyApplicationURI = VerifyApplicationUri;
+        verification.clear = ClearVerification;
+    }
+}
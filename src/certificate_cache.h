@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <open62541/plugin/pki.h>
+
+namespace OPCUA
+{
+    /**! Results of client certificate verification.
+     *   Verification of a certificate chain takes several asymmetric operations, so results are reused
+     *   while clients reconnect. Thread-safe, shared by server instances.
+     */
+    class TCertificateCache
+    {
+    public:
+        //! Results are kept for ttl, so trust list changes are applied after it
+        TCertificateCache(size_t capacity, std::chrono::steady_clock::duration ttl);
+
+        //! Returns false if there is no unexpired result for the certificate
+        bool Find(const UA_ByteString& certificate, UA_StatusCode& result);
+
+        //! Evicts expired results or the oldest one if the cache is full
+        void Add(const UA_ByteString& certificate, UA_StatusCode result);
+
+    private:
+        struct TEntry
+        {
+            UA_StatusCode Result;
+            std::chrono::steady_clock::time_point Expires;
+        };
+
+        size_t Capacity;
+        std::chrono::steady_clock::duration Ttl;
+
+        std::mutex Mutex;
+
+        //! Keyed by certificate bytes
+        std::unordered_map<std::string, TEntry> Entries;
+    };
+
+    /**! Wraps certificate verification of a server config, so certificates are looked up in the cache first.
+     *   Clearing the verification clears the wrapped one. The cache must outlive the server config.
+     */
+    void CacheCertificateVerification(UA_CertificateVerification& verification, TCertificateCache& cache);
+}
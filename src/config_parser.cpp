@@ -1,9 +1,21 @@
 #include "config_parser.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
 
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <wblib/json_utils.h>
 #include <wblib/wbmqtt.h>
@@ -15,7 +27,7 @@ using namespace std;
 using namespace WBMQTT;
 using namespace WBMQTT::JSON;
 
-#define LOG(logger) ::logger.Log() << "[config] "
+#define LOG(logger) LOG_WITH_PREFIX(logger, "[config] ")
 
 namespace
 {
@@ -37,17 +49,34 @@ namespace
         return (l.size() == 2);
     }
 
-    OPCUA::TVariableNodesConfig LoadVariableNodes(const Json::Value& controls)
+    OPCUA::TVariableNodesConfig LoadVariableNodes(const Json::Value& group)
     {
         OPCUA::TVariableNodesConfig res;
-        for (const auto& control: controls) {
+        uint32_t historyDepth = 0;
+        Get(group, "history_depth", historyDepth);
+        uint32_t historyRetention = 0;
+        Get(group, "history_retention_h", historyRetention);
+        bool snapshot = false;
+        Get(group, "snapshot", snapshot);
+        uint32_t pubSubWriterId = 0;
+        Get(group, "pubsub_writer_id", pubSubWriterId);
+        if (pubSubWriterId > std::numeric_limits<uint16_t>::max()) {
+            throw std::runtime_error("Invalid PubSub writer id: " + std::to_string(pubSubWriterId));
+        }
+        for (const auto& control: group["controls"]) {
             bool enabled = false;
             Get(control, "enabled", enabled);
             if (enabled) {
                 OPCUA::TVariableNodeConfig n;
                 n.DeviceControlPair = control["topic"].asString();
+                Get(control, "absolute_deadband", n.AbsoluteDeadband);
+                Get(control, "percent_deadband", n.PercentDeadband);
+                n.HistoryDepth = historyDepth;
+                n.HistoryRetention = std::chrono::hours(historyRetention);
+                n.Snapshot = snapshot;
+                n.PubSubWriterId = pubSubWriterId;
                 if (IsValidTopic(n.DeviceControlPair)) {
-                    res.push_back(n);
+                    res.push_back(std::move(n));
                 } else {
                     LOG(Warn) << "Invalid topic: " << n.DeviceControlPair;
                 }
@@ -60,12 +89,22 @@ namespace
     {
         OPCUA::TObjectNodesConfig res;
         bool anyEnabled = false;
+        std::set<uint32_t> pubSubWriterIds;
         for (const auto& group: config["groups"]) {
             bool enabled = false;
             Get(group, "enabled", enabled);
             if (enabled) {
                 anyEnabled = true;
-                res.insert({group["name"].asString(), LoadVariableNodes(group["controls"])});
+                uint32_t pubSubWriterId = 0;
+                Get(group, "pubsub_writer_id", pubSubWriterId);
+                if (pubSubWriterId != 0 && !pubSubWriterIds.insert(pubSubWriterId).second) {
+                    throw std::runtime_error("Duplicate PubSub writer id: " + std::to_string(pubSubWriterId));
+                }
+                auto name = group["name"].asString();
+                if (name == OPCUA::DIAGNOSTICS_NODE_NAME) {
+                    throw std::runtime_error("Group name '" + name + "' is reserved");
+                }
+                res.emplace(name, LoadVariableNodes(group));
             }
         }
         if (!anyEnabled) {
@@ -83,7 +122,7 @@ namespace
         return cnt;
     }
 
-    void AppendControl(Json::Value& root, PControl c)
+    void AppendControl(Json::Value& root, const PControl& c)
     {
         std::string info(c->GetType());
         info += (c->IsReadonly() ? " (read only)" : " (setup is allowed)");
@@ -91,15 +130,6 @@ namespace
         root.append(MakeControlConfig(controlName, info));
     }
 
-    Json::Value MakeControlsConfig(std::map<std::string, PControl>& controls)
-    {
-        Json::Value res(Json::arrayValue);
-        for (auto control: controls) {
-            AppendControl(res, control.second);
-        }
-        return res;
-    }
-
     Json::Value MakeGroupConfig(const std::string& name)
     {
         Json::Value dev(Json::objectValue);
@@ -109,14 +139,73 @@ namespace
         return dev;
     }
 
-    Json::Value& GetGroup(Json::Value& config, const std::string& name)
+    /**! Parsed schema, LoadConfig is called on every reload and the schema rarely changes.
+     *   The schema is parsed again if its modification time changes. The cached schema is shared, not copied,
+     *   and stays valid for the caller if another thread replaces it
+     */
+    std::shared_ptr<const Json::Value> GetSchema(const std::string& fileName)
+    {
+        static std::mutex mutex;
+        static std::unordered_map<std::string, std::pair<timespec, std::shared_ptr<const Json::Value>>> schemas;
+
+        struct stat st;
+        if (stat(fileName.c_str(), &st) != 0) {
+            return std::make_shared<const Json::Value>(JSON::Parse(fileName));
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        auto it = schemas.find(fileName);
+        if (it != schemas.end() && it->second.first.tv_sec == st.st_mtim.tv_sec &&
+            it->second.first.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            return it->second.second;
+        }
+        auto schema = std::make_shared<const Json::Value>(JSON::Parse(fileName));
+        schemas[fileName] = {st.st_mtim, schema};
+        return schema;
+    }
+
+    //! Writes to a temporary file and renames it, so a power loss leaves either the old or the new config
+    void WriteConfig(const Json::Value& config, const std::string& fileName)
     {
-        for (auto& group: config["groups"]) {
-            if (group["name"].asString() == name) {
-                return group;
+        auto tmpFileName = fileName + ".tmp";
+        {
+            Json::StreamWriterBuilder builder;
+            builder["indentation"] = "    ";
+            std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+            std::ofstream file(tmpFileName);
+            if (!file) {
+                throw std::runtime_error("Can't create '" + tmpFileName + "': " + strerror(errno));
             }
+            writer->write(config, &file);
+            file << std::endl;
+            file.close();
+            if (!file) {
+                unlink(tmpFileName.c_str());
+                throw std::runtime_error("Can't write '" + tmpFileName + "'");
+            }
+        }
+
+        struct stat st;
+        if (stat(fileName.c_str(), &st) == 0) {
+            chmod(tmpFileName.c_str(), st.st_mode & 07777);
+        }
+        auto fd = open(tmpFileName.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+        if (rename(tmpFileName.c_str(), fileName.c_str()) != 0) {
+            auto error = errno;
+            unlink(tmpFileName.c_str());
+            throw std::runtime_error("Can't replace '" + fileName + "': " + strerror(error));
+        }
+        auto slash = fileName.rfind('/');
+        auto dir = (slash == std::string::npos) ? std::string(".") : fileName.substr(0, slash + 1);
+        fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
         }
-        return config["groups"].append(MakeGroupConfig(name));
     }
 
     void LoadMqttConfig(WBMQTT::TMosquittoMqttConfig& cfg, const Json::Value& configRoot)
@@ -139,11 +228,82 @@ void LoadConfig(TConfig& cfg, const std::string& configFileName, const std::stri
 {
     try {
         auto config = JSON::Parse(configFileName);
-        JSON::Validate(config, JSON::Parse(configSchemaFileName));
+        JSON::Validate(config, *GetSchema(configSchemaFileName));
 
         if (config.isMember("opcua")) {
             Get(config["opcua"], "host", cfg.OpcUa.BindIp);
             Get(config["opcua"], "port", cfg.OpcUa.BindPort);
+            uint32_t threads = cfg.OpcUa.Threads;
+            Get(config["opcua"], "threads", threads);
+            cfg.OpcUa.Threads = threads;
+            if (cfg.OpcUa.BindPort + cfg.OpcUa.Threads - 1 > std::numeric_limits<uint16_t>::max()) {
+                throw std::runtime_error("Ports of server threads exceed 65535, decrease port or threads");
+            }
+            Get(config["opcua"], "push_values", cfg.OpcUa.PushValues);
+            uint32_t loopLatency = cfg.OpcUa.LoopLatency.count();
+            Get(config["opcua"], "loop_latency_ms", loopLatency);
+            cfg.OpcUa.LoopLatency = std::chrono::milliseconds(loopLatency);
+            std::string writeMode;
+            if (Get(config["opcua"], "write_mode", writeMode) && writeMode == "enqueue") {
+                cfg.OpcUa.WriteMode = OPCUA::TWriteMode::Enqueue;
+            }
+            uint32_t writeTimeoutMs = cfg.OpcUa.WriteTimeout.count();
+            Get(config["opcua"], "write_timeout_ms", writeTimeoutMs);
+            cfg.OpcUa.WriteTimeout = std::chrono::milliseconds(writeTimeoutMs);
+            uint32_t writeQueueSize = cfg.OpcUa.WriteQueueSize;
+            Get(config["opcua"], "write_queue_size", writeQueueSize);
+            cfg.OpcUa.WriteQueueSize = writeQueueSize;
+            uint32_t metricsInterval = cfg.OpcUa.MetricsInterval.count();
+            Get(config["opcua"], "metrics_interval_s", metricsInterval);
+            cfg.OpcUa.MetricsInterval = std::chrono::seconds(metricsInterval);
+            Get(config["opcua"], "history_dir", cfg.OpcUa.HistoryDir);
+            uint32_t historyFlushInterval = cfg.OpcUa.HistoryFlushInterval.count();
+            Get(config["opcua"], "history_flush_interval_s", historyFlushInterval);
+            cfg.OpcUa.HistoryFlushInterval = std::chrono::seconds(historyFlushInterval);
+            uint32_t maxSessions = cfg.OpcUa.MaxSessions;
+            Get(config["opcua"], "max_sessions", maxSessions);
+            cfg.OpcUa.MaxSessions = maxSessions;
+            uint32_t maxSubscriptionsPerSession = cfg.OpcUa.MaxSubscriptionsPerSession;
+            Get(config["opcua"], "max_subscriptions_per_session", maxSubscriptionsPerSession);
+            cfg.OpcUa.MaxSubscriptionsPerSession = maxSubscriptionsPerSession;
+            uint32_t maxMonitoredItemsPerSubscription = cfg.OpcUa.MaxMonitoredItemsPerSubscription;
+            Get(config["opcua"], "max_monitored_items_per_subscription", maxMonitoredItemsPerSubscription);
+            cfg.OpcUa.MaxMonitoredItemsPerSubscription = maxMonitoredItemsPerSubscription;
+            uint32_t maxMonitoredItems = cfg.OpcUa.MaxMonitoredItems;
+            Get(config["opcua"], "max_monitored_items", maxMonitoredItems);
+            cfg.OpcUa.MaxMonitoredItems = maxMonitoredItems;
+            Get(config["opcua"], "min_sampling_interval_ms", cfg.OpcUa.MinSamplingInterval);
+            Get(config["opcua"], "min_publishing_interval_ms", cfg.OpcUa.MinPublishingInterval);
+            Get(config["opcua"], "load_governor", cfg.OpcUa.LoadGovernor);
+            uint32_t maxLoopLag = cfg.OpcUa.MaxLoopLag.count();
+            Get(config["opcua"], "max_loop_lag_ms", maxLoopLag);
+            cfg.OpcUa.MaxLoopLag = std::chrono::milliseconds(maxLoopLag);
+            Get(config["opcua"], "max_cpu_load_percent", cfg.OpcUa.MaxCpuLoad);
+            Get(config["opcua"], "certificate", cfg.OpcUa.Certificate);
+            Get(config["opcua"], "private_key", cfg.OpcUa.PrivateKey);
+            Get(config["opcua"], "trust_list_dir", cfg.OpcUa.TrustListDir);
+            Get(config["opcua"], "security_none", cfg.OpcUa.SecurityNone);
+            uint32_t maxSecurityTokenLifetime = cfg.OpcUa.MaxSecurityTokenLifetime.count();
+            Get(config["opcua"], "max_security_token_lifetime_s", maxSecurityTokenLifetime);
+            cfg.OpcUa.MaxSecurityTokenLifetime = std::chrono::seconds(maxSecurityTokenLifetime);
+            uint32_t maxSecureChannels = cfg.OpcUa.MaxSecureChannels;
+            Get(config["opcua"], "max_secure_channels", maxSecureChannels);
+            cfg.OpcUa.MaxSecureChannels = maxSecureChannels;
+            Get(config["opcua"], "pubsub_address", cfg.OpcUa.PubSubAddress);
+            Get(config["opcua"], "pubsub_interface", cfg.OpcUa.PubSubInterface);
+            Get(config["opcua"], "pubsub_publisher_id", cfg.OpcUa.PubSubPublisherId);
+            uint32_t pubSubInterval = cfg.OpcUa.PubSubInterval.count();
+            Get(config["opcua"], "pubsub_interval_ms", pubSubInterval);
+            cfg.OpcUa.PubSubInterval = std::chrono::milliseconds(pubSubInterval);
+            if (!cfg.OpcUa.PubSubAddress.empty() && cfg.OpcUa.PubSubInterval.count() == 0) {
+                throw std::runtime_error("PubSub publishing interval must be positive");
+            }
+            if (cfg.OpcUa.Certificate.empty() != cfg.OpcUa.PrivateKey.empty()) {
+                throw std::runtime_error("Both certificate and private key must be set for encrypted endpoints");
+            }
+            if (!cfg.OpcUa.SecurityNone && cfg.OpcUa.Certificate.empty()) {
+                throw std::runtime_error("Certificate is required if endpoint without security is disabled");
+            }
         }
         LoadMqttConfig(cfg.Mqtt, config);
         cfg.OpcUa.ObjectNodes = LoadNodes(config);
@@ -158,7 +318,7 @@ void LoadConfig(TConfig& cfg, const std::string& configFileName, const std::stri
 void UpdateConfig(const string& configFileName, const string& configSchemaFileName)
 {
     auto config = JSON::Parse(configFileName);
-    JSON::Validate(config, JSON::Parse(configSchemaFileName));
+    JSON::Validate(config, *GetSchema(configSchemaFileName));
 
     bool update_groups = false;
     Get(config, "update_groups", update_groups);
@@ -175,13 +335,7 @@ void UpdateConfig(const string& configFileName, const string& configSchemaFileNa
     }
 
     config["update_groups"] = false;
-
-    Json::StreamWriterBuilder builder;
-    builder["indentation"] = "    ";
-    std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
-    std::ofstream file(configFileName);
-    writer->write(config, &file);
-    file << std::endl;
+    WriteConfig(config, configFileName);
 }
 
 void UpdateConfig(PDeviceDriver driver, Json::Value& oldConfig)
@@ -190,45 +344,45 @@ void UpdateConfig(PDeviceDriver driver, Json::Value& oldConfig)
     driver->SetFilter(GetAllDevicesFilter());
     driver->WaitForReady();
 
-    std::map<std::string, std::map<std::string, PControl>> mqttDevices;
-    auto tx = driver->BeginTx();
-    for (auto& device: tx->GetDevicesList()) {
-        if (!WBMQTT::StringStartsWith(device->GetId(), "system__")) {
-            std::map<std::string, PControl> controls;
-            for (auto& control: device->ControlsList()) {
-                controls.insert({control->GetId(), control});
-            }
-            if (controls.size()) {
-                mqttDevices.insert({device->GetId(), controls});
-            }
-        }
+    // Hashed indices keep the merge linear in the number of controls
+    auto& groups = oldConfig["groups"];
+    if (groups.isNull()) {
+        groups = Json::Value(Json::arrayValue);
     }
-
-    for (auto& group: oldConfig["groups"]) {
-        for (auto& control: group["controls"]) {
-            auto topic = control["topic"].asString();
-            if (IsValidTopic(topic)) {
-                auto mqttDevice = mqttDevices.find(GetDeviceName(topic));
-                if (mqttDevice != mqttDevices.end()) {
-                    auto mqttControl = mqttDevice->second.find(GetControlName(topic));
-                    if (mqttControl != mqttDevice->second.end()) {
-                        mqttDevice->second.erase(mqttControl);
-                    }
-                }
-                if (!mqttDevice->second.size()) {
-                    mqttDevices.erase(mqttDevice);
-                }
-            }
+    std::unordered_map<std::string, Json::ArrayIndex> groupIndices;
+    std::unordered_set<std::string> configuredTopics;
+    for (Json::ArrayIndex i = 0; i < groups.size(); ++i) {
+        const auto& group = groups[i];
+        groupIndices.emplace(group["name"].asString(), i);
+        for (const auto& control: group["controls"]) {
+            configuredTopics.insert(control["topic"].asString());
         }
     }
 
-    for (auto& mqttDevice: mqttDevices) {
-        auto controls(MakeControlsConfig(mqttDevice.second));
-        if (controls.size()) {
-            auto& configGroup = GetGroup(oldConfig, mqttDevice.first);
-            for (auto& v: controls) {
-                configGroup["controls"].append(v);
+    auto tx = driver->BeginTx();
+    auto devices = tx->GetDevicesList();
+    auto byId = [](const auto& a, const auto& b) { return a->GetId() < b->GetId(); };
+    std::sort(devices.begin(), devices.end(), byId);
+    for (const auto& device: devices) {
+        if (WBMQTT::StringStartsWith(device->GetId(), "system__")) {
+            continue;
+        }
+        auto controls = device->ControlsList();
+        std::sort(controls.begin(), controls.end(), byId);
+        Json::Value* groupControls = nullptr;
+        for (const auto& control: controls) {
+            if (configuredTopics.count(device->GetId() + "/" + control->GetId())) {
+                continue;
+            }
+            if (!groupControls) {
+                auto it = groupIndices.find(device->GetId());
+                if (it == groupIndices.end()) {
+                    groups.append(MakeGroupConfig(device->GetId()));
+                    it = groupIndices.emplace(device->GetId(), groups.size() - 1).first;
+                }
+                groupControls = &groups[it->second]["controls"];
             }
+            AppendControl(*groupControls, control);
         }
     }
 }
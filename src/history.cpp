@@ -0,0 +1,426 @@
+#include "history.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <wblib/utils.h>
+
+#include "log.h"
+
+#define LOG(logger) LOG_WITH_PREFIX(logger, "[OPCUA] ")
+
+namespace
+{
+    const auto MIN_SEGMENT_DURATION = std::chrono::hours(1);
+
+    //! Number of segments kept within the retention
+    const int SEGMENTS_PER_RETENTION = 8;
+
+    std::chrono::seconds GetSegmentDuration(std::chrono::seconds retention)
+    {
+        return std::max<std::chrono::seconds>(retention / SEGMENTS_PER_RETENTION, MIN_SEGMENT_DURATION);
+    }
+
+    //! On-disk record in native byte order, the store is read on the same controller
+    struct THistoryRecord
+    {
+        int64_t Time;
+        double Value;
+        uint32_t Node;
+        uint8_t Type;
+        uint8_t Bad;
+        uint16_t Reserved;
+    };
+
+    static_assert(sizeof(THistoryRecord) == 24, "History record layout must not change");
+
+    int64_t GetUnixTime()
+    {
+        return UA_DateTime_toUnixTime(UA_DateTime_now());
+    }
+
+    std::string GetRecordsPath(const std::string& segmentPath)
+    {
+        return segmentPath + ".hist";
+    }
+
+    std::string GetNodesPath(const std::string& segmentPath)
+    {
+        return segmentPath + ".nodes";
+    }
+
+    //! Returns record indexes of the nodes referenced by records of the segment
+    std::unordered_map<std::string, uint32_t> LoadNodes(const std::string& segmentPath)
+    {
+        std::unordered_map<std::string, uint32_t> res;
+        std::ifstream file(GetNodesPath(segmentPath));
+        std::string line;
+        for (uint32_t i = 0; std::getline(file, line); ++i) {
+            res.emplace(line, i);
+        }
+        return res;
+    }
+
+    //! Returns time of the first record of the segment, the maximum time if there are no records
+    UA_DateTime ReadFirstTime(const std::string& segmentPath)
+    {
+        THistoryRecord record;
+        auto fd = open(GetRecordsPath(segmentPath).c_str(), O_RDONLY);
+        if (fd < 0) {
+            return std::numeric_limits<UA_DateTime>::max();
+        }
+        auto size = pread(fd, &record, sizeof(record), 0);
+        close(fd);
+        return (size == sizeof(record)) ? record.Time : std::numeric_limits<UA_DateTime>::max();
+    }
+
+    void ReadRecords(const std::string& segmentPath,
+                     uint32_t node,
+                     UA_DateTime start,
+                     UA_DateTime end,
+                     std::vector<OPCUA::THistorySample>& res)
+    {
+        auto fd = open(GetRecordsPath(segmentPath).c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(THistoryRecord))) {
+            close(fd);
+            return;
+        }
+        auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            LOG(Error) << "History segment '" << segmentPath << "' mapping failed";
+            return;
+        }
+        auto records = static_cast<const THistoryRecord*>(data);
+        size_t count = st.st_size / sizeof(THistoryRecord);
+        for (size_t i = 0; i < count; ++i) {
+            const auto& record = records[i];
+            if (record.Node == node && record.Time >= start && record.Time <= end) {
+                OPCUA::THistorySample sample;
+                sample.Time = record.Time;
+                sample.Value = record.Value;
+                sample.Type = static_cast<OPCUA::THistoryValueType>(record.Type);
+                sample.Bad = record.Bad;
+                res.push_back(sample);
+            }
+        }
+        munmap(data, st.st_size);
+    }
+
+    //! Longer encoded names are cut and get a hash of the group name, so they fit into NAME_MAX
+    const size_t MAX_GROUP_DIR_NAME = 200;
+
+    /**! Group names are arbitrary strings, so they are percent-encoded into safe directory names.
+     *   Only letters, digits, '-' and '_' are kept, so different groups never share a directory
+     *   and names like "." or ".." can't point outside of the history directory
+     */
+    std::string GetGroupDirName(const std::string& groupName)
+    {
+        if (groupName.empty()) {
+            throw std::runtime_error("empty group name");
+        }
+        const char* HEX = "0123456789ABCDEF";
+        std::string res;
+        for (auto c: groupName) {
+            auto byte = static_cast<unsigned char>(c);
+            if (isalnum(byte) || c == '-' || c == '_') {
+                res += c;
+            } else {
+                res += '%';
+                res += HEX[byte >> 4];
+                res += HEX[byte & 0x0F];
+            }
+        }
+        if (res.size() <= MAX_GROUP_DIR_NAME) {
+            return res;
+        }
+        // FNV-1a, stable between runs unlike std::hash. The cut name is longer than any short one
+        uint64_t hash = 14695981039346656037ULL;
+        for (auto c: groupName) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+        }
+        res.resize(MAX_GROUP_DIR_NAME - 16);
+        res += '~';
+        for (int shift = 60; shift >= 0; shift -= 4) {
+            res += HEX[(hash >> shift) & 0x0F];
+        }
+        return res;
+    }
+}
+
+namespace OPCUA
+{
+    THistoryBuffer::THistoryBuffer(size_t depth)
+    {
+        Samples.reserve(depth);
+    }
+
+    void THistoryBuffer::Add(const THistorySample& sample)
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        if (Samples.size() < Samples.capacity()) {
+            Samples.push_back(sample);
+            return;
+        }
+        Samples[Next] = sample;
+        Next = (Next + 1) % Samples.size();
+    }
+
+    UA_DateTime THistoryBuffer::GetOldestTime() const
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        return Samples.empty() ? 0 : Samples[Next].Time;
+    }
+
+    void THistoryBuffer::Read(UA_DateTime start, UA_DateTime end, std::vector<THistorySample>& res) const
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        for (size_t i = 0; i < Samples.size(); ++i) {
+            const auto& sample = Samples[(Next + i) % Samples.size()];
+            if (sample.Time >= start && sample.Time <= end) {
+                res.push_back(sample);
+            }
+        }
+    }
+
+    THistoryFile::THistoryFile(const std::string& dir, std::chrono::seconds retention)
+        : Dir(dir),
+          Retention(retention),
+          SegmentDuration(GetSegmentDuration(retention))
+    {
+        std::filesystem::create_directories(Dir);
+        for (const auto& entry: std::filesystem::directory_iterator(Dir)) {
+            if (entry.path().extension() != ".hist") {
+                continue;
+            }
+            try {
+                auto path = (entry.path().parent_path() / entry.path().stem()).string();
+                Segments.push_back(TSegment{std::stoll(entry.path().stem().string()), path, ReadFirstTime(path)});
+            } catch (const std::exception&) {
+                LOG(Warn) << "Unknown file in history directory: " << entry.path().string();
+            }
+        }
+        std::sort(Segments.begin(), Segments.end(), [](const auto& a, const auto& b) {
+            return a.StartTime < b.StartTime;
+        });
+    }
+
+    void THistoryFile::SetRetention(std::chrono::seconds retention)
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        Retention = retention;
+        SegmentDuration = GetSegmentDuration(retention);
+    }
+
+    void THistoryFile::Add(const std::string& nodeName, const THistorySample& sample)
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        Pending.emplace_back(nodeName, sample);
+    }
+
+    void THistoryFile::Flush()
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        auto now = GetUnixTime();
+        DeleteExpiredSegments(now);
+        if (Pending.empty()) {
+            return;
+        }
+        // Segments of previous runs have no node indexes loaded, so a new one is started after restart
+        if (SegmentNodes.empty() || now - Segments.back().StartTime >= SegmentDuration.count()) {
+            StartSegment(now);
+        }
+
+        std::string newNodes;
+        std::vector<THistoryRecord> records;
+        records.reserve(Pending.size());
+        for (const auto& item: Pending) {
+            auto it = SegmentNodes.find(item.first);
+            if (it == SegmentNodes.end()) {
+                it = SegmentNodes.emplace(item.first, SegmentNodes.size()).first;
+                newNodes += item.first + "\n";
+            }
+            THistoryRecord record{};
+            record.Time = item.second.Time;
+            record.Value = item.second.Value;
+            record.Node = it->second;
+            record.Type = static_cast<uint8_t>(item.second.Type);
+            record.Bad = item.second.Bad;
+            records.push_back(record);
+            Segments.back().FirstTime = std::min(Segments.back().FirstTime, record.Time);
+        }
+        Pending.clear();
+
+        // Node names go first, so records never reference unknown nodes
+        const auto& path = Segments.back().Path;
+        if (!newNodes.empty()) {
+            std::ofstream nodesFile(GetNodesPath(path), std::ios::app);
+            nodesFile << newNodes;
+        }
+        std::ofstream recordsFile(GetRecordsPath(path), std::ios::app | std::ios::binary);
+        recordsFile.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(THistoryRecord));
+        if (!recordsFile) {
+            LOG(Error) << "History segment '" << path << "' writing failed";
+        }
+    }
+
+    void THistoryFile::Read(const std::string& nodeName,
+                            UA_DateTime start,
+                            UA_DateTime end,
+                            std::vector<THistorySample>& res) const
+    {
+        // Segments are scanned without the lock, so flushes aren't blocked by slow reads.
+        // Records are only appended and deleted segments stay readable while they are mapped
+        std::vector<std::pair<TSegment, int64_t>> segments;
+        std::vector<THistorySample> pending;
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            for (size_t i = 0; i < Segments.size(); ++i) {
+                // Records of a segment precede the first record of the next one
+                if (Segments[i].FirstTime > end || (i + 1 < Segments.size() && Segments[i + 1].FirstTime < start)) {
+                    continue;
+                }
+                int64_t node = -1;
+                if (i + 1 == Segments.size() && !SegmentNodes.empty()) {
+                    auto it = SegmentNodes.find(nodeName);
+                    if (it == SegmentNodes.end()) {
+                        continue;
+                    }
+                    node = it->second;
+                }
+                segments.emplace_back(Segments[i], node);
+            }
+            for (const auto& item: Pending) {
+                if (item.first == nodeName && item.second.Time >= start && item.second.Time <= end) {
+                    pending.push_back(item.second);
+                }
+            }
+        }
+        auto first = res.size();
+        for (const auto& segment: segments) {
+            auto node = (segment.second >= 0) ? segment.second : FindNode(segment.first, nodeName);
+            if (node >= 0) {
+                ReadRecords(segment.first.Path, node, start, end, res);
+            }
+        }
+        res.insert(res.end(), pending.begin(), pending.end());
+        std::stable_sort(res.begin() + first, res.end(), [](const auto& a, const auto& b) { return a.Time < b.Time; });
+    }
+
+    int64_t THistoryFile::FindNode(const TSegment& segment, const std::string& nodeName) const
+    {
+        auto nodes = segment.Nodes;
+        if (!nodes) {
+            // Written segments don't change, so indexes loaded by concurrent reads are the same
+            nodes = std::make_shared<const TNodeIndexes>(LoadNodes(segment.Path));
+            std::unique_lock<std::mutex> lock(Mutex);
+            for (auto& s: Segments) {
+                if (s.Path == segment.Path) {
+                    s.Nodes = nodes;
+                    break;
+                }
+            }
+        }
+        auto it = nodes->find(nodeName);
+        return (it == nodes->end()) ? -1 : it->second;
+    }
+
+    void THistoryFile::StartSegment(int64_t now)
+    {
+        if (!Segments.empty() && Segments.back().StartTime >= now) {
+            now = Segments.back().StartTime + 1;
+        }
+        Segments.push_back(TSegment{now, Dir + "/" + std::to_string(now), std::numeric_limits<UA_DateTime>::max()});
+        SegmentNodes.clear();
+    }
+
+    void THistoryFile::DeleteExpiredSegments(int64_t now)
+    {
+        // A segment expires when its successor has started before the retention period
+        size_t expired = 0;
+        while (expired + 1 < Segments.size() && Segments[expired + 1].StartTime <= now - Retention.count()) {
+            std::error_code ec;
+            std::filesystem::remove(GetRecordsPath(Segments[expired].Path), ec);
+            std::filesystem::remove(GetNodesPath(Segments[expired].Path), ec);
+            ++expired;
+        }
+        Segments.erase(Segments.begin(), Segments.begin() + expired);
+    }
+
+    THistoryStorage::THistoryStorage(const std::string& dir, std::chrono::seconds flushInterval)
+        : Dir(dir),
+          FlushInterval(flushInterval)
+    {
+        FlushThread = std::thread([this]() {
+            WBMQTT::SetThreadName("opcua-history");
+            Run();
+        });
+    }
+
+    THistoryStorage::~THistoryStorage()
+    {
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            Stop = true;
+        }
+        Stopped.notify_all();
+        if (FlushThread.joinable()) {
+            FlushThread.join();
+        }
+        FlushAll();
+    }
+
+    THistoryFile* THistoryStorage::GetFile(const std::string& groupName, std::chrono::seconds retention)
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        auto it = Files.find(groupName);
+        if (it == Files.end()) {
+            auto file = std::make_unique<THistoryFile>(Dir + "/" + GetGroupDirName(groupName), retention);
+            it = Files.emplace(groupName, std::move(file)).first;
+        } else {
+            // Retention of the group may be changed by a reload
+            it->second->SetRetention(retention);
+        }
+        return it->second.get();
+    }
+
+    void THistoryStorage::Run()
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        while (!Stopped.wait_for(lock, FlushInterval, [this]() { return Stop; })) {
+            lock.unlock();
+            FlushAll();
+            lock.lock();
+        }
+    }
+
+    void THistoryStorage::FlushAll()
+    {
+        std::vector<THistoryFile*> files;
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            for (const auto& item: Files) {
+                files.push_back(item.second.get());
+            }
+        }
+        for (auto file: files) {
+            try {
+                file->Flush();
+            } catch (const std::exception& e) {
+                LOG(Error) << "History flush failed: " << e.what();
+            }
+        }
+    }
+}
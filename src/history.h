@@ -0,0 +1,144 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <open62541/types.h>
+
+namespace OPCUA
+{
+    enum class THistoryValueType : uint8_t
+    {
+        Double,
+        Boolean
+    };
+
+    //! Recorded value of a variable node. Text values are not recorded
+    struct THistorySample
+    {
+        UA_DateTime Time = 0;
+        double Value = 0;
+        THistoryValueType Type = THistoryValueType::Double;
+        bool Bad = false;
+    };
+
+    //! Fixed-size in-memory history of a variable node. The oldest samples are overwritten
+    class THistoryBuffer
+    {
+    public:
+        explicit THistoryBuffer(size_t depth);
+
+        void Add(const THistorySample& sample);
+
+        //! Time of the oldest kept sample, 0 if the buffer is empty
+        UA_DateTime GetOldestTime() const;
+
+        //! Appends samples with time in [start, end] range to res in time order
+        void Read(UA_DateTime start, UA_DateTime end, std::vector<THistorySample>& res) const;
+
+    private:
+        mutable std::mutex Mutex;
+        std::vector<THistorySample> Samples;
+        size_t Next = 0;
+    };
+
+    /**! Append-only on-disk history of a group.
+     *   Samples are buffered in memory and appended to the current segment file by Flush, one write per flush,
+     *   so flash memory is written in large blocks at a configurable rate.
+     *   A segment is a pair of files: <start unix time>.hist with fixed-size records
+     *   and <start unix time>.nodes with names of the nodes referenced by records, one per line.
+     *   Segments older than the retention are deleted as a whole.
+     */
+    class THistoryFile
+    {
+    public:
+        THistoryFile(const std::string& dir, std::chrono::seconds retention);
+
+        //! Segments older than the new retention are deleted on the next flush
+        void SetRetention(std::chrono::seconds retention);
+
+        void Add(const std::string& nodeName, const THistorySample& sample);
+
+        //! Appends buffered samples to disk, starts a new segment and deletes expired ones if needed
+        void Flush();
+
+        //! Appends samples of the node with time in [start, end] range to res in time order
+        void Read(const std::string& nodeName, UA_DateTime start, UA_DateTime end, std::vector<THistorySample>& res) const;
+
+    private:
+        typedef std::unordered_map<std::string, uint32_t> TNodeIndexes;
+
+        struct TSegment
+        {
+            int64_t StartTime;
+            std::string Path;
+
+            /**! Time of the first record, records are appended in time order. Samples are buffered before flushing,
+             *   so it may be earlier than StartTime. The maximum value if the segment has no records
+             */
+            UA_DateTime FirstTime;
+
+            //! Record indexes of the nodes, loaded on the first read of a written segment
+            std::shared_ptr<const TNodeIndexes> Nodes;
+        };
+
+        std::string Dir;
+        std::chrono::seconds Retention;
+        std::chrono::seconds SegmentDuration;
+
+        mutable std::mutex Mutex;
+
+        //! Segments in time order, the last one is written. Reads cache node indexes in them
+        mutable std::vector<TSegment> Segments;
+
+        //! Record indexes of the nodes of the last segment
+        TNodeIndexes SegmentNodes;
+
+        std::vector<std::pair<std::string, THistorySample>> Pending;
+
+        void StartSegment(int64_t now);
+        void DeleteExpiredSegments(int64_t now);
+
+        //! Returns record index of the node in the segment, -1 if the segment has no records of the node
+        int64_t FindNode(const TSegment& segment, const std::string& nodeName) const;
+    };
+
+    /**! On-disk history stores of groups in subdirectories of the history directory.
+     *   Stores are flushed periodically from a dedicated thread and on destruction.
+     */
+    class THistoryStorage
+    {
+    public:
+        THistoryStorage(const std::string& dir, std::chrono::seconds flushInterval);
+        ~THistoryStorage();
+
+        THistoryStorage(const THistoryStorage&) = delete;
+        THistoryStorage& operator=(const THistoryStorage&) = delete;
+
+        /**! Returns the store of the group, creates it if needed or updates its retention.
+         *   The store lives until the storage is destroyed. Throws on failure
+         */
+        THistoryFile* GetFile(const std::string& groupName, std::chrono::seconds retention);
+
+    private:
+        std::string Dir;
+        std::chrono::seconds FlushInterval;
+
+        std::mutex Mutex;
+        std::condition_variable Stopped;
+        bool Stop = false;
+        std::map<std::string, std::unique_ptr<THistoryFile>> Files;
+        std::thread FlushThread;
+
+        void Run();
+        void FlushAll();
+    };
+}
@@ -0,0 +1,56 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <bit>
+#include <sstream>
+
+namespace OPCUA
+{
+    void TLatencyHistogram::Add(std::chrono::steady_clock::duration duration)
+    {
+        auto us = static_cast<uint64_t>(
+            std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count(), 0));
+        auto bucket = std::min<size_t>(std::bit_width(us), BUCKETS_COUNT - 1);
+        Buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        Count.fetch_add(1, std::memory_order_relaxed);
+        SumUs.fetch_add(us, std::memory_order_relaxed);
+        auto max = MaxUs.load(std::memory_order_relaxed);
+        while (us > max && !MaxUs.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t TLatencyHistogram::GetCount() const
+    {
+        return Count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t TLatencyHistogram::GetPercentileUs(double percentile) const
+    {
+        uint64_t total = 0;
+        for (const auto& bucket: Buckets) {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+        if (total == 0) {
+            return 0;
+        }
+        auto rank = std::min(static_cast<uint64_t>(total * percentile / 100), total - 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS_COUNT; ++i) {
+            seen += Buckets[i].load(std::memory_order_relaxed);
+            if (seen > rank) {
+                return uint64_t(1) << i;
+            }
+        }
+        return MaxUs.load(std::memory_order_relaxed);
+    }
+
+    std::string TLatencyHistogram::ToString() const
+    {
+        auto count = GetCount();
+        std::stringstream ss;
+        ss << "count=" << count << " mean_us=" << (count ? SumUs.load(std::memory_order_relaxed) / count : 0)
+           << " p50_us=" << GetPercentileUs(50) << " p90_us=" << GetPercentileUs(90)
+           << " p99_us=" << GetPercentileUs(99) << " max_us=" << MaxUs.load(std::memory_order_relaxed);
+        return ss.str();
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace OPCUA
+{
+    /**! Lock-free histogram of durations with power of two microsecond buckets.
+     *   Bucket 0 counts durations below 1 us, bucket N counts durations in [2^(N-1), 2^N) us.
+     */
+    class TLatencyHistogram
+    {
+    public:
+        static constexpr size_t BUCKETS_COUNT = 32;
+
+        void Add(std::chrono::steady_clock::duration duration);
+
+        uint64_t GetCount() const;
+
+        //! Upper bound of the bucket holding the percentile, us
+        uint64_t GetPercentileUs(double percentile) const;
+
+        //! "count=N mean_us=N p50_us=N p90_us=N p99_us=N max_us=N"
+        std::string ToString() const;
+
+    private:
+        std::array<std::atomic<uint64_t>, BUCKETS_COUNT> Buckets{};
+        std::atomic<uint64_t> Count = 0;
+        std::atomic<uint64_t> SumUs = 0;
+        std::atomic<uint64_t> MaxUs = 0;
+    };
+
+    //! Measures time from construction to destruction
+    class TLatencyTimer
+    {
+    public:
+        explicit TLatencyTimer(TLatencyHistogram& histogram)
+            : Histogram(histogram),
+              Start(std::chrono::steady_clock::now())
+        {}
+
+        ~TLatencyTimer()
+        {
+            Histogram.Add(std::chrono::steady_clock::now() - Start);
+        }
+
+        TLatencyTimer(const TLatencyTimer&) = delete;
+        TLatencyTimer& operator=(const TLatencyTimer&) = delete;
+
+    private:
+        TLatencyHistogram& Histogram;
+        std::chrono::steady_clock::time_point Start;
+    };
+}
@@ -0,0 +1,79 @@
+#include "load_governor.h"
+
+#include <algorithm>
+
+namespace OPCUA
+{
+    TLoadGovernor::TLoadGovernor(std::chrono::milliseconds period,
+                                 std::chrono::milliseconds maxLoopLag,
+                                 double maxCpuLoad,
+                                 double minSamplingInterval,
+                                 double minPublishingInterval)
+        : Period(period),
+          MaxLoopLag(maxLoopLag),
+          MaxCpuLoad(maxCpuLoad),
+          MinSamplingInterval(minSamplingInterval),
+          MinPublishingInterval(minPublishingInterval)
+    {}
+
+    bool TLoadGovernor::Update(std::chrono::steady_clock::time_point now, const TCpuTimes& cpu)
+    {
+        if (LastTime == std::chrono::steady_clock::time_point()) {
+            LastTime = now;
+            LastCpu = cpu;
+            return false;
+        }
+        auto lag = (now - LastTime) - Period;
+        double cpuLoad = 0;
+        if (cpu.Total > LastCpu.Total && cpu.Busy >= LastCpu.Busy) {
+            cpuLoad = 100.0 * (cpu.Busy - LastCpu.Busy) / (cpu.Total - LastCpu.Total);
+        }
+        LastTime = now;
+        LastCpu = cpu;
+
+        auto factor = Factor.load(std::memory_order_relaxed);
+        if (lag > MaxLoopLag || cpuLoad > MaxCpuLoad) {
+            CalmPeriods = 0;
+            if (factor < MAX_FACTOR) {
+                Factor.store(factor * 2, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+        // Hysteresis, so the intervals don't flap near the limits
+        if (lag > MaxLoopLag / 2 || cpuLoad > MaxCpuLoad * 0.8) {
+            CalmPeriods = 0;
+            return false;
+        }
+        if (factor > 1 && ++CalmPeriods >= CALM_PERIODS) {
+            CalmPeriods = 0;
+            Factor.store(factor / 2, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    uint32_t TLoadGovernor::GetFactor() const
+    {
+        return Factor.load(std::memory_order_relaxed);
+    }
+
+    double TLoadGovernor::GetMinSamplingInterval() const
+    {
+        return GetInterval(MinSamplingInterval);
+    }
+
+    double TLoadGovernor::GetMinPublishingInterval() const
+    {
+        return GetInterval(MinPublishingInterval);
+    }
+
+    double TLoadGovernor::GetInterval(double configured) const
+    {
+        auto factor = GetFactor();
+        if (factor == 1) {
+            return configured;
+        }
+        return std::max(configured, MIN_RAISED_INTERVAL) * factor;
+    }
+}
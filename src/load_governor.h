@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "metrics.h"
+
+namespace OPCUA
+{
+    /**! Raises minimum sampling and publishing intervals of a server instance when the controller is overloaded.
+     *   Clients get the raised intervals as revised values of new and modified subscriptions and monitored items,
+     *   so a client requesting everything at 0 ms can't starve the others.
+     *   The load is measured from the server loop lag and the system CPU load.
+     *   The intervals are doubled on every overloaded period and halved back after several calm periods.
+     */
+    class TLoadGovernor
+    {
+    public:
+        //! Maximum multiplier of minimum intervals
+        static constexpr uint32_t MAX_FACTOR = 16;
+
+        //! Raised intervals are not shorter than that, ms
+        static constexpr double MIN_RAISED_INTERVAL = 100;
+
+        //! Number of calm periods before lowering the intervals
+        static constexpr uint32_t CALM_PERIODS = 10;
+
+        /**! period - expected time between updates,
+         *   maxLoopLag - maximum delay of updates,
+         *   maxCpuLoad - maximum system CPU load, percents,
+         *   minSamplingInterval, minPublishingInterval - configured minimum intervals, ms
+         */
+        TLoadGovernor(std::chrono::milliseconds period,
+                      std::chrono::milliseconds maxLoopLag,
+                      double maxCpuLoad,
+                      double minSamplingInterval,
+                      double minPublishingInterval);
+
+        /**! Called every period from the server loop. Returns true if minimum intervals are changed.
+         *   The first call only takes the reference point.
+         */
+        bool Update(std::chrono::steady_clock::time_point now, const TCpuTimes& cpu);
+
+        //! Current multiplier of minimum intervals, may be read from any thread
+        uint32_t GetFactor() const;
+
+        double GetMinSamplingInterval() const;
+        double GetMinPublishingInterval() const;
+
+    private:
+        std::chrono::steady_clock::duration Period;
+        std::chrono::steady_clock::duration MaxLoopLag;
+        double MaxCpuLoad;
+        double MinSamplingInterval;
+        double MinPublishingInterval;
+
+        std::chrono::steady_clock::time_point LastTime;
+        TCpuTimes LastCpu{};
+        uint32_t CalmPeriods = 0;
+        std::atomic<uint32_t> Factor = 1;
+
+        double GetInterval(double configured) const;
+    };
+}
@@ -6,3 +6,9 @@ extern WBMQTT::TLogger Error;
 extern WBMQTT::TLogger Warn;
 extern WBMQTT::TLogger Info;
 extern WBMQTT::TLogger Debug;
+
+// Arguments are not evaluated if the logger is disabled
+#define LOG_WITH_PREFIX(logger, prefix)                                                                                \
+    if (!::logger.IsEnabled()) {                                                                                       \
+    } else                                                                                                             \
+        ::logger.Log() << prefix
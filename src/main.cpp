@@ -1,4 +1,5 @@
 #include <getopt.h>
+#include <mutex>
 
 #include <wblib/signal_handling.h>
 #include <wblib/wbmqtt.h>
@@ -9,7 +10,7 @@
 #include "config_parser.h"
 #include "opcua_exception.h"
 
-#define LOG(logger) ::logger.Log() << "[main] "
+#define LOG(logger) LOG_WITH_PREFIX(logger, "[main] ")
 
 #define STR(x) #x
 #define XSTR(x) STR(x)
@@ -132,6 +133,22 @@ namespace
                 exit(2);
         }
     }
+
+    //! Applies groups from the config file to the running server, other settings require restart
+    void ReloadConfig(OPCUA::IServer& server, const string& configFile)
+    {
+        LOG(Info) << "Reloading config";
+        TConfig config;
+        try {
+            LoadConfig(config, configFile, CONFIG_JSON_SCHEMA_FULL_FILE_PATH);
+        } catch (const TEmptyConfigException&) {
+            LOG(Warn) << "All groups are disabled";
+        } catch (const exception& e) {
+            LOG(Error) << "Config reload failed, previous config is kept: " << e.what();
+            return;
+        }
+        server.Reload(config.OpcUa.ObjectNodes);
+    }
 }
 
 int main(int argc, char* argv[])
@@ -140,8 +157,22 @@ int main(int argc, char* argv[])
     string configFile(CONFIG_FULL_FILE_PATH);
 
     TPromise<void> initialized;
-    SignalHandling::Handle({SIGINT, SIGTERM});
+    std::unique_ptr<OPCUA::IServer> opcuaServer;
+    std::mutex opcuaServerMutex;
+    SignalHandling::Handle({SIGINT, SIGTERM, SIGHUP, SIGUSR1});
     SignalHandling::OnSignals({SIGINT, SIGTERM}, [&] { SignalHandling::Stop(); });
+    SignalHandling::OnSignals({SIGHUP}, [&] {
+        std::unique_lock<std::mutex> lock(opcuaServerMutex);
+        if (opcuaServer) {
+            ReloadConfig(*opcuaServer, configFile);
+        }
+    });
+    SignalHandling::OnSignals({SIGUSR1}, [&] {
+        std::unique_lock<std::mutex> lock(opcuaServerMutex);
+        if (opcuaServer) {
+            opcuaServer->LogLatency();
+        }
+    });
     SetThreadName(APP_NAME);
 
     ParseCommadLine(argc, argv, config.Mqtt, configFile);
@@ -176,10 +207,17 @@ int main(int argc, char* argv[])
         driver->StartLoop();
         driver->WaitForReady();
 
-        auto OpcuaServer(OPCUA::MakeServer(config.OpcUa, driver));
+        {
+            auto server = OPCUA::MakeServer(config.OpcUa, driver);
+            std::unique_lock<std::mutex> lock(opcuaServerMutex);
+            opcuaServer = std::move(server);
+        }
 
         initialized.Complete();
         SignalHandling::Wait();
+
+        std::unique_lock<std::mutex> lock(opcuaServerMutex);
+        opcuaServer.reset();
     } catch (const TEmptyConfigException&) {
         LOG(Error) << "All groups are disabled, stopping service gracefully";
         return EXIT_NOTRUNNING;
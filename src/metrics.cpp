@@ -0,0 +1,98 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace
+{
+    typedef std::array<std::atomic<uint64_t>, static_cast<size_t>(OPCUA::TCounter::COUNT)> TThreadCounters;
+
+    std::mutex RegistryMutex;
+    std::vector<const TThreadCounters*> Registry;
+
+    //! Counters of exited threads
+    OPCUA::TCounters RetiredCounters{};
+
+    class TThreadCountersHolder
+    {
+    public:
+        TThreadCountersHolder()
+        {
+            std::unique_lock<std::mutex> lock(RegistryMutex);
+            Registry.push_back(&Counters);
+        }
+
+        ~TThreadCountersHolder()
+        {
+            std::unique_lock<std::mutex> lock(RegistryMutex);
+            for (size_t i = 0; i < Counters.size(); ++i) {
+                RetiredCounters[i] += Counters[i].load(std::memory_order_relaxed);
+            }
+            Registry.erase(std::find(Registry.begin(), Registry.end(), &Counters));
+        }
+
+        TThreadCounters Counters{};
+    };
+
+    thread_local TThreadCountersHolder ThreadCounters;
+}
+
+namespace OPCUA
+{
+    namespace Metrics
+    {
+        void Add(TCounter counter, uint64_t value)
+        {
+            // Only the owner thread writes the counter, so no atomic read-modify-write is needed
+            auto& c = ThreadCounters.Counters[static_cast<size_t>(counter)];
+            c.store(c.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        TCounters Collect()
+        {
+            std::unique_lock<std::mutex> lock(RegistryMutex);
+            auto res = RetiredCounters;
+            for (const auto counters: Registry) {
+                for (size_t i = 0; i < res.size(); ++i) {
+                    res[i] += (*counters)[i].load(std::memory_order_relaxed);
+                }
+            }
+            return res;
+        }
+
+        uint64_t GetRssKb()
+        {
+            uint64_t size = 0;
+            uint64_t resident = 0;
+            std::ifstream statm("/proc/self/statm");
+            statm >> size >> resident;
+            return resident * sysconf(_SC_PAGESIZE) / 1024;
+        }
+
+        TCpuTimes GetCpuTimes()
+        {
+            // cpu user nice system idle iowait irq softirq steal
+            std::ifstream stat("/proc/stat");
+            std::string cpu;
+            uint64_t times[8] = {};
+            stat >> cpu;
+            for (auto& time: times) {
+                stat >> time;
+            }
+            if (!stat || cpu != "cpu") {
+                return TCpuTimes{};
+            }
+            uint64_t total = 0;
+            for (auto time: times) {
+                total += time;
+            }
+            return TCpuTimes{total - times[3] - times[4], total};
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace OPCUA
+{
+    enum class TCounter
+    {
+        //! MQTT value events of configured controls
+        Events,
+
+        //! OPC UA reads served by the gateway callbacks
+        Reads,
+
+        //! OPC UA writes to variable nodes
+        Writes,
+
+        //! OPC UA writes rejected before queueing for publishing
+        FailedWrites,
+
+        //! Time spent waiting for the gateway mutexes
+        MutexWaitUs,
+
+        COUNT
+    };
+
+    typedef std::array<uint64_t, static_cast<size_t>(TCounter::COUNT)> TCounters;
+
+    //! System-wide CPU time since boot, in clock ticks
+    struct TCpuTimes
+    {
+        //! Time of all CPUs spent not idle and not waiting for IO
+        uint64_t Busy;
+        uint64_t Total;
+    };
+
+    /**! Process-wide counters. Every thread increments its own copy without contention,
+     *   the copies are summed up only on collection.
+     */
+    namespace Metrics
+    {
+        void Add(TCounter counter, uint64_t value = 1);
+
+        TCounters Collect();
+
+        //! Resident set size of the process in kilobytes
+        uint64_t GetRssKb();
+
+        //! Reads /proc/stat, returns zeros if it is unavailable
+        TCpuTimes GetCpuTimes();
+    }
+}
@@ -0,0 +1,23 @@
+#include "pending_pushes.h"
+
+namespace OPCUA
+{
+    bool TPendingPushes::AddSnapshot(const std::string& objectNodeName)
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        Snapshots.insert(objectNodeName);
+        return !Pending.exchange(true, std::memory_order_release);
+    }
+
+    bool TPendingPushes::Take(std::vector<std::string>& snapshots)
+    {
+        if (!Pending.load(std::memory_order_acquire)) {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(Mutex);
+        snapshots.assign(Snapshots.begin(), Snapshots.end());
+        Snapshots.clear();
+        Pending.store(false, std::memory_order_relaxed);
+        return !snapshots.empty();
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace OPCUA
+{
+    /**! Groups with snapshot nodes changed by values received from MQTT, waiting to be rebuilt by a server thread.
+     *   Repeated changes of a group before the thread takes them are coalesced, the thread writes the latest values.
+     *   Thread-safe, the server thread checks for pending groups without locking.
+     */
+    class TPendingPushes
+    {
+    public:
+        //! Returns true if there were no pending groups, so the server thread should be woken up
+        bool AddSnapshot(const std::string& objectNodeName);
+
+        //! Moves pending group names to the vector, returns false if there are none
+        bool Take(std::vector<std::string>& snapshots);
+
+    private:
+        std::mutex Mutex;
+        std::unordered_set<std::string> Snapshots;
+        std::atomic<bool> Pending = false;
+    };
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace OPCUA
+{
+    /**! Read sections and grace periods of read-copy-update.
+     *   Readers enter sections without locks and waiting.
+     *   A writer unlinks an object from readers and waits for a grace period before deleting it.
+     */
+    class TRcuDomain
+    {
+    public:
+        //! Read section. Objects seen in the section are valid while the guard exists
+        class TReadGuard
+        {
+        public:
+            explicit TReadGuard(const TRcuDomain& owner)
+            {
+                auto epoch = owner.Epoch.load();
+                Readers = &owner.Readers[epoch & 1];
+                Readers->fetch_add(1);
+            }
+
+            TReadGuard(TReadGuard&& other) noexcept: Readers(other.Readers)
+            {
+                other.Readers = nullptr;
+            }
+
+            TReadGuard(const TReadGuard&) = delete;
+            TReadGuard& operator=(const TReadGuard&) = delete;
+            TReadGuard& operator=(TReadGuard&&) = delete;
+
+            ~TReadGuard()
+            {
+                if (Readers) {
+                    Readers->fetch_sub(1, std::memory_order_release);
+                }
+            }
+
+        private:
+            std::atomic<uint64_t>* Readers;
+        };
+
+        TRcuDomain() = default;
+        TRcuDomain(const TRcuDomain&) = delete;
+        TRcuDomain& operator=(const TRcuDomain&) = delete;
+
+        TReadGuard Read() const
+        {
+            return TReadGuard(*this);
+        }
+
+        //! Epoch to tag objects which the caller has unlinked from readers
+        uint32_t GetEpoch() const
+        {
+            return Epoch.load();
+        }
+
+        //! Returns true if no read section could see objects unlinked in the epoch
+        bool IsGracePeriodOver(uint32_t epoch) const
+        {
+            return static_cast<int32_t>(Epoch.load() - epoch) >= 2;
+        }
+
+        /**! Starts the next epoch if readers registered two epochs ago are gone, doesn't wait for them.
+         *   Readers could take any of two counters around a flip, so a grace period takes two epochs.
+         */
+        void TryAdvance()
+        {
+            std::unique_lock<std::mutex> lock(WriterMutex);
+            auto epoch = Epoch.load();
+            if (Readers[(epoch + 1) & 1].load() == 0) {
+                Epoch.store(epoch + 1);
+            }
+        }
+
+        //! Blocks until read sections started before the call are gone, must not be called in read section
+        void Synchronize()
+        {
+            auto epoch = GetEpoch();
+            while (!IsGracePeriodOver(epoch)) {
+                TryAdvance();
+                if (!IsGracePeriodOver(epoch)) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+        mutable std::atomic<uint64_t> Readers[2] = {0, 0};
+        std::atomic<uint32_t> Epoch = 0;
+        std::mutex WriterMutex;
+    };
+
+    /**! Read-copy-update pointer to an immutable snapshot.
+     *   Readers take the current snapshot without locks and waiting.
+     *   A writer publishes a new snapshot and deletes the old one after all readers,
+     *   which could see it, have left their read sections.
+     */
+    template<class T> class TRcuPtr
+    {
+    public:
+        //! Read section. The snapshot is valid while the guard exists
+        class TReadGuard
+        {
+        public:
+            explicit TReadGuard(const TRcuPtr& owner): Section(owner.Domain.Read()), Value(owner.Current.load())
+            {}
+
+            const T* operator->() const
+            {
+                return Value;
+            }
+
+            const T& operator*() const
+            {
+                return *Value;
+            }
+
+        private:
+            TRcuDomain::TReadGuard Section;
+            const T* Value;
+        };
+
+        explicit TRcuPtr(std::unique_ptr<T> value): Current(value.release())
+        {}
+
+        TRcuPtr(const TRcuPtr&) = delete;
+        TRcuPtr& operator=(const TRcuPtr&) = delete;
+
+        ~TRcuPtr()
+        {
+            delete Current.load();
+        }
+
+        TReadGuard Read() const
+        {
+            return TReadGuard(*this);
+        }
+
+        //! Publishes a new snapshot. Blocks until readers of the previous one are gone, must not be called in read section
+        void Update(std::unique_ptr<T> value)
+        {
+            std::unique_ptr<T> old(Current.exchange(value.release()));
+            Domain.Synchronize();
+        }
+
+    private:
+        std::atomic<T*> Current;
+        TRcuDomain Domain;
+    };
+}
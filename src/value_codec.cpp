@@ -0,0 +1,190 @@
+#include "value_codec.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <unordered_map>
+
+namespace
+{
+    const std::unordered_map<std::string, OPCUA::TValueKind> MetaTypes = {
+        {"switch", OPCUA::TValueKind::Boolean},
+        {"pushbutton", OPCUA::TValueKind::Boolean},
+        {"alarm", OPCUA::TValueKind::Boolean},
+        {"range", OPCUA::TValueKind::Double},
+        {"value", OPCUA::TValueKind::Double},
+        {"text", OPCUA::TValueKind::String},
+        {"rgb", OPCUA::TValueKind::String},
+        // Legacy numeric types with implied units
+        {"temperature", OPCUA::TValueKind::Double},
+        {"rel_humidity", OPCUA::TValueKind::Double},
+        {"atmospheric_pressure", OPCUA::TValueKind::Double},
+        {"pressure", OPCUA::TValueKind::Double},
+        {"rainfall", OPCUA::TValueKind::Double},
+        {"wind_speed", OPCUA::TValueKind::Double},
+        {"power", OPCUA::TValueKind::Double},
+        {"power_consumption", OPCUA::TValueKind::Double},
+        {"voltage", OPCUA::TValueKind::Double},
+        {"current", OPCUA::TValueKind::Double},
+        {"water_flow", OPCUA::TValueKind::Double},
+        {"water_consumption", OPCUA::TValueKind::Double},
+        {"heat_power", OPCUA::TValueKind::Double},
+        {"heat_energy", OPCUA::TValueKind::Double},
+        {"resistance", OPCUA::TValueKind::Double},
+        {"concentration", OPCUA::TValueKind::Double},
+        {"lux", OPCUA::TValueKind::Double},
+        {"sound_level", OPCUA::TValueKind::Double}};
+
+    bool IsIntegerPrecision(double precision)
+    {
+        return precision >= 1 && std::floor(precision) == precision;
+    }
+
+    template<class T> T ClampRound(double value)
+    {
+        if (value <= std::numeric_limits<T>::min()) {
+            return std::numeric_limits<T>::min();
+        }
+        if (value >= std::numeric_limits<T>::max()) {
+            return std::numeric_limits<T>::max();
+        }
+        return static_cast<T>(std::llround(value));
+    }
+
+    template<class T> bool GetScalar(const UA_Variant& variant, const UA_DataType* type, double& value)
+    {
+        if (!UA_Variant_hasScalarType(&variant, type)) {
+            return false;
+        }
+        value = static_cast<double>(*static_cast<const T*>(variant.data));
+        return true;
+    }
+
+    bool GetNumber(const UA_Variant& variant, double& value)
+    {
+        return GetScalar<UA_Double>(variant, &UA_TYPES[UA_TYPES_DOUBLE], value) ||
+               GetScalar<UA_Float>(variant, &UA_TYPES[UA_TYPES_FLOAT], value) ||
+               GetScalar<UA_Int32>(variant, &UA_TYPES[UA_TYPES_INT32], value) ||
+               GetScalar<UA_UInt32>(variant, &UA_TYPES[UA_TYPES_UINT32], value) ||
+               GetScalar<UA_Int16>(variant, &UA_TYPES[UA_TYPES_INT16], value) ||
+               GetScalar<UA_UInt16>(variant, &UA_TYPES[UA_TYPES_UINT16], value) ||
+               GetScalar<UA_Int64>(variant, &UA_TYPES[UA_TYPES_INT64], value) ||
+               GetScalar<UA_UInt64>(variant, &UA_TYPES[UA_TYPES_UINT64], value) ||
+               GetScalar<UA_SByte>(variant, &UA_TYPES[UA_TYPES_SBYTE], value) ||
+               GetScalar<UA_Byte>(variant, &UA_TYPES[UA_TYPES_BYTE], value);
+    }
+}
+
+namespace OPCUA
+{
+    TValueKind GetValueKind(const std::string& metaType, double min, double precision)
+    {
+        auto it = MetaTypes.find(metaType);
+        if (it == MetaTypes.end()) {
+            return TValueKind::Unknown;
+        }
+        if (it->second == TValueKind::Double && IsIntegerPrecision(precision)) {
+            if (metaType != "range") {
+                // Counters of value controls may exceed Int32
+                return TValueKind::Int64;
+            }
+            return (min >= 0) ? TValueKind::UInt32 : TValueKind::Int32;
+        }
+        return it->second;
+    }
+
+    const UA_DataType* GetDataType(TValueKind kind)
+    {
+        switch (kind) {
+            case TValueKind::Boolean:
+                return &UA_TYPES[UA_TYPES_BOOLEAN];
+            case TValueKind::Int32:
+                return &UA_TYPES[UA_TYPES_INT32];
+            case TValueKind::UInt32:
+                return &UA_TYPES[UA_TYPES_UINT32];
+            case TValueKind::Int64:
+                return &UA_TYPES[UA_TYPES_INT64];
+            case TValueKind::Double:
+                return &UA_TYPES[UA_TYPES_DOUBLE];
+            case TValueKind::String:
+                return &UA_TYPES[UA_TYPES_STRING];
+            default:
+                return nullptr;
+        }
+    }
+
+    bool IsNumeric(TValueKind kind)
+    {
+        return kind == TValueKind::Boolean || kind == TValueKind::Int32 || kind == TValueKind::UInt32 ||
+               kind == TValueKind::Int64 || kind == TValueKind::Double;
+    }
+
+    bool ParseNumber(TValueKind kind, const std::string& rawValue, double& value)
+    {
+        if (kind == TValueKind::Boolean && (rawValue == "true" || rawValue == "false")) {
+            value = (rawValue == "true");
+            return true;
+        }
+        if (rawValue.empty()) {
+            return false;
+        }
+        char* end = nullptr;
+        value = std::strtod(rawValue.c_str(), &end);
+        if (*end != '\0' || std::isnan(value)) {
+            return false;
+        }
+        if (kind == TValueKind::Boolean) {
+            value = (value != 0);
+        }
+        return true;
+    }
+
+    void SetNumber(UA_Variant& variant, TValueKind kind, double value, TNumberStorage& storage)
+    {
+        switch (kind) {
+            case TValueKind::Boolean:
+                storage.Boolean = (value != 0);
+                break;
+            case TValueKind::Int32:
+                storage.Int32 = ClampRound<UA_Int32>(value);
+                break;
+            case TValueKind::UInt32:
+                storage.UInt32 = ClampRound<UA_UInt32>(value);
+                break;
+            case TValueKind::Int64:
+                storage.Int64 = ClampRound<UA_Int64>(value);
+                break;
+            default:
+                storage.Double = value;
+                kind = TValueKind::Double;
+                break;
+        }
+        UA_Variant_setScalar(&variant, &storage, GetDataType(kind));
+        variant.storageType = UA_VARIANT_DATA_NODELETE;
+    }
+
+    bool GetWriteValue(TWriteValue& value, TValueKind kind, const UA_Variant& variant)
+    {
+        if (UA_Variant_hasScalarType(&variant, &UA_TYPES[UA_TYPES_BOOLEAN])) {
+            value = static_cast<bool>(*(UA_Boolean*)variant.data);
+            return true;
+        }
+        if (UA_Variant_hasScalarType(&variant, &UA_TYPES[UA_TYPES_STRING])) {
+            auto str = (UA_String*)variant.data;
+            value = std::string((const char*)str->data, str->length);
+            return true;
+        }
+        double number;
+        if (!GetNumber(variant, number)) {
+            return false;
+        }
+        if (kind == TValueKind::Boolean) {
+            value = (number != 0);
+        } else if (kind == TValueKind::Int32 || kind == TValueKind::UInt32 || kind == TValueKind::Int64) {
+            value = std::round(number);
+        } else {
+            value = number;
+        }
+        return true;
+    }
+}
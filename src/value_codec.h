@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <variant>
+
+#include <open62541/types.h>
+
+namespace OPCUA
+{
+    //! Value written by OPC UA client. Strings are published as raw values
+    typedef std::variant<bool, double, std::string> TWriteValue;
+
+    //! OPC UA representation of control values, chosen once from the control meta type
+    enum class TValueKind
+    {
+        //! Unknown meta type, the representation is chosen from every value
+        Unknown,
+        Boolean,
+        Int32,
+        UInt32,
+        Int64,
+        Double,
+        String
+    };
+
+    /**! Maps Wiren Board meta type to value representation:
+     *     - switch, pushbutton, alarm - Boolean;
+     *     - range - UInt32 or Int32 if precision is integer, depending on the sign of min, otherwise Double;
+     *     - value and legacy numeric types - Int64 if precision is integer, otherwise Double;
+     *     - text, rgb - String.
+     *   precision is 0 if it is not set.
+     */
+    TValueKind GetValueKind(const std::string& metaType, double min, double precision);
+
+    //! DataType of variable nodes with values of the kind, nullptr for BaseDataType
+    const UA_DataType* GetDataType(TValueKind kind);
+
+    bool IsNumeric(TValueKind kind);
+
+    //! Parses raw MQTT value of a numeric or boolean kind without allocations. Returns false on malformed values
+    bool ParseNumber(TValueKind kind, const std::string& rawValue, double& value);
+
+    //! Scalar of a numeric or boolean kind
+    union TNumberStorage
+    {
+        UA_Boolean Boolean;
+        UA_Int32 Int32;
+        UA_UInt32 UInt32;
+        UA_Int64 Int64;
+        UA_Double Double;
+    };
+
+    /**! Points the variant to the value converted to the kind in storage without allocations.
+     *   Values out of the range of an integer kind are clamped to it. Values are kept as double,
+     *   so Int64 values are exact up to 2^53.
+     *   The variant doesn't own the value, so clearing it doesn't free storage.
+     */
+    void SetNumber(UA_Variant& variant, TValueKind kind, double value, TNumberStorage& storage);
+
+    /**! Converts a value written by OPC UA client to the value published to MQTT.
+     *   Integer and float types are accepted for numeric kinds. Returns false for unsupported types.
+     */
+    bool GetWriteValue(TWriteValue& value, TValueKind kind, const UA_Variant& variant);
+}
@@ -0,0 +1,222 @@
+#include "write_queue.h"
+
+#include <algorithm>
+
+#include "async_log.h"
+#include "log.h"
+
+#define LOG(logger) LOG_WITH_PREFIX(logger, "[OPCUA] ")
+
+namespace
+{
+    //! Rejected writes are logged once per period, so clients can't flood the log
+    OPCUA::TLogRateLimit QueueFullLogLimit(std::chrono::seconds(10));
+
+    WBMQTT::TFuture<void> SetControlValue(const WBMQTT::PDriverTx& tx, const OPCUA::TWriteRequest& request)
+    {
+        if (auto value = std::get_if<bool>(&request.Value)) {
+            LOG(Debug) << "Variable node '" << request.NodeName << "' = " << *value;
+            return request.Control->SetValue(tx, *value);
+        }
+        if (auto value = std::get_if<double>(&request.Value)) {
+            LOG(Debug) << "Variable node '" << request.NodeName << "' = " << *value;
+            return request.Control->SetValue(tx, *value);
+        }
+        const auto& rawValue = std::get<std::string>(request.Value);
+        LOG(Debug) << "Variable node '" << request.NodeName << "' = " << rawValue;
+        return request.Control->SetRawValue(tx, rawValue);
+    }
+}
+
+namespace OPCUA
+{
+    TWriteQueue::TWriteQueue(WBMQTT::PDeviceDriver driver, size_t maxSize): Driver(driver), MaxSize(maxSize)
+    {
+        Worker = std::thread([this]() {
+            WBMQTT::SetThreadName("opcua-write");
+            Run();
+        });
+    }
+
+    TWriteQueue::~TWriteQueue()
+    {
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            Stopped = true;
+        }
+        HasRequests.notify_all();
+        if (Worker.joinable()) {
+            Worker.join();
+        }
+    }
+
+    std::future<UA_StatusCode> TWriteQueue::Push(TWriteRequest&& request)
+    {
+        auto res = request.Result.get_future();
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            if (Requests.size() + Reserved >= MaxSize) {
+                Reject(request.NodeName, 1);
+                request.Result.set_value(UA_STATUSCODE_BADTOOMANYOPERATIONS);
+                return res;
+            }
+            Requests.emplace_back(std::move(request));
+            Stats.Depth = Requests.size();
+            Stats.MaxDepth = std::max(Stats.MaxDepth, Stats.Depth);
+        }
+        HasRequests.notify_one();
+        return res;
+    }
+
+    std::vector<std::future<UA_StatusCode>> TWriteQueue::Push(std::vector<TWriteRequest>&& requests)
+    {
+        std::vector<std::future<UA_StatusCode>> res;
+        res.reserve(requests.size());
+        for (auto& request: requests) {
+            res.push_back(request.Result.get_future());
+        }
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            if (Requests.size() + Reserved + requests.size() > MaxSize) {
+                Reject(std::string(), requests.size());
+                for (auto& request: requests) {
+                    request.Result.set_value(UA_STATUSCODE_BADTOOMANYOPERATIONS);
+                }
+                return res;
+            }
+            for (auto& request: requests) {
+                Requests.emplace_back(std::move(request));
+            }
+            Stats.Depth = Requests.size();
+            Stats.MaxDepth = std::max(Stats.MaxDepth, Stats.Depth);
+        }
+        HasRequests.notify_one();
+        return res;
+    }
+
+    bool TWriteQueue::Reserve(const std::string& nodeName)
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        if (Requests.size() + Reserved >= MaxSize) {
+            Reject(nodeName, 1);
+            return false;
+        }
+        ++Reserved;
+        return true;
+    }
+
+    void TWriteQueue::PushReserved(std::vector<TWriteRequest>& requests)
+    {
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            Reserved -= std::min(Reserved, requests.size());
+            for (auto& request: requests) {
+                Requests.emplace_back(std::move(request));
+            }
+            Stats.Depth = Requests.size();
+            Stats.MaxDepth = std::max(Stats.MaxDepth, Stats.Depth);
+        }
+        requests.clear();
+        HasRequests.notify_one();
+    }
+
+    void TWriteQueue::Reject(const std::string& nodeName, size_t count)
+    {
+        Stats.Rejected += count;
+        uint64_t suppressed;
+        if (QueueFullLogLimit.Allow(suppressed)) {
+            if (!nodeName.empty()) {
+                LOG(Warn) << "Variable node '" << nodeName << "' writing failed. Write queue is full ("
+                          << Requests.size() + Reserved << " requests)" << TSuppressed{suppressed};
+            } else {
+                LOG(Warn) << count << " variable nodes writing failed. Write queue is full ("
+                          << Requests.size() + Reserved << " requests)" << TSuppressed{suppressed};
+            }
+        }
+    }
+
+    void TWriteQueue::AddTimeout()
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        ++Stats.Timeouts;
+    }
+
+    TWriteQueueStats TWriteQueue::GetStats() const
+    {
+        std::unique_lock<std::mutex> lock(Mutex);
+        return Stats;
+    }
+
+    const TLatencyHistogram& TWriteQueue::GetPublishLatency() const
+    {
+        return PublishLatency;
+    }
+
+    void TWriteQueue::Run()
+    {
+        std::vector<TWriteRequest> batch;
+        std::unique_lock<std::mutex> lock(Mutex);
+        while (true) {
+            HasRequests.wait(lock, [this]() { return Stopped || !Requests.empty(); });
+            if (Requests.empty()) {
+                return;
+            }
+            batch.swap(Requests);
+            Stats.Depth = 0;
+            lock.unlock();
+
+            auto failed = Publish(batch);
+
+            lock.lock();
+            ++Stats.Batches;
+            Stats.Published += batch.size() - failed;
+            Stats.Failed += failed;
+            batch.clear();
+        }
+    }
+
+    size_t TWriteQueue::Publish(std::vector<TWriteRequest>& batch)
+    {
+        size_t failed = 0;
+        std::vector<std::pair<TWriteRequest*, WBMQTT::TFuture<void>>> published;
+        published.reserve(batch.size());
+        WBMQTT::PDriverTx tx;
+        try {
+            tx = Driver->BeginTx();
+        } catch (const std::exception& e) {
+            LOG(Error) << batch.size() << " written values are not published to MQTT: " << e.what();
+            for (auto& request: batch) {
+                request.Result.set_value(UA_STATUSCODE_BADDEVICEFAILURE);
+            }
+            return batch.size();
+        }
+        for (auto& request: batch) {
+            try {
+                published.emplace_back(&request, SetControlValue(tx, request));
+            } catch (const std::exception& e) {
+                LOG(Error) << "Variable node '" + request.NodeName + "' write error: " << e.what();
+                request.Result.set_value(UA_STATUSCODE_BADDEVICEFAILURE);
+                ++failed;
+            }
+        }
+        for (auto& item: published) {
+            try {
+                item.second.Sync();
+                LOG(Debug) << "Variable node '" << item.first->NodeName << "' is published";
+                PublishLatency.Add(std::chrono::steady_clock::now() - item.first->QueuedTime);
+                item.first->Result.set_value(UA_STATUSCODE_GOOD);
+            } catch (const std::exception& e) {
+                LOG(Error) << "Variable node '" + item.first->NodeName + "' write error: " << e.what();
+                item.first->Result.set_value(UA_STATUSCODE_BADDEVICEFAILURE);
+                ++failed;
+            }
+        }
+        // Successful batches are not logged by default, every client write would reach the journal
+        if (failed) {
+            LOG(Warn) << batch.size() - failed << " of " << batch.size() << " written values are published to MQTT";
+        } else {
+            LOG(Debug) << batch.size() << " written values are published to MQTT";
+        }
+        return failed;
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include <open62541/statuscodes.h>
+#include <open62541/types.h>
+
+#include <wblib/wbmqtt.h>
+
+#include "latency.h"
+#include "value_codec.h"
+
+namespace OPCUA
+{
+    struct TWriteRequest
+    {
+        //! Node id, used for logging
+        std::string NodeName;
+
+        //! Keeps the control alive while the request is queued, the control could be replaced meanwhile
+        WBMQTT::PControl Control;
+
+        TWriteValue Value;
+
+        std::promise<UA_StatusCode> Result;
+
+        std::chrono::steady_clock::time_point QueuedTime = std::chrono::steady_clock::now();
+    };
+
+    struct TWriteQueueStats
+    {
+        size_t Depth = 0;
+        size_t MaxDepth = 0;
+        uint64_t Batches = 0;
+        uint64_t Published = 0;
+        uint64_t Failed = 0;
+        uint64_t Rejected = 0;
+        uint64_t Timeouts = 0;
+    };
+
+    /**! Publishes values written by OPC UA clients to MQTT from a dedicated thread,
+     *   so the OPC UA server loop doesn't wait for the MQTT driver.
+     *   All requests queued while the previous batch was published go to MQTT in one driver transaction.
+     */
+    class TWriteQueue
+    {
+    public:
+        TWriteQueue(WBMQTT::PDeviceDriver driver, size_t maxSize);
+
+        //! Publishes queued requests and stops the thread
+        ~TWriteQueue();
+
+        TWriteQueue(const TWriteQueue&) = delete;
+        TWriteQueue& operator=(const TWriteQueue&) = delete;
+
+        /**! Queues the request.
+         *   Returns UA_STATUSCODE_BADTOOMANYOPERATIONS instead of queueing if the queue is full.
+         */
+        std::future<UA_StatusCode> Push(TWriteRequest&& request);
+
+        /**! Queues the requests at once, so they are published in one driver transaction.
+         *   All requests are rejected with UA_STATUSCODE_BADTOOMANYOPERATIONS if they don't fit into the queue.
+         */
+        std::vector<std::future<UA_StatusCode>> Push(std::vector<TWriteRequest>&& requests);
+
+        /**! Reserves a place for the request of the node, which is queued later by PushReserved.
+         *   Returns false and counts the request as rejected if the queue is full.
+         */
+        bool Reserve(const std::string& nodeName);
+
+        //! Queues requests with reserved places at once, so they are published in one driver transaction
+        void PushReserved(std::vector<TWriteRequest>& requests);
+
+        //! Counts a write response sent before the request was published
+        void AddTimeout();
+
+        TWriteQueueStats GetStats() const;
+
+        //! Time from queueing of a request to confirmation of publishing by the driver
+        const TLatencyHistogram& GetPublishLatency() const;
+
+    private:
+        void Run();
+
+        //! Completes requests of the batch, returns the number of failed ones
+        size_t Publish(std::vector<TWriteRequest>& batch);
+
+        //! Counts and logs rejected requests. Called under Mutex
+        void Reject(const std::string& nodeName, size_t count);
+
+        WBMQTT::PDeviceDriver Driver;
+        size_t MaxSize;
+
+        mutable std::mutex Mutex;
+        std::condition_variable HasRequests;
+        std::vector<TWriteRequest> Requests;
+
+        //! Places reserved for requests which are not queued yet
+        size_t Reserved = 0;
+        TWriteQueueStats Stats;
+        bool Stopped = false;
+
+        TLatencyHistogram PublishLatency;
+
+        std::thread Worker;
+    };
+}
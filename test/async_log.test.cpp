@@ -0,0 +1,84 @@
+#include "async_log.h"
+
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log.h"
+
+namespace
+{
+    void Push(OPCUA::TAsyncLog& log, WBMQTT::TLogger& logger, const char* format, ...)
+    {
+        va_list args;
+        va_start(args, format);
+        log.Push(logger, "test", format, args);
+        va_end(args);
+    }
+}
+
+TEST(TAsyncLogTest, push)
+{
+    OPCUA::TAsyncLog log(4);
+    for (int i = 0; i < 3; ++i) {
+        Push(log, ::Info, "message %d", i);
+    }
+    ASSERT_EQ(0, log.GetDropped());
+}
+
+// Messages pushed while the ring is full are dropped, queued ones are written in order
+TEST(TAsyncLogTest, overflow)
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<std::string> written;
+    bool released = false;
+    bool blocked;
+    uint64_t dropped;
+    {
+        OPCUA::TAsyncLog log(4, [&](WBMQTT::TLogger& logger, const char* category, const char* text) {
+            EXPECT_EQ(&::Info, &logger);
+            std::unique_lock<std::mutex> lock(mutex);
+            written.push_back(std::string(category) + ": " + text);
+            changed.notify_all();
+            // The record is occupied until the first message is written
+            changed.wait(lock, [&]() { return released; });
+        });
+        Push(log, ::Info, "message %d", 0);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            blocked = changed.wait_for(lock, std::chrono::seconds(2), [&]() { return !written.empty(); });
+        }
+        for (int i = 1; i < 6; ++i) {
+            Push(log, ::Info, "message %d", i);
+        }
+        dropped = log.GetDropped();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            released = true;
+        }
+        changed.notify_all();
+        // The destructor writes the queued messages
+    }
+    ASSERT_TRUE(blocked);
+    ASSERT_EQ(2, dropped);
+    ASSERT_EQ((std::vector<std::string>{"test: message 0", "test: message 1", "test: message 2", "test: message 3"}),
+              written);
+}
+
+TEST(TLogRateLimitTest, suppress)
+{
+    OPCUA::TLogRateLimit limit(std::chrono::milliseconds(50));
+    uint64_t suppressed = 100;
+    ASSERT_TRUE(limit.Allow(suppressed));
+    ASSERT_EQ(0, suppressed);
+    ASSERT_FALSE(limit.Allow(suppressed));
+    ASSERT_FALSE(limit.Allow(suppressed));
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    ASSERT_TRUE(limit.Allow(suppressed));
+    ASSERT_EQ(2, suppressed);
+}
@@ -0,0 +1,92 @@
+#include "certificate_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <open62541/statuscodes.h>
+
+#include <thread>
+
+namespace
+{
+    UA_ByteString MakeCertificate(std::string& bytes)
+    {
+        return UA_ByteString{bytes.size(), reinterpret_cast<UA_Byte*>(bytes.data())};
+    }
+
+    struct TVerificationCalls
+    {
+        size_t Count = 0;
+        bool Cleared = false;
+    };
+
+    extern "C" {
+    //! Certificates starting with 'g' are good
+    UA_StatusCode CountingVerifyCertificate(void* context, const UA_ByteString* certificate)
+    {
+        ++static_cast<TVerificationCalls*>(context)->Count;
+        return (certificate->length && certificate->data[0] == 'g') ? UA_STATUSCODE_GOOD : UA_STATUSCODE_BAD;
+    }
+
+    UA_StatusCode AcceptApplicationUri(void* context, const UA_ByteString* certificate, const UA_String* applicationUri)
+    {
+        return UA_STATUSCODE_GOOD;
+    }
+
+    void ClearCountingVerification(UA_CertificateVerification* verification)
+    {
+        static_cast<TVerificationCalls*>(verification->context)->Cleared = true;
+    }
+    }
+}
+
+TEST(TCertificateCacheTest, find)
+{
+    OPCUA::TCertificateCache cache(2, std::chrono::seconds(60));
+    std::string a = "a", b = "b", c = "c";
+    UA_StatusCode res = UA_STATUSCODE_GOOD;
+
+    ASSERT_FALSE(cache.Find(MakeCertificate(a), res));
+    cache.Add(MakeCertificate(a), UA_STATUSCODE_BAD);
+    ASSERT_TRUE(cache.Find(MakeCertificate(a), res));
+    ASSERT_EQ(UA_STATUSCODE_BAD, res);
+
+    // The oldest result is evicted
+    cache.Add(MakeCertificate(b), UA_STATUSCODE_GOOD);
+    cache.Add(MakeCertificate(c), UA_STATUSCODE_GOOD);
+    ASSERT_FALSE(cache.Find(MakeCertificate(a), res));
+    ASSERT_TRUE(cache.Find(MakeCertificate(b), res));
+    ASSERT_TRUE(cache.Find(MakeCertificate(c), res));
+}
+
+TEST(TCertificateCacheTest, expiration)
+{
+    OPCUA::TCertificateCache cache(2, std::chrono::milliseconds(10));
+    std::string a = "a";
+    UA_StatusCode res;
+    cache.Add(MakeCertificate(a), UA_STATUSCODE_GOOD);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_FALSE(cache.Find(MakeCertificate(a), res));
+}
+
+TEST(TCertificateCacheTest, verification)
+{
+    OPCUA::TCertificateCache cache(10, std::chrono::seconds(60));
+    TVerificationCalls calls;
+    UA_CertificateVerification verification{&calls,
+                                            CountingVerifyCertificate,
+                                            AcceptApplicationUri,
+                                            ClearCountingVerification};
+    OPCUA::CacheCertificateVerification(verification, cache);
+
+    std::string goodBytes = "good", badBytes = "bad";
+    auto good = MakeCertificate(goodBytes);
+    auto bad = MakeCertificate(badBytes);
+    for (size_t i = 0; i < 3; ++i) {
+        ASSERT_EQ(UA_STATUSCODE_GOOD, verification.verifyCertificate(verification.context, &good));
+        ASSERT_EQ(UA_STATUSCODE_BAD, verification.verifyCertificate(verification.context, &bad));
+    }
+    ASSERT_EQ(2, calls.Count);
+
+    verification.clear(&verification);
+    ASSERT_TRUE(calls.Cleared);
+}
@@ -1,8 +1,11 @@
 #include "config_parser.h"
 
 #include <gtest/gtest.h>
+#include <filesystem>
 #include <vector>
 
+#include <unistd.h>
+
 #include <wblib/json_utils.h>
 #include <wblib/testing/fake_driver.h>
 #include <wblib/testing/fake_mqtt.h>
@@ -32,8 +35,9 @@ TEST_F(TLoadConfigTest, no_file)
 
 TEST_F(TLoadConfigTest, bad_config)
 {
-    // missing fields
-    for (size_t i = 1; i <= 3; ++i) {
+    // missing fields, endpoint without security is disabled without certificate, duplicate PubSub writer ids,
+    // ports of server threads out of range, reserved group name
+    for (size_t i = 1; i <= 7; ++i) {
         TConfig cfg;
         ASSERT_THROW(LoadConfig(cfg, TestRootDir + "/bad/bad" + std::to_string(i) + ".conf", SchemaFile),
                      std::runtime_error)
@@ -56,6 +60,97 @@ TEST_F(TLoadConfigTest, good)
     ASSERT_STREQ(cfg.OpcUa.ObjectNodes["test"].begin()->DeviceControlPair.c_str(), "test/test");
 }
 
+TEST_F(TLoadConfigTest, deadband)
+{
+    TConfig cfg;
+    LoadConfig(cfg, TestRootDir + "/good/deadband.conf", SchemaFile);
+    ASSERT_EQ(cfg.OpcUa.ObjectNodes["test"].size(), 1);
+    ASSERT_DOUBLE_EQ(cfg.OpcUa.ObjectNodes["test"].begin()->AbsoluteDeadband, 0.5);
+    ASSERT_DOUBLE_EQ(cfg.OpcUa.ObjectNodes["test"].begin()->PercentDeadband, 2);
+}
+
+TEST_F(TLoadConfigTest, history)
+{
+    TConfig cfg;
+    LoadConfig(cfg, TestRootDir + "/good/history.conf", SchemaFile);
+    ASSERT_EQ(cfg.OpcUa.HistoryDir, "/tmp/wb-mqtt-opcua-history");
+    ASSERT_EQ(cfg.OpcUa.HistoryFlushInterval.count(), 60);
+    ASSERT_EQ(cfg.OpcUa.ObjectNodes["test"].size(), 1);
+    ASSERT_EQ(cfg.OpcUa.ObjectNodes["test"].begin()->HistoryDepth, 1000);
+    ASSERT_EQ(cfg.OpcUa.ObjectNodes["test"].begin()->HistoryRetention.count(), 24 * 3600);
+}
+
+TEST_F(TLoadConfigTest, snapshot)
+{
+    TConfig cfg;
+    LoadConfig(cfg, TestRootDir + "/good/snapshot.conf", SchemaFile);
+    ASSERT_EQ(cfg.OpcUa.ObjectNodes["test"].size(), 2);
+    for (const auto& variableNode: cfg.OpcUa.ObjectNodes["test"]) {
+        ASSERT_TRUE(variableNode.Snapshot);
+    }
+}
+
+TEST_F(TLoadConfigTest, limits)
+{
+    TConfig cfg;
+    LoadConfig(cfg, TestRootDir + "/good/limits.conf", SchemaFile);
+    ASSERT_EQ(cfg.OpcUa.MaxSessions, 10);
+    ASSERT_EQ(cfg.OpcUa.MaxSubscriptionsPerSession, 5);
+    ASSERT_EQ(cfg.OpcUa.MaxMonitoredItemsPerSubscription, 1000);
+    ASSERT_EQ(cfg.OpcUa.MaxMonitoredItems, 5000);
+    ASSERT_DOUBLE_EQ(cfg.OpcUa.MinSamplingInterval, 250);
+    ASSERT_DOUBLE_EQ(cfg.OpcUa.MinPublishingInterval, 500);
+    ASSERT_FALSE(cfg.OpcUa.LoadGovernor);
+    ASSERT_EQ(cfg.OpcUa.MaxLoopLag.count(), 200);
+    ASSERT_DOUBLE_EQ(cfg.OpcUa.MaxCpuLoad, 75);
+    ASSERT_TRUE(cfg.OpcUa.PushValues);
+    ASSERT_EQ(cfg.OpcUa.LoopLatency.count(), 2);
+}
+
+TEST_F(TLoadConfigTest, security)
+{
+    TConfig cfg;
+    LoadConfig(cfg, TestRootDir + "/good/security.conf", SchemaFile);
+    ASSERT_EQ(cfg.OpcUa.Certificate, "/etc/wb-mqtt-opcua/server_cert.der");
+    ASSERT_EQ(cfg.OpcUa.PrivateKey, "/etc/wb-mqtt-opcua/server_key.der");
+    ASSERT_EQ(cfg.OpcUa.TrustListDir, "/etc/wb-mqtt-opcua/trusted");
+    ASSERT_FALSE(cfg.OpcUa.SecurityNone);
+    ASSERT_EQ(cfg.OpcUa.MaxSecurityTokenLifetime.count(), 7200);
+    ASSERT_EQ(cfg.OpcUa.MaxSecureChannels, 10);
+}
+
+TEST_F(TLoadConfigTest, pubsub)
+{
+    TConfig cfg;
+    LoadConfig(cfg, TestRootDir + "/good/pubsub.conf", SchemaFile);
+    ASSERT_EQ(cfg.OpcUa.PubSubAddress, "opc.udp://224.0.0.22:4840/");
+    ASSERT_EQ(cfg.OpcUa.PubSubInterface, "eth0");
+    ASSERT_EQ(cfg.OpcUa.PubSubPublisherId, 42);
+    ASSERT_EQ(cfg.OpcUa.PubSubInterval.count(), 20);
+    ASSERT_EQ(cfg.OpcUa.ObjectNodes["fast"].size(), 2);
+    for (const auto& variableNode: cfg.OpcUa.ObjectNodes["fast"]) {
+        ASSERT_EQ(variableNode.PubSubWriterId, 7);
+    }
+    ASSERT_EQ(cfg.OpcUa.ObjectNodes["slow"].front().PubSubWriterId, 0);
+}
+
+TEST_F(TLoadConfigTest, write_config)
+{
+    auto configFile = std::filesystem::temp_directory_path() / ("wb-mqtt-opcua-test-" + std::to_string(getpid()));
+    std::filesystem::copy_file(TestRootDir + "/good/limits.conf", configFile);
+    std::filesystem::permissions(configFile, std::filesystem::perms::owner_read | std::filesystem::perms::owner_write);
+
+    UpdateConfig(configFile.string(), SchemaFile);
+
+    auto config = JSON::Parse(configFile.string());
+    ASSERT_FALSE(config["update_groups"].asBool());
+    ASSERT_EQ(config["opcua"]["max_sessions"].asInt(), 10);
+    ASSERT_FALSE(std::filesystem::exists(configFile.string() + ".tmp"));
+    ASSERT_EQ(std::filesystem::status(configFile).permissions(),
+              std::filesystem::perms::owner_read | std::filesystem::perms::owner_write);
+    std::filesystem::remove(configFile);
+}
+
 class TUpdateConfigTest: public Testing::TLoggedFixture
 {
 protected:
@@ -0,0 +1,120 @@
+#include "history.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace
+{
+    OPCUA::THistorySample MakeSample(UA_DateTime time, double value)
+    {
+        OPCUA::THistorySample sample;
+        sample.Time = time;
+        sample.Value = value;
+        return sample;
+    }
+}
+
+TEST(THistoryBufferTest, ring)
+{
+    OPCUA::THistoryBuffer buffer(3);
+    ASSERT_EQ(0, buffer.GetOldestTime());
+
+    for (int i = 1; i <= 5; ++i) {
+        buffer.Add(MakeSample(i * UA_DATETIME_SEC, i));
+    }
+    ASSERT_EQ(3 * UA_DATETIME_SEC, buffer.GetOldestTime());
+
+    std::vector<OPCUA::THistorySample> samples;
+    buffer.Read(0, 4 * UA_DATETIME_SEC, samples);
+    ASSERT_EQ(2, samples.size());
+    ASSERT_DOUBLE_EQ(3, samples[0].Value);
+    ASSERT_DOUBLE_EQ(4, samples[1].Value);
+}
+
+TEST(THistoryFileTest, flush_and_read)
+{
+    auto dir = std::filesystem::temp_directory_path() / ("wb-mqtt-opcua-history-test-" + std::to_string(getpid()));
+    std::filesystem::remove_all(dir);
+    auto now = UA_DateTime_now();
+    {
+        OPCUA::THistoryFile file(dir.string(), std::chrono::hours(24));
+        file.Add("dev/a", MakeSample(now, 1));
+        file.Add("dev/b", MakeSample(now + 1, 2));
+        file.Flush();
+        file.Add("dev/a", MakeSample(now + 2, 3));
+
+        // Not flushed samples are read too
+        std::vector<OPCUA::THistorySample> samples;
+        file.Read("dev/a", now, now + 2, samples);
+        ASSERT_EQ(2, samples.size());
+        ASSERT_DOUBLE_EQ(1, samples[0].Value);
+        ASSERT_DOUBLE_EQ(3, samples[1].Value);
+        file.Flush();
+    }
+
+    // Segments of the previous run are read after restart
+    OPCUA::THistoryFile file(dir.string(), std::chrono::hours(24));
+    std::vector<OPCUA::THistorySample> samples;
+    file.Read("dev/b", 0, now + UA_DATETIME_SEC, samples);
+    ASSERT_EQ(1, samples.size());
+    ASSERT_DOUBLE_EQ(2, samples[0].Value);
+    ASSERT_EQ(now + 1, samples[0].Time);
+
+    std::filesystem::remove_all(dir);
+}
+
+// Samples are buffered before flushing, so a segment keeps samples received before its start
+TEST(THistoryFileTest, samples_before_segment_start)
+{
+    auto dir = std::filesystem::temp_directory_path() / ("wb-mqtt-opcua-history-test-" + std::to_string(getpid()));
+    std::filesystem::remove_all(dir);
+    auto time = UA_DateTime_now() - 3600 * UA_DATETIME_SEC;
+    {
+        OPCUA::THistoryFile file(dir.string(), std::chrono::hours(24));
+        file.Add("dev/a", MakeSample(time, 1));
+        file.Flush();
+
+        std::vector<OPCUA::THistorySample> samples;
+        file.Read("dev/a", time - UA_DATETIME_SEC, time + UA_DATETIME_SEC, samples);
+        ASSERT_EQ(1, samples.size());
+    }
+
+    OPCUA::THistoryFile file(dir.string(), std::chrono::hours(24));
+    std::vector<OPCUA::THistorySample> samples;
+    file.Read("dev/a", time - UA_DATETIME_SEC, time + UA_DATETIME_SEC, samples);
+    ASSERT_EQ(1, samples.size());
+    ASSERT_DOUBLE_EQ(1, samples[0].Value);
+
+    std::filesystem::remove_all(dir);
+}
+
+// Every group gets its own directory inside the storage directory
+TEST(THistoryStorageTest, group_dirs)
+{
+    auto dir = std::filesystem::temp_directory_path() / ("wb-mqtt-opcua-storage-test-" + std::to_string(getpid()));
+    std::filesystem::remove_all(dir);
+    {
+        OPCUA::THistoryStorage storage(dir.string(), std::chrono::hours(1));
+        const std::vector<std::string> names{"Room 1", "Room_1", ".", "..", "Дом", "Сад", std::string(300, 'a')};
+        std::vector<OPCUA::THistoryFile*> files;
+        for (const auto& name: names) {
+            files.push_back(storage.GetFile(name, std::chrono::hours(24)));
+        }
+        ASSERT_EQ(files[0], storage.GetFile("Room 1", std::chrono::hours(48)));
+        ASSERT_THROW(storage.GetFile("", std::chrono::hours(24)), std::runtime_error);
+
+        size_t count = 0;
+        for (const auto& entry: std::filesystem::directory_iterator(dir)) {
+            ASSERT_TRUE(entry.is_directory());
+            ASSERT_LE(entry.path().filename().string().size(), 255);
+            ++count;
+        }
+        ASSERT_EQ(files.size(), count);
+    }
+    std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,46 @@
+#include "latency.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+TEST(TLatencyHistogramTest, percentiles)
+{
+    OPCUA::TLatencyHistogram histogram;
+    ASSERT_EQ(0, histogram.GetPercentileUs(50));
+
+    for (size_t i = 0; i < 90; ++i) {
+        histogram.Add(microseconds(3));
+    }
+    for (size_t i = 0; i < 10; ++i) {
+        histogram.Add(microseconds(1000));
+    }
+    ASSERT_EQ(100, histogram.GetCount());
+    ASSERT_EQ(4, histogram.GetPercentileUs(50));
+    ASSERT_EQ(1024, histogram.GetPercentileUs(99));
+    ASSERT_EQ("count=100 mean_us=102 p50_us=4 p90_us=1024 p99_us=1024 max_us=1000", histogram.ToString());
+}
+
+TEST(TLatencyHistogramTest, concurrent_add)
+{
+    const size_t THREADS_COUNT = 4;
+    const size_t ITERATIONS = 10000;
+
+    OPCUA::TLatencyHistogram histogram;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < THREADS_COUNT; ++i) {
+        threads.emplace_back([&]() {
+            for (size_t j = 0; j < ITERATIONS; ++j) {
+                histogram.Add(microseconds(j));
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    ASSERT_EQ(THREADS_COUNT * ITERATIONS, histogram.GetCount());
+    ASSERT_EQ(16384, histogram.GetPercentileUs(100));
+}
@@ -0,0 +1,78 @@
+#include "load_governor.h"
+
+#include <gtest/gtest.h>
+
+namespace
+{
+    const auto PERIOD = std::chrono::milliseconds(1000);
+
+    class TLoadGovernorTest: public testing::Test
+    {
+    protected:
+        OPCUA::TLoadGovernor Governor{PERIOD, std::chrono::milliseconds(100), 90, 50, 10};
+        std::chrono::steady_clock::time_point Now = std::chrono::steady_clock::now();
+        OPCUA::TCpuTimes Cpu{1000, 10000};
+
+        //! Advances time by the period plus lag and CPU times by 100 ticks with cpuLoad percents busy
+        bool Update(std::chrono::milliseconds lag, uint64_t cpuLoad)
+        {
+            Now += PERIOD + lag;
+            Cpu.Busy += cpuLoad;
+            Cpu.Total += 100;
+            return Governor.Update(Now, Cpu);
+        }
+    };
+}
+
+TEST_F(TLoadGovernorTest, configured_intervals)
+{
+    ASSERT_FALSE(Governor.Update(Now, Cpu));
+    ASSERT_FALSE(Update(std::chrono::milliseconds(0), 50));
+    ASSERT_EQ(1, Governor.GetFactor());
+    ASSERT_DOUBLE_EQ(50, Governor.GetMinSamplingInterval());
+    ASSERT_DOUBLE_EQ(10, Governor.GetMinPublishingInterval());
+}
+
+TEST_F(TLoadGovernorTest, loop_lag)
+{
+    Governor.Update(Now, Cpu);
+    ASSERT_TRUE(Update(std::chrono::milliseconds(500), 10));
+    ASSERT_EQ(2, Governor.GetFactor());
+    ASSERT_DOUBLE_EQ(200, Governor.GetMinSamplingInterval());
+    ASSERT_DOUBLE_EQ(200, Governor.GetMinPublishingInterval());
+}
+
+TEST_F(TLoadGovernorTest, cpu_load)
+{
+    Governor.Update(Now, Cpu);
+    for (uint32_t factor = 2; factor <= OPCUA::TLoadGovernor::MAX_FACTOR; factor *= 2) {
+        ASSERT_TRUE(Update(std::chrono::milliseconds(0), 95));
+        ASSERT_EQ(factor, Governor.GetFactor());
+    }
+    ASSERT_FALSE(Update(std::chrono::milliseconds(0), 95));
+    ASSERT_EQ(OPCUA::TLoadGovernor::MAX_FACTOR, Governor.GetFactor());
+}
+
+TEST_F(TLoadGovernorTest, recovery)
+{
+    Governor.Update(Now, Cpu);
+    Update(std::chrono::milliseconds(0), 100);
+    Update(std::chrono::milliseconds(0), 100);
+    ASSERT_EQ(4, Governor.GetFactor());
+
+    // Load near the limit doesn't lower the intervals
+    for (uint32_t i = 0; i < OPCUA::TLoadGovernor::CALM_PERIODS * 2; ++i) {
+        ASSERT_FALSE(Update(std::chrono::milliseconds(0), 85));
+    }
+    for (uint32_t i = 1; i < OPCUA::TLoadGovernor::CALM_PERIODS; ++i) {
+        ASSERT_FALSE(Update(std::chrono::milliseconds(0), 10));
+    }
+    ASSERT_TRUE(Update(std::chrono::milliseconds(0), 10));
+    ASSERT_EQ(2, Governor.GetFactor());
+    for (uint32_t i = 1; i < OPCUA::TLoadGovernor::CALM_PERIODS; ++i) {
+        ASSERT_FALSE(Update(std::chrono::milliseconds(0), 10));
+    }
+    ASSERT_TRUE(Update(std::chrono::milliseconds(0), 10));
+    ASSERT_EQ(1, Governor.GetFactor());
+    ASSERT_DOUBLE_EQ(50, Governor.GetMinSamplingInterval());
+}
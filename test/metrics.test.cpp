@@ -0,0 +1,48 @@
+#include "metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+TEST(TMetricsTest, counters_of_exited_threads)
+{
+    const size_t THREADS_COUNT = 4;
+    const size_t ITERATIONS = 10000;
+
+    auto before = OPCUA::Metrics::Collect();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < THREADS_COUNT; ++i) {
+        threads.emplace_back([]() {
+            for (size_t j = 0; j < ITERATIONS; ++j) {
+                OPCUA::Metrics::Add(OPCUA::TCounter::Events);
+            }
+            OPCUA::Metrics::Add(OPCUA::TCounter::MutexWaitUs, 10);
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    OPCUA::Metrics::Add(OPCUA::TCounter::Events);
+    auto after = OPCUA::Metrics::Collect();
+
+    auto delta = [&](OPCUA::TCounter counter) {
+        auto i = static_cast<size_t>(counter);
+        return after[i] - before[i];
+    };
+    ASSERT_EQ(THREADS_COUNT * ITERATIONS + 1, delta(OPCUA::TCounter::Events));
+    ASSERT_EQ(THREADS_COUNT * 10, delta(OPCUA::TCounter::MutexWaitUs));
+    ASSERT_EQ(0, delta(OPCUA::TCounter::Writes));
+}
+
+TEST(TMetricsTest, rss)
+{
+    ASSERT_GT(OPCUA::Metrics::GetRssKb(), 0);
+}
+
+TEST(TMetricsTest, cpu_times)
+{
+    auto cpu = OPCUA::Metrics::GetCpuTimes();
+    ASSERT_GT(cpu.Total, 0);
+    ASSERT_LE(cpu.Busy, cpu.Total);
+}
@@ -0,0 +1,54 @@
+#include "pending_pushes.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <thread>
+
+TEST(TPendingPushesTest, empty)
+{
+    OPCUA::TPendingPushes pushes;
+    std::vector<std::string> snapshots;
+    ASSERT_FALSE(pushes.Take(snapshots));
+    ASSERT_TRUE(snapshots.empty());
+}
+
+TEST(TPendingPushesTest, coalesce)
+{
+    OPCUA::TPendingPushes pushes;
+    // Only the first pending group wakes the server thread up
+    ASSERT_TRUE(pushes.AddSnapshot("dev1"));
+    ASSERT_FALSE(pushes.AddSnapshot("dev2"));
+    ASSERT_FALSE(pushes.AddSnapshot("dev1"));
+
+    std::vector<std::string> snapshots;
+    ASSERT_TRUE(pushes.Take(snapshots));
+    std::sort(snapshots.begin(), snapshots.end());
+    ASSERT_EQ((std::vector<std::string>{"dev1", "dev2"}), snapshots);
+
+    ASSERT_FALSE(pushes.Take(snapshots));
+    ASSERT_TRUE(pushes.AddSnapshot("dev2"));
+    ASSERT_TRUE(pushes.Take(snapshots));
+    ASSERT_EQ((std::vector<std::string>{"dev2"}), snapshots);
+}
+
+TEST(TPendingPushesTest, threads)
+{
+    OPCUA::TPendingPushes pushes;
+    const size_t count = 10000;
+    std::thread producer([&]() {
+        for (size_t i = 0; i < count; ++i) {
+            pushes.AddSnapshot("dev" + std::to_string(i));
+        }
+    });
+    size_t taken = 0;
+    std::vector<std::string> snapshots;
+    while (taken < count) {
+        if (pushes.Take(snapshots)) {
+            taken += snapshots.size();
+        }
+    }
+    producer.join();
+    ASSERT_EQ(count, taken);
+    ASSERT_FALSE(pushes.Take(snapshots));
+}
@@ -0,0 +1,286 @@
+#include "OPCUAServer.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <wblib/testing/fake_mqtt.h>
+#include <wblib/testing/testlog.h>
+
+using namespace WBMQTT;
+
+namespace
+{
+    typedef std::chrono::steady_clock TClock;
+
+    const uint16_t PORT = 48610;
+    const uint16_t BIND_PORT = 48620;
+    const char* MULTICAST_GROUP = "224.0.0.22";
+    const char* LOOPBACK = "127.0.0.1";
+    const uint16_t WRITER_ID = 5;
+    const auto MESSAGE_TIMEOUT = std::chrono::seconds(2);
+
+    //! UDP socket joined to the multicast group on loopback, as a PubSub subscriber
+    class TSubscriber
+    {
+    public:
+        TSubscriber(): Socket(socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0))
+        {
+            int reuse = 1;
+            setsockopt(Socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(PORT);
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            bind(Socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+            ip_mreq membership{};
+            inet_pton(AF_INET, MULTICAST_GROUP, &membership.imr_multiaddr);
+            inet_pton(AF_INET, LOOPBACK, &membership.imr_interface);
+            setsockopt(Socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership));
+        }
+
+        ~TSubscriber()
+        {
+            close(Socket);
+        }
+
+        TSubscriber(const TSubscriber&) = delete;
+        TSubscriber& operator=(const TSubscriber&) = delete;
+
+        //! Waits for a datagram until the deadline, returns false if there is none
+        bool Receive(std::vector<uint8_t>& datagram, TClock::time_point deadline)
+        {
+            pollfd fd{Socket, POLLIN, 0};
+            while (TClock::now() < deadline) {
+                if (poll(&fd, 1, 10) <= 0) {
+                    continue;
+                }
+                datagram.resize(65536);
+                auto size = recv(Socket, datagram.data(), datagram.size(), 0);
+                if (size > 0) {
+                    datagram.resize(size);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        int Socket;
+    };
+
+    //! Little-endian reader of UADP fields, fails instead of reading past the end
+    class TUadpReader
+    {
+    public:
+        explicit TUadpReader(const std::vector<uint8_t>& data): Data(data)
+        {}
+
+        bool Skip(size_t size)
+        {
+            if (Data.size() - Offset < size) {
+                return false;
+            }
+            Offset += size;
+            return true;
+        }
+
+        template<class T> bool Read(T& value)
+        {
+            if (Data.size() - Offset < sizeof(T)) {
+                return false;
+            }
+            value = 0;
+            for (size_t i = 0; i < sizeof(T); ++i) {
+                value |= static_cast<T>(Data[Offset + i]) << (8 * i);
+            }
+            Offset += sizeof(T);
+            return true;
+        }
+
+    private:
+        const std::vector<uint8_t>& Data;
+        size_t Offset = 0;
+    };
+
+    //! Headers of a UADP NetworkMessage and its first DataSetMessage
+    struct TUadpMessage
+    {
+        uint16_t WriterGroupId = 0;
+        std::vector<uint16_t> DataSetWriterIds;
+        bool KeyFrame = false;
+        uint16_t FieldCount = 0;
+    };
+
+    //! Parses an unsigned, unchunked UADP message, see OPC UA Part 14, 7.2.2
+    bool ParseUadp(const std::vector<uint8_t>& datagram, TUadpMessage& message)
+    {
+        TUadpReader reader(datagram);
+        uint8_t flags = 0;
+        uint8_t extendedFlags1 = 0;
+        uint8_t extendedFlags2 = 0;
+        if (!reader.Read(flags) || (flags & 0x0F) != 1) {
+            return false;
+        }
+        if ((flags & 0x80) && !reader.Read(extendedFlags1)) {
+            return false;
+        }
+        if ((extendedFlags1 & 0x80) && !reader.Read(extendedFlags2)) {
+            return false;
+        }
+        // Security, chunks, promoted fields and discovery messages are not used by the gateway
+        if ((extendedFlags1 & 0x10) || (extendedFlags2 & 0x1F)) {
+            return false;
+        }
+        if (flags & 0x10) {
+            const size_t publisherIdSizes[] = {1, 2, 4, 8};
+            auto type = extendedFlags1 & 0x07;
+            if (type == 4) {
+                uint32_t length = 0;
+                if (!reader.Read(length) || !reader.Skip(length)) {
+                    return false;
+                }
+            } else if (type > 3 || !reader.Skip(publisherIdSizes[type])) {
+                return false;
+            }
+        }
+        if ((extendedFlags1 & 0x08) && !reader.Skip(16)) {
+            return false;
+        }
+        if (flags & 0x20) {
+            uint8_t groupFlags = 0;
+            if (!reader.Read(groupFlags)) {
+                return false;
+            }
+            if ((groupFlags & 0x01) && !reader.Read(message.WriterGroupId)) {
+                return false;
+            }
+            if ((groupFlags & 0x02) && !reader.Skip(4)) {
+                return false;
+            }
+            if ((groupFlags & 0x04) && !reader.Skip(2)) {
+                return false;
+            }
+            if ((groupFlags & 0x08) && !reader.Skip(2)) {
+                return false;
+            }
+        }
+        uint8_t count = 1;
+        if (flags & 0x40) {
+            if (!reader.Read(count)) {
+                return false;
+            }
+            message.DataSetWriterIds.resize(count);
+            for (auto& id: message.DataSetWriterIds) {
+                if (!reader.Read(id)) {
+                    return false;
+                }
+            }
+        }
+        if ((extendedFlags1 & 0x20) && !reader.Skip(8)) {
+            return false;
+        }
+        if ((extendedFlags1 & 0x40) && !reader.Skip(2)) {
+            return false;
+        }
+        // Sizes of DataSetMessages
+        if (count > 1 && !reader.Skip(2 * count)) {
+            return false;
+        }
+
+        uint8_t dataSetFlags1 = 0;
+        uint8_t dataSetFlags2 = 0;
+        if (!reader.Read(dataSetFlags1)) {
+            return false;
+        }
+        if ((dataSetFlags1 & 0x80) && !reader.Read(dataSetFlags2)) {
+            return false;
+        }
+        const std::pair<bool, size_t> optionalFields[] = {{(dataSetFlags1 & 0x08) != 0, 2},
+                                                          {(dataSetFlags2 & 0x10) != 0, 8},
+                                                          {(dataSetFlags2 & 0x20) != 0, 2},
+                                                          {(dataSetFlags1 & 0x10) != 0, 2},
+                                                          {(dataSetFlags1 & 0x20) != 0, 4},
+                                                          {(dataSetFlags1 & 0x40) != 0, 4}};
+        for (const auto& field: optionalFields) {
+            if (field.first && !reader.Skip(field.second)) {
+                return false;
+            }
+        }
+        // RawData key frames have no field count
+        message.KeyFrame = (dataSetFlags2 & 0x0F) == 0;
+        if (message.KeyFrame && ((dataSetFlags1 >> 1) & 0x03) == 1) {
+            return false;
+        }
+        return reader.Read(message.FieldCount);
+    }
+}
+
+class TPubSubTest: public Testing::TLoggedFixture
+{
+protected:
+    // The test checks UADP messages, MQTT traffic is not compared with reference logs
+    void TearDown() override
+    {}
+};
+
+// A published group is sent as a UADP message with the writer id of the group and a field per control
+TEST_F(TPubSubTest, uadp_message)
+{
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto driver =
+        NewDriver(TDriverArgs{}.SetId("test-pubsub").SetBackend(NewDriverBackend(mqttBroker->MakeClient("test"))));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    OPCUA::TServerConfig config;
+    config.BindPort = BIND_PORT;
+    config.PubSubAddress = std::string("opc.udp://") + MULTICAST_GROUP + ":" + std::to_string(PORT) + "/";
+    config.PubSubInterface = LOOPBACK;
+    config.PubSubInterval = std::chrono::milliseconds(20);
+    for (const auto& nodeName: {"test/a", "test/b", "test/c"}) {
+        OPCUA::TVariableNodeConfig variableNode{nodeName};
+        variableNode.PubSubWriterId = WRITER_ID;
+        config.ObjectNodes["test"].push_back(variableNode);
+    }
+    config.ObjectNodes["other"].push_back(OPCUA::TVariableNodeConfig{"test/d"});
+
+    TSubscriber subscriber;
+    auto server = std::make_unique<OPCUA::TServerImpl>(config, driver);
+
+    std::vector<uint8_t> datagram;
+    std::vector<TUadpMessage> messages;
+    auto deadline = TClock::now() + MESSAGE_TIMEOUT;
+    while (subscriber.Receive(datagram, deadline)) {
+        TUadpMessage message;
+        ASSERT_TRUE(ParseUadp(datagram, message));
+        messages.push_back(message);
+        if (message.KeyFrame) {
+            break;
+        }
+    }
+    server.reset();
+    driver->StopLoop();
+    if (messages.empty()) {
+        GTEST_SKIP() << "Multicast on loopback is not available";
+    }
+
+    // Only the group with the writer id is published
+    for (const auto& message: messages) {
+        ASSERT_EQ(WRITER_ID, message.WriterGroupId);
+        ASSERT_EQ(std::vector<uint16_t>{WRITER_ID}, message.DataSetWriterIds);
+    }
+    ASSERT_TRUE(messages.back().KeyFrame);
+    ASSERT_EQ(3, messages.back().FieldCount);
+}
@@ -3,6 +3,21 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include <unistd.h>
+
+#include <open62541/client_config_default.h>
+#include <open62541/client_highlevel.h>
+
 #include <wblib/json_utils.h>
 #include <wblib/testing/fake_driver.h>
 #include <wblib/testing/fake_mqtt.h>
@@ -19,13 +34,187 @@ namespace
         {}
 
     protected:
-        void CreateVariableNode(const UA_NodeId& parentNodeId,
-                                const std::string& nodeName,
-                                WBMQTT::PControl control) override
+        void SetupVariableNode(OPCUA::TVariableNodeSlot& slot) override
         {
-            throw std::runtime_error("forced CreateVariableNode failure");
+            throw std::runtime_error("forced SetupVariableNode failure");
         }
     };
+
+    class TInspectableServer: public OPCUA::TServerImpl
+    {
+    public:
+        TInspectableServer(const OPCUA::TServerConfig& config, WBMQTT::PDeviceDriver driver)
+            : TServerImpl(config, driver)
+        {}
+
+        using TServerImpl::FindVariableNodeSlot;
+        using TServerImpl::GetServerInstance;
+    };
+
+    //! Reads numeric value of the variable node from the server instance, NaN if it has no numeric value
+    double ReadNumber(UA_Server* server, const std::string& nodeName)
+    {
+        UA_Variant variant;
+        UA_Variant_init(&variant);
+        OPCUA::TWriteValue value;
+        auto res = UA_Server_readValue(server, UA_NODEID_STRING(1, (char*)nodeName.c_str()), &variant);
+        if (res != UA_STATUSCODE_GOOD || !OPCUA::GetWriteValue(value, OPCUA::TValueKind::Double, variant) ||
+            !std::holds_alternative<double>(value))
+        {
+            value = std::numeric_limits<double>::quiet_NaN();
+        }
+        UA_Variant_clear(&variant);
+        return std::get<double>(value);
+    }
+
+    //! Reads status of the variable node value from the server instance
+    UA_StatusCode ReadStatus(UA_Server* server, const std::string& nodeName)
+    {
+        UA_ReadValueId item;
+        UA_ReadValueId_init(&item);
+        item.nodeId = UA_NODEID_STRING(1, (char*)nodeName.c_str());
+        item.attributeId = UA_ATTRIBUTEID_VALUE;
+        auto dataValue = UA_Server_read(server, &item, UA_TIMESTAMPSTORETURN_NEITHER);
+        auto res = dataValue.hasStatus ? dataValue.status : UA_STATUSCODE_GOOD;
+        UA_DataValue_clear(&dataValue);
+        return res;
+    }
+
+    //! Sets value and error of the local control and passes the value event to the server
+    void SetControlValue(PDeviceDriver driver,
+                         OPCUA::TServerImpl& server,
+                         PControl control,
+                         const std::string& value,
+                         const std::string& error = "")
+    {
+        {
+            auto tx = driver->BeginTx();
+            control->SetError(tx, error).Sync();
+            control->SetRawValue(tx, value).Sync();
+        }
+        server.ControlValueEventCallback(TControlValueEvent(control, value));
+    }
+
+    //! Reads numeric elements of the snapshot node array, NaN for empty elements
+    std::vector<double> ReadSnapshot(UA_Server* server, const std::string& nodeName)
+    {
+        UA_Variant variant;
+        UA_Variant_init(&variant);
+        std::vector<double> res;
+        if (UA_Server_readValue(server, UA_NODEID_STRING(1, (char*)nodeName.c_str()), &variant) ==
+                UA_STATUSCODE_GOOD &&
+            variant.type == &UA_TYPES[UA_TYPES_VARIANT])
+        {
+            for (size_t i = 0; i < variant.arrayLength; ++i) {
+                OPCUA::TWriteValue value;
+                const auto& item = static_cast<const UA_Variant*>(variant.data)[i];
+                if (OPCUA::GetWriteValue(value, OPCUA::TValueKind::Double, item) &&
+                    std::holds_alternative<double>(value))
+                {
+                    res.push_back(std::get<double>(value));
+                } else {
+                    res.push_back(std::numeric_limits<double>::quiet_NaN());
+                }
+            }
+        }
+        UA_Variant_clear(&variant);
+        return res;
+    }
+
+    //! Waits for the snapshot node to be rebuilt by a server thread, NaN matches empty elements
+    bool WaitForSnapshot(UA_Server* server, const std::string& nodeName, const std::vector<double>& expected)
+    {
+        auto same = [](double a, double b) { return a == b || (std::isnan(a) && std::isnan(b)); };
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (std::chrono::steady_clock::now() < deadline) {
+            auto values = ReadSnapshot(server, nodeName);
+            if (std::equal(values.begin(), values.end(), expected.begin(), expected.end(), same)) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return false;
+    }
+
+    struct THistoryPage
+    {
+        UA_StatusCode Status;
+        std::vector<double> Values;
+        std::vector<UA_DateTime> Times;
+        std::string ContinuationPoint;
+    };
+
+    //! Reads raw history of the node from the history database of the server instance, as HistoryRead service does
+    THistoryPage ReadHistoryPage(UA_Server* server,
+                                 const std::string& nodeName,
+                                 const UA_ReadRawModifiedDetails& details,
+                                 const std::string& continuationPoint = std::string(),
+                                 bool releaseContinuationPoints = false)
+    {
+        UA_HistoryReadValueId item;
+        UA_HistoryReadValueId_init(&item);
+        item.nodeId = UA_NODEID_STRING(1, (char*)nodeName.c_str());
+        item.continuationPoint.data = (UA_Byte*)continuationPoint.data();
+        item.continuationPoint.length = continuationPoint.size();
+
+        UA_HistoryReadResult result;
+        UA_HistoryReadResult_init(&result);
+        UA_HistoryReadResponse response;
+        UA_HistoryReadResponse_init(&response);
+        response.results = &result;
+        response.resultsSize = 1;
+        UA_HistoryData data;
+        UA_HistoryData_init(&data);
+        UA_HistoryData* historyData = &data;
+
+        auto& database = UA_Server_getConfig(server)->historyDatabase;
+        database.readRaw(server,
+                         database.context,
+                         nullptr,
+                         nullptr,
+                         nullptr,
+                         &details,
+                         UA_TIMESTAMPSTORETURN_SOURCE,
+                         releaseContinuationPoints,
+                         1,
+                         &item,
+                         &response,
+                         &historyData);
+
+        THistoryPage page;
+        page.Status = result.statusCode;
+        page.ContinuationPoint.assign((const char*)result.continuationPoint.data, result.continuationPoint.length);
+        for (size_t i = 0; i < data.dataValuesSize; ++i) {
+            page.Values.push_back(*static_cast<const UA_Double*>(data.dataValues[i].value.data));
+            page.Times.push_back(data.dataValues[i].sourceTimestamp);
+        }
+        UA_HistoryData_clear(&data);
+        UA_HistoryReadResult_clear(&result);
+        return page;
+    }
+
+    //! Writes the number into the node through a client session, returns the status of the write
+    UA_StatusCode ClientWriteNumber(uint16_t port, const std::string& nodeName, UA_Double number)
+    {
+        auto client = UA_Client_new();
+        UA_ClientConfig_setDefault(UA_Client_getConfig(client));
+        auto url = "opc.tcp://localhost:" + std::to_string(port);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        auto res = UA_Client_connect(client, url.c_str());
+        // The server thread starts listening in background
+        while (res != UA_STATUSCODE_GOOD && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            res = UA_Client_connect(client, url.c_str());
+        }
+        if (res == UA_STATUSCODE_GOOD) {
+            UA_Variant value;
+            UA_Variant_setScalar(&value, &number, &UA_TYPES[UA_TYPES_DOUBLE]);
+            res = UA_Client_writeValueAttribute(client, UA_NODEID_STRING(1, (char*)nodeName.c_str()), &value);
+        }
+        UA_Client_disconnect(client);
+        UA_Client_delete(client);
+        return res;
+    }
 }
 
 class TServerTest: public Testing::TLoggedFixture
@@ -41,6 +230,14 @@ protected:
     }
 };
 
+//! Tests of node values, MQTT traffic isn't compared with reference logs
+class TServerBehaviorTest: public TServerTest
+{
+protected:
+    void TearDown() override
+    {}
+};
+
 // Check that server control map contains the control after MQTT driver callback.
 // Control added to the map when OPC UA nodes are created.
 TEST_F(TServerTest, control)
@@ -61,11 +258,12 @@ TEST_F(TServerTest, control)
     tx->End();
 
     auto server = std::make_unique<OPCUA::TServerImpl>(config.OpcUa, driver);
+    driver->WaitForReady();
     server->ControlValueEventCallback(TControlValueEvent(control, std::to_string(0)));
     ASSERT_EQ(control, server->GetControl("test/test"));
 }
 
-TEST_F(TServerTest, control_rollback_on_create_variable_node_failure)
+TEST_F(TServerTest, control_rollback_on_setup_variable_node_failure)
 {
     TConfig config;
     LoadConfig(config, testRootDir + "/bad/wb-mqtt-opcua.conf", schemaFile);
@@ -83,7 +281,430 @@ TEST_F(TServerTest, control_rollback_on_create_variable_node_failure)
     tx->End();
 
     auto server = std::make_unique<TFailingServer>(config.OpcUa, driver);
+    driver->WaitForReady();
 
     ASSERT_NO_THROW(server->ControlValueEventCallback(TControlValueEvent(control, std::to_string(0))));
     ASSERT_EQ(nullptr, server->GetControl("test/test"));
 }
+
+// Check that variable nodes are created at startup for configured controls, including ones absent in MQTT
+TEST_F(TServerTest, eager_nodes)
+{
+    TConfig config;
+    LoadConfig(config, testRootDir + "/bad/wb-mqtt-opcua.conf", schemaFile);
+    config.OpcUa.ObjectNodes["test"].push_back(OPCUA::TVariableNodeConfig{"test/missing"});
+
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto mqttClient = mqttBroker->MakeClient("test");
+    auto backend = NewDriverBackend(mqttClient);
+    auto driver = NewDriver(TDriverArgs{}.SetId("test").SetBackend(backend));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    auto tx = driver->BeginTx();
+    auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId("test")).GetValue();
+    auto control = device->CreateControl(tx, TControlArgs{}.SetId("test").SetType("value")).GetValue();
+    tx->End();
+
+    auto server = std::make_unique<TInspectableServer>(config.OpcUa, driver);
+    driver->WaitForReady();
+    server->ControlValueEventCallback(TControlValueEvent(control, std::to_string(0)));
+
+    auto slot = server->FindVariableNodeSlot("test/test");
+    ASSERT_NE(nullptr, slot);
+    ASSERT_TRUE(slot->NodeCreated);
+    ASSERT_TRUE(slot->Materialized);
+
+    auto missingSlot = server->FindVariableNodeSlot("test/missing");
+    ASSERT_NE(nullptr, missingSlot);
+    ASSERT_TRUE(missingSlot->NodeCreated);
+    ASSERT_FALSE(server->ControlExists("test/missing"));
+
+    UA_DataValue dataValue;
+    UA_DataValue_init(&dataValue);
+    server->ReadVariable(*missingSlot, &dataValue);
+    ASSERT_TRUE(dataValue.hasStatus);
+    ASSERT_EQ(UA_STATUSCODE_UNCERTAININITIALVALUE, dataValue.status);
+    UA_DataValue_clear(&dataValue);
+}
+
+// Check that reload adds and removes only changed nodes and keeps the unchanged ones
+TEST_F(TServerTest, reload)
+{
+    TConfig config;
+    LoadConfig(config, testRootDir + "/bad/wb-mqtt-opcua.conf", schemaFile);
+
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto mqttClient = mqttBroker->MakeClient("test");
+    auto backend = NewDriverBackend(mqttClient);
+    auto driver = NewDriver(TDriverArgs{}.SetId("test").SetBackend(backend));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    auto tx = driver->BeginTx();
+    auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId("test")).GetValue();
+    auto control = device->CreateControl(tx, TControlArgs{}.SetId("test").SetType("value")).GetValue();
+    tx->End();
+
+    auto server = std::make_unique<TInspectableServer>(config.OpcUa, driver);
+    driver->WaitForReady();
+    server->ControlValueEventCallback(TControlValueEvent(control, std::to_string(0)));
+    auto slot = server->FindVariableNodeSlot("test/test");
+    ASSERT_NE(nullptr, slot);
+
+    auto objectNodes = config.OpcUa.ObjectNodes;
+    objectNodes["test"].push_back(OPCUA::TVariableNodeConfig{"test/missing"});
+    server->Reload(objectNodes);
+    ASSERT_EQ(slot, server->FindVariableNodeSlot("test/test"));
+    ASSERT_TRUE(slot->Materialized);
+    ASSERT_EQ(control, server->GetControl("test/test"));
+    auto missingSlot = server->FindVariableNodeSlot("test/missing");
+    ASSERT_NE(nullptr, missingSlot);
+    ASSERT_TRUE(missingSlot->NodeCreated);
+
+    server->Reload(config.OpcUa.ObjectNodes);
+    ASSERT_EQ(slot, server->FindVariableNodeSlot("test/test"));
+    ASSERT_EQ(nullptr, server->FindVariableNodeSlot("test/missing"));
+    ASSERT_EQ(control, server->GetControl("test/test"));
+
+    // A changed deadband replaces the slot, the node is recreated with the same id
+    objectNodes = config.OpcUa.ObjectNodes;
+    objectNodes["test"].front().AbsoluteDeadband = 1;
+    server->Reload(objectNodes);
+    auto replacedSlot = server->FindVariableNodeSlot("test/test");
+    ASSERT_NE(nullptr, replacedSlot);
+    ASSERT_NE(slot, replacedSlot);
+    ASSERT_TRUE(replacedSlot->NodeCreated);
+    ASSERT_TRUE(replacedSlot->Materialized);
+    ASSERT_EQ(control, server->GetControl("test/test"));
+}
+
+// Values within the deadband aren't pushed, but a change of the error state always is
+TEST_F(TServerBehaviorTest, deadband)
+{
+    TConfig config;
+    LoadConfig(config, testRootDir + "/bad/wb-mqtt-opcua.conf", schemaFile);
+    config.OpcUa.PushValues = true;
+    config.OpcUa.ObjectNodes["test"].front().AbsoluteDeadband = 1;
+
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto driver = NewDriver(TDriverArgs{}.SetId("test").SetBackend(NewDriverBackend(mqttBroker->MakeClient("test"))));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    auto tx = driver->BeginTx();
+    auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId("test")).GetValue();
+    auto control = device->CreateControl(tx, TControlArgs{}.SetId("test").SetType("value")).GetValue();
+    tx->End();
+
+    auto server = std::make_unique<TInspectableServer>(config.OpcUa, driver);
+    driver->WaitForReady();
+    auto instance = server->GetServerInstance(0);
+    SetControlValue(driver, *server, control, "0");
+    ASSERT_EQ(0, ReadNumber(instance, "test/test"));
+
+    SetControlValue(driver, *server, control, "0.5");
+    ASSERT_EQ(0, ReadNumber(instance, "test/test"));
+
+    SetControlValue(driver, *server, control, "1.5");
+    ASSERT_EQ(1.5, ReadNumber(instance, "test/test"));
+    ASSERT_EQ(UA_STATUSCODE_GOOD, ReadStatus(instance, "test/test"));
+
+    SetControlValue(driver, *server, control, "2", "r");
+    ASSERT_EQ(2, ReadNumber(instance, "test/test"));
+    ASSERT_EQ(UA_STATUSCODE_BAD, ReadStatus(instance, "test/test"));
+
+    // The value is within the deadband of the last committed one, the cleared error must reach the node
+    SetControlValue(driver, *server, control, "2.5");
+    ASSERT_EQ(2.5, ReadNumber(instance, "test/test"));
+    ASSERT_EQ(UA_STATUSCODE_GOOD, ReadStatus(instance, "test/test"));
+
+    SetControlValue(driver, *server, control, "3");
+    ASSERT_EQ(2.5, ReadNumber(instance, "test/test"));
+
+    server.reset();
+    driver->StopLoop();
+}
+
+// Values before the in-memory buffer are read from disk, long reads are continued by continuation points
+TEST_F(TServerBehaviorTest, history_read)
+{
+    TConfig config;
+    LoadConfig(config, testRootDir + "/bad/wb-mqtt-opcua.conf", schemaFile);
+    auto historyDir =
+        std::filesystem::temp_directory_path() / ("wb-mqtt-opcua-server-history-test-" + std::to_string(getpid()));
+    std::filesystem::remove_all(historyDir);
+    config.OpcUa.HistoryDir = historyDir.string();
+    config.OpcUa.ObjectNodes["test"].front().HistoryDepth = 2;
+    config.OpcUa.ObjectNodes["test"].front().HistoryRetention = std::chrono::hours(1);
+
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto driver = NewDriver(TDriverArgs{}.SetId("test").SetBackend(NewDriverBackend(mqttBroker->MakeClient("test"))));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    auto tx = driver->BeginTx();
+    auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId("test")).GetValue();
+    auto control = device->CreateControl(tx, TControlArgs{}.SetId("test").SetType("value")).GetValue();
+    tx->End();
+
+    auto server = std::make_unique<TInspectableServer>(config.OpcUa, driver);
+    driver->WaitForReady();
+    auto instance = server->GetServerInstance(0);
+    for (int i = 1; i <= 4; ++i) {
+        SetControlValue(driver, *server, control, std::to_string(i));
+    }
+
+    // The buffer keeps the last two values, older ones are read from disk
+    UA_ReadRawModifiedDetails details;
+    UA_ReadRawModifiedDetails_init(&details);
+    details.startTime = 1;
+    auto page = ReadHistoryPage(instance, "test/test", details);
+    ASSERT_EQ(UA_STATUSCODE_GOOD, page.Status);
+    ASSERT_EQ((std::vector<double>{1, 2, 3, 4}), page.Values);
+    ASSERT_TRUE(page.ContinuationPoint.empty());
+
+    // The range within the buffer is read from memory
+    details.startTime = page.Times[2];
+    page = ReadHistoryPage(instance, "test/test", details);
+    ASSERT_EQ(UA_STATUSCODE_GOOD, page.Status);
+    ASSERT_EQ((std::vector<double>{3, 4}), page.Values);
+
+    details.startTime = 1;
+    details.numValuesPerNode = 3;
+    page = ReadHistoryPage(instance, "test/test", details);
+    ASSERT_EQ(UA_STATUSCODE_GOOD, page.Status);
+    ASSERT_EQ((std::vector<double>{1, 2, 3}), page.Values);
+    ASSERT_FALSE(page.ContinuationPoint.empty());
+    auto continuationPoint = page.ContinuationPoint;
+
+    page = ReadHistoryPage(instance, "test/test", details, continuationPoint);
+    ASSERT_EQ(UA_STATUSCODE_GOOD, page.Status);
+    ASSERT_EQ((std::vector<double>{4}), page.Values);
+    ASSERT_TRUE(page.ContinuationPoint.empty());
+
+    // Continuation points keep no server state, releasing returns no values
+    page = ReadHistoryPage(instance, "test/test", details, continuationPoint, true);
+    ASSERT_EQ(UA_STATUSCODE_GOOD, page.Status);
+    ASSERT_TRUE(page.Values.empty());
+    ASSERT_TRUE(page.ContinuationPoint.empty());
+
+    server.reset();
+    driver->StopLoop();
+    std::filesystem::remove_all(historyDir);
+}
+
+// The snapshot node gets all values of the group in config order after changes of its controls
+TEST_F(TServerBehaviorTest, snapshot)
+{
+    TConfig config;
+    LoadConfig(config, testRootDir + "/bad/wb-mqtt-opcua.conf", schemaFile);
+    config.OpcUa.PushValues = true;
+    auto& group = config.OpcUa.ObjectNodes["test"];
+    group.push_back(OPCUA::TVariableNodeConfig{"test/other"});
+    for (auto& variableNode: group) {
+        variableNode.Snapshot = true;
+    }
+
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto driver = NewDriver(TDriverArgs{}.SetId("test").SetBackend(NewDriverBackend(mqttBroker->MakeClient("test"))));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    auto tx = driver->BeginTx();
+    auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId("test")).GetValue();
+    auto control = device->CreateControl(tx, TControlArgs{}.SetId("test").SetType("value")).GetValue();
+    auto other = device->CreateControl(tx, TControlArgs{}.SetId("other").SetType("value")).GetValue();
+    tx->End();
+
+    auto server = std::make_unique<TInspectableServer>(config.OpcUa, driver);
+    driver->WaitForReady();
+    auto instance = server->GetServerInstance(0);
+    // The control without a value has an empty element
+    SetControlValue(driver, *server, other, "2");
+    ASSERT_TRUE(WaitForSnapshot(instance, "test#Snapshot", {std::numeric_limits<double>::quiet_NaN(), 2}));
+
+    // Several changes before the server thread takes them are written as one snapshot
+    SetControlValue(driver, *server, control, "1");
+    SetControlValue(driver, *server, other, "3");
+    ASSERT_TRUE(WaitForSnapshot(instance, "test#Snapshot", {1, 3}));
+
+    server.reset();
+    driver->StopLoop();
+}
+
+// Check that pushed values don't break control registration and repeated events update existing node
+TEST_F(TServerTest, push_values)
+{
+    TConfig config;
+    LoadConfig(config, testRootDir + "/bad/wb-mqtt-opcua.conf", schemaFile);
+    config.OpcUa.PushValues = true;
+    config.OpcUa.BindPort = 48710;
+    config.OpcUa.ObjectNodes["test"].push_back(OPCUA::TVariableNodeConfig{"test/missing"});
+
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto mqttClient = mqttBroker->MakeClient("test");
+    auto backend = NewDriverBackend(mqttClient);
+    auto driver = NewDriver(TDriverArgs{}.SetId("test").SetBackend(backend));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    auto tx = driver->BeginTx();
+    auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId("test")).GetValue();
+    auto control = device->CreateControl(tx, TControlArgs{}.SetId("test").SetType("value")).GetValue();
+    tx->End();
+
+    auto server = std::make_unique<TInspectableServer>(config.OpcUa, driver);
+    driver->WaitForReady();
+    server->ControlValueEventCallback(TControlValueEvent(control, std::to_string(0)));
+    ASSERT_NO_THROW(server->ControlValueEventCallback(TControlValueEvent(control, std::to_string(1))));
+    ASSERT_EQ(control, server->GetControl("test/test"));
+
+    // The node serves the committed control value
+    auto instance = server->GetServerInstance(0);
+    ASSERT_EQ(0, ReadNumber(instance, "test/test"));
+
+    // A client learns about failed writes: the control is read-only and the other one is missing in MQTT
+    ASSERT_NE(UA_STATUSCODE_GOOD, ClientWriteNumber(config.OpcUa.BindPort, "test/test", 5));
+    ASSERT_EQ(UA_STATUSCODE_BADDEVICEFAILURE, ClientWriteNumber(config.OpcUa.BindPort, "test/missing", 5));
+    ASSERT_EQ(0, ReadNumber(instance, "test/test"));
+}
+
+// Check that every server thread rebuilds pushed snapshots in its own instance
+TEST_F(TServerTest, threads)
+{
+    TConfig config;
+    LoadConfig(config, testRootDir + "/bad/wb-mqtt-opcua.conf", schemaFile);
+    config.OpcUa.Threads = 2;
+    config.OpcUa.PushValues = true;
+    config.OpcUa.LoopLatency = std::chrono::milliseconds(2);
+    config.OpcUa.ObjectNodes["test"].front().Snapshot = true;
+
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto mqttClient = mqttBroker->MakeClient("test");
+    auto backend = NewDriverBackend(mqttClient);
+    auto driver = NewDriver(TDriverArgs{}.SetId("test").SetBackend(backend));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    auto tx = driver->BeginTx();
+    auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId("test")).GetValue();
+    auto control = device->CreateControl(tx, TControlArgs{}.SetId("test").SetType("value")).GetValue();
+    tx->End();
+
+    auto server = std::make_unique<TInspectableServer>(config.OpcUa, driver);
+    driver->WaitForReady();
+    server->ControlValueEventCallback(TControlValueEvent(control, std::to_string(0)));
+    ASSERT_EQ(control, server->GetControl("test/test"));
+    for (size_t i = 0; i < config.OpcUa.Threads; ++i) {
+        ASSERT_EQ(0, ReadNumber(server->GetServerInstance(i), "test/test")) << i;
+        ASSERT_TRUE(WaitForSnapshot(server->GetServerInstance(i), "test#Snapshot", {0})) << i;
+    }
+}
+
+// Check that controls of a configured device which are absent in config don't get OPC UA nodes
+TEST_F(TServerTest, unconfigured_control)
+{
+    TConfig config;
+    LoadConfig(config, testRootDir + "/bad/wb-mqtt-opcua.conf", schemaFile);
+
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto mqttClient = mqttBroker->MakeClient("test");
+    auto backend = NewDriverBackend(mqttClient);
+    auto driver = NewDriver(TDriverArgs{}.SetId("test").SetBackend(backend));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    auto tx = driver->BeginTx();
+    auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId("test")).GetValue();
+    auto control = device->CreateControl(tx, TControlArgs{}.SetId("test").SetType("value")).GetValue();
+    auto unused = device->CreateControl(tx, TControlArgs{}.SetId("unused").SetType("value")).GetValue();
+    tx->End();
+
+    auto server = std::make_unique<OPCUA::TServerImpl>(config.OpcUa, driver);
+    driver->WaitForReady();
+    server->ControlValueEventCallback(TControlValueEvent(unused, std::to_string(0)));
+    server->ControlValueEventCallback(TControlValueEvent(control, std::to_string(0)));
+    ASSERT_EQ(nullptr, server->GetControl("test/unused"));
+    ASSERT_EQ(control, server->GetControl("test/test"));
+}
+
+// Readers of the control registry must always see a consistent control while the MQTT thread
+// publishes, withdraws and replaces it. Replaced controls must be released after readers are gone
+TEST_F(TServerTest, registry_contention)
+{
+    const size_t READERS_COUNT = 4;
+    const size_t WRITER_ITERATIONS = 2000;
+
+    TConfig config;
+    LoadConfig(config, testRootDir + "/bad/wb-mqtt-opcua.conf", schemaFile);
+
+    auto mqttBroker = Testing::NewFakeMqttBroker(*this);
+    auto mqttClient = mqttBroker->MakeClient("test");
+    auto backend = NewDriverBackend(mqttClient);
+    auto driver = NewDriver(TDriverArgs{}.SetId("test").SetBackend(backend));
+    driver->StartLoop();
+    driver->WaitForReady();
+
+    auto tx = driver->BeginTx();
+    auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId("test")).GetValue();
+    auto control = device->CreateControl(tx, TControlArgs{}.SetId("test").SetType("value")).GetValue();
+    auto replacement = device->CreateControl(tx, TControlArgs{}.SetId("test2").SetType("value")).GetValue();
+    tx->End();
+    auto controlUseCount = control.use_count();
+    auto replacementUseCount = replacement.use_count();
+
+    auto server = std::make_unique<TInspectableServer>(config.OpcUa, driver);
+    driver->WaitForReady();
+    server->ControlValueEventCallback(TControlValueEvent(control, std::to_string(0)));
+    auto slot = server->FindVariableNodeSlot("test/test");
+    ASSERT_NE(nullptr, slot);
+
+    std::atomic<bool> stop = false;
+    std::atomic<size_t> badReads = 0;
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < READERS_COUNT; ++i) {
+        readers.emplace_back([&]() {
+            while (!stop) {
+                auto ctrl = slot->Control.load();
+                if (ctrl && ctrl != control.get() && ctrl != replacement.get()) {
+                    ++badReads;
+                }
+                if (server->ControlExists("test/test")) {
+                    UA_DataValue dataValue;
+                    UA_DataValue_init(&dataValue);
+                    server->ReadVariable(*slot, &dataValue);
+                    UA_DataValue_clear(&dataValue);
+                }
+            }
+        });
+    }
+
+    for (size_t i = 0; i < WRITER_ITERATIONS; ++i) {
+        auto& published = (i % 2) ? replacement : control;
+        server->RemoveControl("test/test");
+        server->AddControl("test/test", published);
+        server->ControlValueEventCallback(TControlValueEvent(published, std::to_string(i)));
+    }
+    stop = true;
+    for (auto& reader: readers) {
+        reader.join();
+    }
+
+    // Without readers the replaced control is released at once
+    server->AddControl("test/test", control);
+    ASSERT_EQ(0, badReads);
+    ASSERT_EQ(control, server->GetControl("test/test"));
+    ASSERT_EQ(controlUseCount + 1, control.use_count());
+    ASSERT_EQ(replacementUseCount, replacement.use_count());
+}
+
+TEST(TFilterDeviceIdsTest, controls_of_several_devices)
+{
+    OPCUA::TObjectNodesConfig objectNodes;
+    objectNodes["mixed"].push_back(OPCUA::TVariableNodeConfig{"dev2/c1"});
+    objectNodes["mixed"].push_back(OPCUA::TVariableNodeConfig{"dev1/c1"});
+    objectNodes["dev1"].push_back(OPCUA::TVariableNodeConfig{"dev1/c2"});
+    objectNodes["empty"];
+    ASSERT_EQ((std::vector<std::string>{"dev1", "dev2"}), OPCUA::GetFilterDeviceIds(objectNodes));
+}
@@ -0,0 +1,79 @@
+#include "value_codec.h"
+
+#include <gtest/gtest.h>
+
+TEST(TValueCodecTest, kinds)
+{
+    ASSERT_EQ(OPCUA::TValueKind::Boolean, OPCUA::GetValueKind("switch", 0, 0));
+    ASSERT_EQ(OPCUA::TValueKind::Boolean, OPCUA::GetValueKind("pushbutton", 0, 0));
+    ASSERT_EQ(OPCUA::TValueKind::Boolean, OPCUA::GetValueKind("alarm", 0, 0));
+    ASSERT_EQ(OPCUA::TValueKind::UInt32, OPCUA::GetValueKind("range", 0, 1));
+    ASSERT_EQ(OPCUA::TValueKind::Int32, OPCUA::GetValueKind("range", -10, 1));
+    ASSERT_EQ(OPCUA::TValueKind::Double, OPCUA::GetValueKind("range", 0, 0.1));
+    ASSERT_EQ(OPCUA::TValueKind::Double, OPCUA::GetValueKind("value", 0, 0));
+    ASSERT_EQ(OPCUA::TValueKind::Int64, OPCUA::GetValueKind("value", 0, 1));
+    ASSERT_EQ(OPCUA::TValueKind::Int64, OPCUA::GetValueKind("power_consumption", 0, 1));
+    ASSERT_EQ(OPCUA::TValueKind::Double, OPCUA::GetValueKind("temperature", 0, 0.01));
+    ASSERT_EQ(OPCUA::TValueKind::String, OPCUA::GetValueKind("text", 0, 0));
+    ASSERT_EQ(OPCUA::TValueKind::String, OPCUA::GetValueKind("rgb", 0, 0));
+    ASSERT_EQ(OPCUA::TValueKind::Unknown, OPCUA::GetValueKind("custom", 0, 0));
+}
+
+TEST(TValueCodecTest, parse)
+{
+    double value;
+    ASSERT_TRUE(OPCUA::ParseNumber(OPCUA::TValueKind::Double, "12.5", value));
+    ASSERT_DOUBLE_EQ(12.5, value);
+    ASSERT_TRUE(OPCUA::ParseNumber(OPCUA::TValueKind::Boolean, "1", value));
+    ASSERT_DOUBLE_EQ(1, value);
+    ASSERT_TRUE(OPCUA::ParseNumber(OPCUA::TValueKind::Boolean, "false", value));
+    ASSERT_DOUBLE_EQ(0, value);
+    ASSERT_FALSE(OPCUA::ParseNumber(OPCUA::TValueKind::Double, "", value));
+    ASSERT_FALSE(OPCUA::ParseNumber(OPCUA::TValueKind::Double, "12a", value));
+    ASSERT_FALSE(OPCUA::ParseNumber(OPCUA::TValueKind::Int32, "nan", value));
+}
+
+TEST(TValueCodecTest, encode)
+{
+    OPCUA::TNumberStorage storage;
+    UA_Variant variant;
+
+    OPCUA::SetNumber(variant, OPCUA::TValueKind::Int32, -2.6, storage);
+    ASSERT_EQ(&UA_TYPES[UA_TYPES_INT32], variant.type);
+    ASSERT_EQ(-3, *static_cast<UA_Int32*>(variant.data));
+
+    OPCUA::SetNumber(variant, OPCUA::TValueKind::UInt32, -1, storage);
+    ASSERT_EQ(&UA_TYPES[UA_TYPES_UINT32], variant.type);
+    ASSERT_EQ(0, *static_cast<UA_UInt32*>(variant.data));
+
+    OPCUA::SetNumber(variant, OPCUA::TValueKind::Int64, 3e9, storage);
+    ASSERT_EQ(&UA_TYPES[UA_TYPES_INT64], variant.type);
+    ASSERT_EQ(3000000000, *static_cast<UA_Int64*>(variant.data));
+
+    OPCUA::SetNumber(variant, OPCUA::TValueKind::Boolean, 1, storage);
+    ASSERT_EQ(&UA_TYPES[UA_TYPES_BOOLEAN], variant.type);
+    ASSERT_TRUE(*static_cast<UA_Boolean*>(variant.data));
+
+    OPCUA::SetNumber(variant, OPCUA::TValueKind::Double, 0.5, storage);
+    ASSERT_EQ(&UA_TYPES[UA_TYPES_DOUBLE], variant.type);
+    ASSERT_DOUBLE_EQ(0.5, *static_cast<UA_Double*>(variant.data));
+    ASSERT_EQ(static_cast<void*>(&storage), variant.data);
+}
+
+TEST(TValueCodecTest, write_value)
+{
+    OPCUA::TNumberStorage storage;
+    UA_Variant variant;
+    OPCUA::TWriteValue value;
+
+    OPCUA::SetNumber(variant, OPCUA::TValueKind::Int32, 5, storage);
+    ASSERT_TRUE(OPCUA::GetWriteValue(value, OPCUA::TValueKind::Double, variant));
+    ASSERT_DOUBLE_EQ(5, std::get<double>(value));
+
+    ASSERT_TRUE(OPCUA::GetWriteValue(value, OPCUA::TValueKind::Boolean, variant));
+    ASSERT_TRUE(std::get<bool>(value));
+
+    OPCUA::SetNumber(variant, OPCUA::TValueKind::Double, 2.4, storage);
+    ASSERT_TRUE(OPCUA::GetWriteValue(value, OPCUA::TValueKind::Int32, variant));
+    ASSERT_DOUBLE_EQ(2, std::get<double>(value));
+}
@@ -0,0 +1,455 @@
+#include "OPCUAServer.h"
+#include "write_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include <open62541/client_config_default.h>
+#include <open62541/client_highlevel.h>
+
+#include <wblib/testing/fake_driver.h>
+#include <wblib/testing/fake_mqtt.h>
+#include <wblib/testing/testlog.h>
+
+using namespace WBMQTT;
+
+namespace
+{
+    const auto WAIT_TIMEOUT = std::chrono::seconds(2);
+
+    class TInspectableServer: public OPCUA::TServerImpl
+    {
+    public:
+        TInspectableServer(const OPCUA::TServerConfig& config, WBMQTT::PDeviceDriver driver)
+            : TServerImpl(config, driver)
+        {}
+
+        using TServerImpl::FindVariableNodeSlot;
+        using TServerImpl::GetWriteQueue;
+    };
+
+    OPCUA::TWriteRequest MakeRequest(const PControl& control, double value)
+    {
+        OPCUA::TWriteRequest request;
+        request.NodeName = "test/" + control->GetId();
+        request.Control = control;
+        request.Value = value;
+        return request;
+    }
+
+    //! Waits until the queue worker changes stats as expected
+    bool WaitForStats(const OPCUA::TWriteQueue& queue, const std::function<bool(const OPCUA::TWriteQueueStats&)>& ready)
+    {
+        auto deadline = std::chrono::steady_clock::now() + WAIT_TIMEOUT;
+        while (!ready(queue.GetStats())) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    bool IsEmpty(const OPCUA::TWriteQueueStats& stats)
+    {
+        return stats.Depth == 0;
+    }
+
+    bool IsReady(std::future<UA_StatusCode>& res)
+    {
+        return res.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+}
+
+class TWriteQueueTest: public Testing::TLoggedFixture
+{
+protected:
+    Testing::PFakeMqttBroker MqttBroker;
+    PDeviceDriver Driver;
+    PControl Control;
+    PControl OtherControl;
+
+    void SetUp() override
+    {
+        MqttBroker = Testing::NewFakeMqttBroker(*this);
+        Driver = NewDriver(TDriverArgs{}.SetId("test").SetBackend(NewDriverBackend(MqttBroker->MakeClient("test"))));
+        Driver->StartLoop();
+        Driver->WaitForReady();
+
+        auto tx = Driver->BeginTx();
+        auto device = tx->CreateDevice(TLocalDeviceArgs{}.SetId("test")).GetValue();
+        Control =
+            device->CreateControl(tx, TControlArgs{}.SetId("test").SetType("value").SetReadonly(false)).GetValue();
+        OtherControl =
+            device->CreateControl(tx, TControlArgs{}.SetId("other").SetType("value").SetReadonly(false)).GetValue();
+        tx->End();
+    }
+
+    // The tests check results of write requests, published values are not compared with reference logs
+    void TearDown() override
+    {
+        Driver->StopLoop();
+    }
+
+    //! Server of the "test" group with the writable controls
+    std::unique_ptr<TInspectableServer> MakeServer(OPCUA::TServerConfig& config)
+    {
+        config.ObjectNodes["test"].push_back(OPCUA::TVariableNodeConfig{"test/test"});
+        config.ObjectNodes["test"].push_back(OPCUA::TVariableNodeConfig{"test/other"});
+        auto server = std::make_unique<TInspectableServer>(config, Driver);
+        // Retained values of the filtered devices are loaded after the server starts
+        Driver->WaitForReady();
+        server->ControlValueEventCallback(TControlValueEvent(Control, "0"));
+        server->ControlValueEventCallback(TControlValueEvent(OtherControl, "0"));
+        return server;
+    }
+};
+
+// Requests exceeding the queue size are rejected at once, queued ones are published after the driver is free
+TEST_F(TWriteQueueTest, full_queue)
+{
+    OPCUA::TWriteQueue queue(Driver, 2);
+    std::vector<std::future<UA_StatusCode>> published;
+    {
+        // The driver runs one transaction at a time, so the worker can't publish while it is open
+        auto tx = Driver->BeginTx();
+        published.push_back(queue.Push(MakeRequest(Control, 1)));
+        ASSERT_TRUE(WaitForStats(queue, IsEmpty));
+        published.push_back(queue.Push(MakeRequest(Control, 2)));
+        published.push_back(queue.Push(MakeRequest(Control, 3)));
+
+        auto rejected = queue.Push(MakeRequest(Control, 4));
+        ASSERT_TRUE(IsReady(rejected));
+        ASSERT_EQ(UA_STATUSCODE_BADTOOMANYOPERATIONS, rejected.get());
+
+        std::vector<OPCUA::TWriteRequest> requests;
+        requests.push_back(MakeRequest(Control, 5));
+        requests.push_back(MakeRequest(Control, 6));
+        for (auto& res: queue.Push(std::move(requests))) {
+            ASSERT_TRUE(IsReady(res));
+            ASSERT_EQ(UA_STATUSCODE_BADTOOMANYOPERATIONS, res.get());
+        }
+
+        auto stats = queue.GetStats();
+        ASSERT_EQ(2, stats.Depth);
+        ASSERT_EQ(2, stats.MaxDepth);
+        ASSERT_EQ(3, stats.Rejected);
+        for (auto& res: published) {
+            ASSERT_FALSE(IsReady(res));
+        }
+        tx->End();
+    }
+
+    for (auto& res: published) {
+        ASSERT_EQ(std::future_status::ready, res.wait_for(WAIT_TIMEOUT));
+        ASSERT_EQ(UA_STATUSCODE_GOOD, res.get());
+    }
+    ASSERT_TRUE(WaitForStats(queue, [](const OPCUA::TWriteQueueStats& stats) { return stats.Published == 3; }));
+    auto stats = queue.GetStats();
+    ASSERT_EQ(3, stats.Published);
+    ASSERT_EQ(0, stats.Failed);
+    ASSERT_EQ(3, stats.Rejected);
+    ASSERT_EQ(0, stats.Timeouts);
+}
+
+// A write isn't confirmed until it is published, so a busy driver makes it time out
+TEST_F(TWriteQueueTest, wait_timeout)
+{
+    OPCUA::TServerConfig config;
+    config.WriteMode = OPCUA::TWriteMode::Wait;
+    config.WriteTimeout = std::chrono::milliseconds(50);
+    auto server = MakeServer(config);
+    auto slot = server->FindVariableNodeSlot("test/test");
+    ASSERT_NE(nullptr, slot);
+
+    UA_Double value = 1;
+    UA_DataValue dataValue;
+    UA_DataValue_init(&dataValue);
+    UA_Variant_setScalar(&dataValue.value, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+    dataValue.hasValue = true;
+
+    ASSERT_EQ(UA_STATUSCODE_GOOD, server->WriteVariable(*slot, &dataValue));
+    {
+        auto tx = Driver->BeginTx();
+        auto start = std::chrono::steady_clock::now();
+        ASSERT_EQ(UA_STATUSCODE_BADTIMEOUT, server->WriteVariable(*slot, &dataValue));
+        ASSERT_GE(std::chrono::steady_clock::now() - start, config.WriteTimeout);
+        tx->End();
+    }
+}
+
+// The write is confirmed as soon as it is queued, while the driver is busy
+TEST_F(TWriteQueueTest, enqueue_result)
+{
+    OPCUA::TServerConfig config;
+    config.WriteMode = OPCUA::TWriteMode::Enqueue;
+    config.WriteTimeout = std::chrono::seconds(10);
+    auto server = MakeServer(config);
+    auto slot = server->FindVariableNodeSlot("test/test");
+    ASSERT_NE(nullptr, slot);
+
+    UA_Double value = 1;
+    UA_DataValue dataValue;
+    UA_DataValue_init(&dataValue);
+    UA_Variant_setScalar(&dataValue.value, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+    dataValue.hasValue = true;
+    {
+        auto tx = Driver->BeginTx();
+        auto start = std::chrono::steady_clock::now();
+        ASSERT_EQ(UA_STATUSCODE_GOOD, server->WriteVariable(*slot, &dataValue));
+        ASSERT_LT(std::chrono::steady_clock::now() - start, config.WriteTimeout);
+        tx->End();
+    }
+}
+
+// Values of one Write service request in enqueue mode are published by the worker in one batch
+TEST_F(TWriteQueueTest, write_service)
+{
+    OPCUA::TServerConfig config;
+    config.BindPort = 48700;
+    config.WriteMode = OPCUA::TWriteMode::Enqueue;
+    auto server = MakeServer(config);
+
+    std::vector<std::string> nodeNames{"test/test", "test/other"};
+    std::vector<OPCUA::TNumberStorage> storage(nodeNames.size());
+    std::vector<UA_WriteValue> nodes(nodeNames.size());
+    for (size_t i = 0; i < nodeNames.size(); ++i) {
+        auto slot = server->FindVariableNodeSlot(nodeNames[i]);
+        ASSERT_NE(nullptr, slot);
+        UA_WriteValue_init(&nodes[i]);
+        nodes[i].nodeId = UA_NODEID_STRING(1, (char*)nodeNames[i].c_str());
+        nodes[i].attributeId = UA_ATTRIBUTEID_VALUE;
+        nodes[i].value.hasValue = true;
+        OPCUA::SetNumber(nodes[i].value.value, slot->ValueKind, 7 + i, storage[i]);
+    }
+    UA_WriteRequest request;
+    UA_WriteRequest_init(&request);
+    request.nodesToWrite = nodes.data();
+    request.nodesToWriteSize = nodes.size();
+
+    auto client = UA_Client_new();
+    UA_ClientConfig_setDefault(UA_Client_getConfig(client));
+    auto url = "opc.tcp://localhost:" + std::to_string(config.BindPort);
+    auto deadline = std::chrono::steady_clock::now() + WAIT_TIMEOUT;
+    auto res = UA_Client_connect(client, url.c_str());
+    // The server thread starts listening in background
+    while (res != UA_STATUSCODE_GOOD && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        res = UA_Client_connect(client, url.c_str());
+    }
+    UA_WriteResponse response;
+    UA_WriteResponse_init(&response);
+    if (res == UA_STATUSCODE_GOOD) {
+        response = UA_Client_Service_write(client, request);
+    }
+    UA_Client_disconnect(client);
+    UA_Client_delete(client);
+    ASSERT_EQ(UA_STATUSCODE_GOOD, res);
+
+    ASSERT_EQ(UA_STATUSCODE_GOOD, response.responseHeader.serviceResult);
+    ASSERT_EQ(nodes.size(), response.resultsSize);
+    for (size_t i = 0; i < response.resultsSize; ++i) {
+        ASSERT_EQ(UA_STATUSCODE_GOOD, response.results[i]);
+    }
+    UA_WriteResponse_clear(&response);
+
+    ASSERT_TRUE(WaitForStats(server->GetWriteQueue(),
+                             [](const OPCUA::TWriteQueueStats& stats) { return stats.Published == 2; }));
+    ASSERT_EQ(1, server->GetWriteQueue().GetStats().Batches);
+    ASSERT_EQ(7, Control->GetValue().As<double>());
+    ASSERT_EQ(8, OtherControl->GetValue().As<double>());
+}
+
+// GetValues method rejects unknown groups, SetValues method rejects malformed arguments
+TEST_F(TWriteQueueTest, group_values_arguments)
+{
+    OPCUA::TServerConfig config;
+    auto server = MakeServer(config);
+
+    UA_Variant output[3];
+    for (auto& variant: output) {
+        UA_Variant_init(&variant);
+    }
+    ASSERT_EQ(UA_STATUSCODE_BADNODEIDUNKNOWN, server->GetGroupValues("missing", output));
+
+    UA_String names[2] = {UA_STRING((char*)"test/test"), UA_STRING((char*)"test/other")};
+    UA_Variant values[2];
+    OPCUA::TNumberStorage storage[2];
+    for (size_t i = 0; i < 2; ++i) {
+        UA_Variant_init(&values[i]);
+        OPCUA::SetNumber(values[i], OPCUA::TValueKind::Double, 1, storage[i]);
+    }
+    UA_Variant input[2];
+    UA_Variant_init(&input[0]);
+    UA_Variant_init(&input[1]);
+
+    // Different numbers of names and values
+    UA_Variant_setArray(&input[0], names, 2, &UA_TYPES[UA_TYPES_STRING]);
+    UA_Variant_setArray(&input[1], values, 1, &UA_TYPES[UA_TYPES_VARIANT]);
+    ASSERT_EQ(UA_STATUSCODE_BADINVALIDARGUMENT, server->SetGroupValues("test", input, output));
+
+    // A scalar name instead of an array
+    UA_Variant_setScalar(&input[0], names, &UA_TYPES[UA_TYPES_STRING]);
+    ASSERT_EQ(UA_STATUSCODE_BADINVALIDARGUMENT, server->SetGroupValues("test", input, output));
+
+    // Values aren't variants
+    UA_Variant_setArray(&input[0], names, 2, &UA_TYPES[UA_TYPES_STRING]);
+    UA_Variant_setArray(&input[1], names, 2, &UA_TYPES[UA_TYPES_STRING]);
+    ASSERT_EQ(UA_STATUSCODE_BADINVALIDARGUMENT, server->SetGroupValues("test", input, output));
+    ASSERT_EQ(0, server->GetWriteQueue().GetStats().Published);
+}
+
+// GetValues method outputs names, values and statuses of the group controls only
+TEST_F(TWriteQueueTest, get_group_values)
+{
+    OPCUA::TServerConfig config;
+    config.ObjectNodes["another"].push_back(OPCUA::TVariableNodeConfig{"test/third"});
+    auto server = MakeServer(config);
+
+    UA_Variant output[3];
+    for (auto& variant: output) {
+        UA_Variant_init(&variant);
+    }
+    ASSERT_EQ(UA_STATUSCODE_GOOD, server->GetGroupValues("test", output));
+    ASSERT_TRUE(UA_Variant_hasArrayType(&output[0], &UA_TYPES[UA_TYPES_STRING]));
+    ASSERT_TRUE(UA_Variant_hasArrayType(&output[1], &UA_TYPES[UA_TYPES_VARIANT]));
+    ASSERT_TRUE(UA_Variant_hasArrayType(&output[2], &UA_TYPES[UA_TYPES_STATUSCODE]));
+    ASSERT_EQ(2, output[0].arrayLength);
+    ASSERT_EQ(2, output[1].arrayLength);
+    ASSERT_EQ(2, output[2].arrayLength);
+    auto names = (const UA_String*)output[0].data;
+    auto values = (const UA_Variant*)output[1].data;
+    auto statuses = (const UA_StatusCode*)output[2].data;
+    std::vector<std::string> nodeNames{"test/test", "test/other"};
+    for (size_t i = 0; i < nodeNames.size(); ++i) {
+        ASSERT_EQ(nodeNames[i], std::string((const char*)names[i].data, names[i].length));
+        ASSERT_EQ(UA_STATUSCODE_GOOD, statuses[i]);
+        OPCUA::TWriteValue value;
+        ASSERT_TRUE(OPCUA::GetWriteValue(value, server->FindVariableNodeSlot(nodeNames[i])->ValueKind, values[i]));
+        ASSERT_EQ(0, std::get<double>(value));
+    }
+    for (auto& variant: output) {
+        UA_Variant_clear(&variant);
+    }
+
+    // The control of the group hasn't appeared in MQTT
+    ASSERT_EQ(UA_STATUSCODE_GOOD, server->GetGroupValues("another", output));
+    ASSERT_EQ(1, output[2].arrayLength);
+    ASSERT_EQ(UA_STATUSCODE_UNCERTAININITIALVALUE, ((const UA_StatusCode*)output[2].data)[0]);
+    for (auto& variant: output) {
+        UA_Variant_clear(&variant);
+    }
+}
+
+// SetValues method publishes valid values and outputs per-control statuses for the rest
+TEST_F(TWriteQueueTest, set_group_values)
+{
+    OPCUA::TServerConfig config;
+    config.WriteMode = OPCUA::TWriteMode::Wait;
+    config.WriteTimeout = std::chrono::seconds(2);
+    config.ObjectNodes["another"].push_back(OPCUA::TVariableNodeConfig{"test/third"});
+    auto server = MakeServer(config);
+
+    // A value, a value of unsupported type, a control of another group and an unknown control
+    UA_String names[4] = {UA_STRING((char*)"test/test"),
+                          UA_STRING((char*)"test/other"),
+                          UA_STRING((char*)"test/third"),
+                          UA_STRING((char*)"test/missing")};
+    UA_Variant values[4];
+    for (auto& value: values) {
+        UA_Variant_init(&value);
+    }
+    OPCUA::TNumberStorage storage[3];
+    OPCUA::SetNumber(values[0], server->FindVariableNodeSlot("test/test")->ValueKind, 4, storage[0]);
+    UA_NodeId nodeId = UA_NODEID_NUMERIC(0, 1);
+    UA_Variant_setScalar(&values[1], &nodeId, &UA_TYPES[UA_TYPES_NODEID]);
+    OPCUA::SetNumber(values[2], OPCUA::TValueKind::Double, 5, storage[1]);
+    OPCUA::SetNumber(values[3], OPCUA::TValueKind::Double, 6, storage[2]);
+
+    UA_Variant input[2];
+    UA_Variant_init(&input[0]);
+    UA_Variant_init(&input[1]);
+    UA_Variant_setArray(&input[0], names, 4, &UA_TYPES[UA_TYPES_STRING]);
+    UA_Variant_setArray(&input[1], values, 4, &UA_TYPES[UA_TYPES_VARIANT]);
+    UA_Variant output;
+    UA_Variant_init(&output);
+    ASSERT_EQ(UA_STATUSCODE_GOOD, server->SetGroupValues("test", input, &output));
+    ASSERT_TRUE(UA_Variant_hasArrayType(&output, &UA_TYPES[UA_TYPES_STATUSCODE]));
+    ASSERT_EQ(4, output.arrayLength);
+    auto results = (const UA_StatusCode*)output.data;
+    ASSERT_EQ(UA_STATUSCODE_GOOD, results[0]);
+    ASSERT_EQ(UA_STATUSCODE_BADDATATYPEIDUNKNOWN, results[1]);
+    ASSERT_EQ(UA_STATUSCODE_BADNODEIDUNKNOWN, results[2]);
+    ASSERT_EQ(UA_STATUSCODE_BADNODEIDUNKNOWN, results[3]);
+    UA_Variant_clear(&output);
+
+    ASSERT_TRUE(WaitForStats(server->GetWriteQueue(),
+                             [](const OPCUA::TWriteQueueStats& stats) { return stats.Published == 1; }));
+    ASSERT_EQ(4, Control->GetValue().As<double>());
+    ASSERT_EQ(0, OtherControl->GetValue().As<double>());
+}
+
+// SetValues method values are queued all together or rejected all together if they don't fit into the queue
+TEST_F(TWriteQueueTest, set_group_values_full_queue)
+{
+    OPCUA::TServerConfig config;
+    config.WriteMode = OPCUA::TWriteMode::Enqueue;
+    config.WriteQueueSize = 2;
+    auto server = MakeServer(config);
+    auto slot = server->FindVariableNodeSlot("test/test");
+    ASSERT_NE(nullptr, slot);
+
+    OPCUA::TNumberStorage storage[3];
+    UA_DataValue dataValue;
+    UA_DataValue_init(&dataValue);
+    dataValue.hasValue = true;
+
+    UA_String names[2] = {UA_STRING((char*)"test/test"), UA_STRING((char*)"test/other")};
+    UA_Variant values[2];
+    for (size_t i = 0; i < 2; ++i) {
+        UA_Variant_init(&values[i]);
+        OPCUA::SetNumber(values[i], slot->ValueKind, 8 + i, storage[i]);
+    }
+    UA_Variant input[2];
+    UA_Variant_init(&input[0]);
+    UA_Variant_init(&input[1]);
+    UA_Variant_setArray(&input[0], names, 2, &UA_TYPES[UA_TYPES_STRING]);
+    UA_Variant_setArray(&input[1], values, 2, &UA_TYPES[UA_TYPES_VARIANT]);
+    {
+        // The worker takes the first value and waits for the driver, the second one occupies the queue
+        auto tx = Driver->BeginTx();
+        OPCUA::SetNumber(dataValue.value, slot->ValueKind, 1, storage[2]);
+        ASSERT_EQ(UA_STATUSCODE_GOOD, server->WriteVariable(*slot, &dataValue));
+        ASSERT_TRUE(WaitForStats(server->GetWriteQueue(), IsEmpty));
+        ASSERT_EQ(UA_STATUSCODE_GOOD, server->WriteVariable(*slot, &dataValue));
+        ASSERT_EQ(1, server->GetWriteQueue().GetStats().Depth);
+
+        // One of two values fits into the queue, both are rejected
+        UA_Variant output;
+        UA_Variant_init(&output);
+        ASSERT_EQ(UA_STATUSCODE_GOOD, server->SetGroupValues("test", input, &output));
+        ASSERT_EQ(2, output.arrayLength);
+        auto results = (const UA_StatusCode*)output.data;
+        ASSERT_EQ(UA_STATUSCODE_BADTOOMANYOPERATIONS, results[0]);
+        ASSERT_EQ(UA_STATUSCODE_BADTOOMANYOPERATIONS, results[1]);
+        UA_Variant_clear(&output);
+
+        auto stats = server->GetWriteQueue().GetStats();
+        ASSERT_EQ(1, stats.Depth);
+        ASSERT_EQ(2, stats.Rejected);
+        tx->End();
+    }
+
+    ASSERT_TRUE(WaitForStats(server->GetWriteQueue(),
+                             [](const OPCUA::TWriteQueueStats& stats) { return stats.Published == 2; }));
+    ASSERT_EQ(1, Control->GetValue().As<double>());
+    ASSERT_EQ(0, OtherControl->GetValue().As<double>());
+}